@@ -0,0 +1,96 @@
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "../../ComputationGraph/CG.hpp"
+#include "../../ComputationGraph/CGkernel.hpp"
+#include "Benchmark.hpp"
+
+/* The Affine loops before the packed kernels, for comparison */
+void referenceForward(size_t B, size_t N, size_t K, const dtype *X, const dtype *w, dtype *Y)
+{
+    for (int j=0; j<K; ++j) {
+        const dtype *wj = w + j * N;
+        for (int n=0; n<B; ++n) {
+            dtype       *y  = Y + n * N;
+            const dtype  xj = X[n * K + j];
+            for (int i=0; i<N; ++i) {
+                y[i] += wj[i] * xj;
+            }
+        }
+    }
+}
+
+void referenceBackward(size_t B, size_t N, size_t K, const dtype *X, const dtype *w, const dtype *G, dtype *dX, dtype *gw)
+{
+    for (int i=0; i<K; ++i) {
+        const dtype *wi = w + i * N;
+        for (int n=0; n<B; ++n) {
+            const dtype *g   = G + n * N;
+            dtype        sum = 0;
+            for (int j=0; j<N; ++j) {
+                sum += wi[j] * g[j];
+            }
+            dX[n * K + i] += sum;
+        }
+    }
+    for (int i=0; i<K; ++i) {
+        dtype *gwi = gw + i * N;
+        for (int n=0; n<B; ++n) {
+            const dtype *g  = G + n * N;
+            const dtype  xi = X[n * K + i];
+            for (int j=0; j<N; ++j) {
+                gwi[j] += xi * g[j];
+            }
+        }
+    }
+}
+
+int main(void) {
+
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+
+    vec1<vec1<size_t>> shapes = {{784, 64}, {64, 64}, {120, 10}};
+    vec1<size_t> batches = {1, 100};
+
+    std::cout << "kernels: " << CGK::instructionSet() << std::endl;
+    for (int s=0; s<shapes.size(); ++s) {
+        size_t K = shapes.at(s).at(0);
+        size_t N = shapes.at(s).at(1);
+        vec2<dtype> weight(K + 1, vec1<dtype>(N));
+        for (int i=0; i<=K; ++i) {
+            for (int j=0; j<N; ++j) {
+                weight.at(i).at(j) = dist(engine);
+            }
+        }
+
+        for (int b=0; b<batches.size(); ++b) {
+            size_t B = batches.at(b);
+            CG::Leaf1  input(K);
+            CG::Affine affine(&input, weight);
+            CG::setBatch(&affine, B);
+            for (int i=0; i<B*K; ++i) {
+                input.data.data()[i] = dist(engine);
+            }
+            affine.forwardStep(0);
+            for (int i=0; i<B*N; ++i) {
+                affine.getGrad()[i] = dist(engine);
+            }
+
+            vec1<dtype> Y(B * N), dX(B * K), gw((K + 1) * N);
+            const dtype *X = input.data.data();
+            const dtype *w = affine.weight.data();
+            const dtype *G = affine.grad.data();
+
+            double flop = 2.0 * B * K * N;
+            double refF = gflops(flop, [&]{ referenceForward(B, N, K, X, w, Y.data()); });
+            double newF = gflops(flop, [&]{ affine.calcData(); });
+            double refB = gflops(2 * flop, [&]{ referenceBackward(B, N, K, X, w, G, dX.data(), gw.data()); });
+            double newB = gflops(2 * flop, [&]{ affine.calcPartialDerivative(); });
+
+            std::cout << std::setw(4) << K << "x" << std::setw(3) << std::left << N << std::right << " batch " << std::setw(3) << B << std::fixed << std::setprecision(2)
+                      << " forward " << std::setw(6) << refF << " -> " << std::setw(6) << newF << " GFLOP/s"
+                      << "  backward " << std::setw(6) << refB << " -> " << std::setw(6) << newB << " GFLOP/s" << std::endl;
+        }
+    }
+}
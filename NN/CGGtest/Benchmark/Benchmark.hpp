@@ -0,0 +1,58 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include "../../ComputationGraph/Type.hpp"
+
+/* Timing and comparison helpers shared by the benchmarks of this directory */
+
+using dtype = type::dtype;
+template<typename T> using vec1 = type::vec1<T>;
+template<typename T> using vec2 = type::vec2<T>;
+
+inline double milliseconds(std::function<void()> f) // repeats f for at least 0.2 s
+{
+    size_t count = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    while (seconds < 0.2) {
+        f();
+        ++count;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return seconds * 1e3 / count;
+}
+
+inline double gflops(double flop, std::function<void()> f)
+{
+    return flop / milliseconds(f) * 1e-6;
+}
+
+inline dtype maxError(const dtype *a, const dtype *b, size_t n)
+{
+    dtype ret = 0;
+    for (size_t i=0; i<n; ++i) {
+        ret = std::max(ret, std::fabs(a[i] - b[i]));
+    }
+    return ret;
+}
+
+inline dtype maxError(const vec1<dtype> &a, const vec1<dtype> &b)
+{
+    return maxError(a.data(), b.data(), std::min(a.size(), b.size()));
+}
+
+inline dtype maxRelativeError(const vec1<dtype> &a, const vec1<dtype> &b) // relative to a, absolute below 1
+{
+    dtype ret = 0;
+    for (size_t i=0; i<std::min(a.size(), b.size()); ++i) {
+        ret = std::max(ret, std::fabs(a.at(i) - b.at(i)) / std::max<dtype>(1, std::fabs(a.at(i))));
+    }
+    return ret;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include "../../ComputationGraph/CGgenerator.hpp"
+#include "Benchmark.hpp"
+
+template<typename T> using vec3 = type::vec3<T>;
+
+/* Trains LeNet-5 with and without setCheckpointing on the same batches: the losses and every gradient
+   must agree, while the checkpointed plan holds the data of its kept steps only. The replica shares
+   the weights of the master, so only the master applies its gradients */
+
+vec1<dtype> gradients(const vec1<CG::Node*> &steps) // parameter gradients of every step, then the gradient of the input
+{
+    vec1<dtype> ret;
+    for (int i=0; i<steps.size(); ++i) {
+        if (CG::Affine *node = dynamic_cast<CG::Affine*>(steps.at(i))) {
+            ret.insert(ret.end(), node->gradWeight.data(), node->gradWeight.data() + node->gradWeight.numel());
+        }
+        if (CG::MultiConvolution2d *node = dynamic_cast<CG::MultiConvolution2d*>(steps.at(i))) {
+            ret.insert(ret.end(), node->gradKernel.data(), node->gradKernel.data() + node->gradKernel.numel());
+            ret.insert(ret.end(), node->gradBias.data(), node->gradBias.data() + node->gradBias.numel());
+        }
+    }
+    ret.insert(ret.end(), steps.front()->grad.data(), steps.front()->grad.data() + steps.front()->grad.numel());
+    return ret;
+}
+
+size_t held(const vec1<CG::Node*> &steps) // elements of data still allocated
+{
+    size_t ret = 0;
+    for (int i=0; i<steps.size(); ++i) {
+        ret += steps.at(i)->data.numel();
+    }
+    return ret;
+}
+
+bool run(size_t interval, size_t batch)
+{
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<dtype> dist(0, 1);
+
+    CGG::NN2d *full = CGG::Lenet5(28, 28);
+    vec1<CG::Node*> nodes;
+    CGG::NN2d *checkpointed = CGG::replicate(full, nodes);
+    checkpointed->setCheckpointing(interval);
+    CGE::CheckpointPlan *plan = dynamic_cast<CGE::CheckpointPlan*>(checkpointed->plan);
+
+    dtype  lossError = 0;
+    dtype  gradError = 0;
+    size_t heldFull = 0, heldCheckpointed = 0, heldKept = 0;
+    for (int n=0; n<3; ++n) {
+        vec3<dtype> data(batch, vec2<dtype>(28, vec1<dtype>(28)));
+        vec2<dtype> target(batch, vec1<dtype>(10, 0));
+        for (int b=0; b<batch; ++b) {
+            for (int i=0; i<28; ++i) {
+                for (int j=0; j<28; ++j) {
+                    data.at(b).at(i).at(j) = dist(engine);
+                }
+            }
+            target.at(b).at((n + b) % 10) = 1;
+        }
+        dtype loss0 = full->trainBatch(data, target);
+        dtype loss1 = checkpointed->trainBatch(data, target);
+        lossError = std::max(lossError, std::fabs(loss0 - loss1));
+        gradError = std::max(gradError, maxRelativeError(gradients(full->plan->steps), gradients(plan->steps)));
+
+        heldFull         = held(full->plan->steps);
+        heldCheckpointed = held(plan->steps);
+        heldKept         = 0;
+        for (int i=0; i<plan->steps.size(); ++i) {
+            heldKept += plan->keep.at(i) ? full->plan->steps.at(i)->data.numel() : 0;
+        }
+        full->update(1e-2);
+        checkpointed->update(0); // clears its gradients, the weights are shared
+    }
+
+    size_t kept = std::count(plan->keep.begin(), plan->keep.end(), true);
+    std::cout << "interval " << interval << " batch " << std::setw(3) << batch << ": " << kept << "/" << plan->steps.size() << " steps kept, held "
+              << heldFull << " -> " << heldCheckpointed << " elements" << std::scientific << std::setprecision(2)
+              << ", max loss error " << lossError << ", max gradient error " << gradError << std::endl;
+    return heldCheckpointed == heldKept && heldCheckpointed < heldFull && lossError < 1e-12 && gradError < 1e-12;
+}
+
+int main(void) {
+
+    bool ok = true;
+    for (size_t batch : {1, 10}) {
+        for (size_t interval : {0, 2, 4}) {
+            ok = run(interval, batch) && ok;
+        }
+    }
+    std::cout << (ok ? "checkpointed and full plans agree" : "MISMATCH") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include "../../ComputationGraph/CG.hpp"
+#include "Benchmark.hpp"
+
+/* Checks every convolution algorithm against the direct one and times it */
+
+struct Shape
+{
+    size_t channel, height, width, kernel, stride, padding;
+};
+
+struct Result
+{
+    vec1<dtype> output, gradInput, gradKernel;
+    dtype       gradBias;
+    double      forward, backward; // ms per call
+};
+
+Result run(Shape s, size_t batch, CG::ConvAlgorithm algorithm)
+{
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+
+    vec1<CG::Node*> inputs;
+    for (int c=0; c<s.channel; ++c) {
+        inputs.push_back(new CG::Leaf2(s.height, s.width));
+    }
+    CG::Tensor kernel({s.channel, s.kernel, s.kernel});
+    for (int i=0; i<kernel.numel(); ++i) {
+        kernel.data()[i] = dist(engine);
+    }
+    size_t height = (s.height + 2 * s.padding - s.kernel) / s.stride + 1;
+    size_t width  = (s.width  + 2 * s.padding - s.kernel) / s.stride + 1;
+    CG::Convolution2d conv(inputs, kernel, 0.5, s.stride, s.padding, s.padding, height, width);
+    conv.algorithm = algorithm;
+
+    CG::setBatch(&conv, batch);
+    for (int c=0; c<s.channel; ++c) {
+        inputs.at(c)->forwardStep(0);
+        for (int i=0; i<inputs.at(c)->data.numel(); ++i) {
+            inputs.at(c)->data.data()[i] = dist(engine);
+        }
+    }
+    conv.forwardStep(0);
+    CG::Span g = conv.getGrad();
+    for (int i=0; i<g.size(); ++i) {
+        g[i] = dist(engine);
+    }
+    conv.calcPartialDerivative();
+
+    Result r;
+    r.output     = conv.getData();
+    r.gradKernel = vec1<dtype>(conv.gradKernel.data(), conv.gradKernel.data() + conv.gradKernel.numel());
+    r.gradBias   = conv.gradBias;
+    for (int c=0; c<s.channel; ++c) {
+        vec1<dtype> gi = inputs.at(c)->getGrad();
+        r.gradInput.insert(r.gradInput.end(), gi.begin(), gi.end());
+    }
+    r.forward  = milliseconds([&]{ // new input epochs, so that cached input transforms are rebuilt as in training
+        for (int c=0; c<s.channel; ++c) {
+            inputs.at(c)->forwardStep(0);
+        }
+        conv.calcData();
+    });
+    r.backward = milliseconds([&]{ conv.calcPartialDerivative(); });
+
+    for (int c=0; c<s.channel; ++c) {
+        delete inputs.at(c);
+    }
+    return r;
+}
+
+/* A MultiConvolution2d layer over single-map inputs, as mergeSiblings builds it: every output
+   channel comes out of the same products across the input channels */
+struct Layer
+{
+    size_t inputs, outputs, height, width, kernel, padding;
+};
+
+Result runLayer(Layer s, size_t batch, CG::ConvAlgorithm algorithm, std::string &chosen)
+{
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+
+    vec1<CG::Node*> inputs;
+    for (int c=0; c<s.inputs; ++c) {
+        inputs.push_back(new CG::Leaf2(s.height, s.width));
+    }
+    CG::Tensor kernel({s.outputs, s.inputs, s.kernel, s.kernel});
+    CG::Tensor bias(vec1<size_t>{s.outputs});
+    for (int i=0; i<kernel.numel(); ++i) {
+        kernel.data()[i] = dist(engine);
+    }
+    for (int i=0; i<bias.numel(); ++i) {
+        bias.data()[i] = dist(engine);
+    }
+    size_t height = s.height + 2 * s.padding - s.kernel + 1;
+    size_t width  = s.width  + 2 * s.padding - s.kernel + 1;
+    CG::MultiConvolution2d conv(inputs, kernel, bias, CG::Tensor(), 1, s.padding, s.padding, height, width);
+    conv.algorithm = algorithm;
+
+    CG::setBatch(&conv, batch);
+    for (int c=0; c<s.inputs; ++c) {
+        inputs.at(c)->forwardStep(0);
+        for (int i=0; i<inputs.at(c)->data.numel(); ++i) {
+            inputs.at(c)->data.data()[i] = dist(engine);
+        }
+    }
+    conv.forwardStep(0);
+    CG::Span g = conv.getGrad();
+    for (int i=0; i<g.size(); ++i) {
+        g[i] = dist(engine);
+    }
+    conv.calcPartialDerivative();
+
+    Result r;
+    r.output     = conv.getData();
+    r.gradKernel = vec1<dtype>(conv.gradKernel.data(), conv.gradKernel.data() + conv.gradKernel.numel());
+    r.gradBias   = conv.gradBias.data()[0];
+    for (int c=0; c<s.inputs; ++c) {
+        vec1<dtype> gi = inputs.at(c)->getGrad();
+        r.gradInput.insert(r.gradInput.end(), gi.begin(), gi.end());
+    }
+    r.forward  = milliseconds([&]{
+        for (int c=0; c<s.inputs; ++c) {
+            inputs.at(c)->forwardStep(0);
+        }
+        conv.calcData();
+    });
+    r.backward = milliseconds([&]{ conv.calcPartialDerivative(); });
+    vec1<std::string> names = {"direct", "im2col", "winograd", "fft", "auto"};
+    chosen = names.at((int)conv.selectAlgorithm());
+
+    for (int c=0; c<s.inputs; ++c) {
+        delete inputs.at(c);
+    }
+    return r;
+}
+
+/* Single-channel convolutions reading the same input, as the per-channel C1 of LeNet-5 is parsed:
+   Auto charges each reader its share of the shared input transforms. Returns the forward time of
+   the layer and the output of its first reader */
+double runShared(size_t readers, CG::ConvAlgorithm algorithm, vec1<dtype> &output, std::string &chosen)
+{
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+
+    CG::Leaf2 input(28, 28);
+    vec1<CG::Convolution2d*> convs;
+    for (int r=0; r<readers; ++r) {
+        CG::Tensor kernel({1, 5, 5});
+        for (int i=0; i<kernel.numel(); ++i) {
+            kernel.data()[i] = dist(engine);
+        }
+        convs.push_back(new CG::Convolution2d({&input}, kernel, 0.5, 1, 2, 2, 28, 28));
+        convs.back()->algorithm = algorithm;
+        CG::setBatch(convs.back(), 10);
+    }
+    input.forwardStep(0);
+    for (int i=0; i<input.data.numel(); ++i) {
+        input.data.data()[i] = dist(engine);
+    }
+    std::function<void()> layer = [&]{ // a new input epoch, so that a shared transform is rebuilt once per layer
+        input.forwardStep(0);
+        for (int r=0; r<readers; ++r) {
+            convs.at(r)->forwardStep(0);
+        }
+    };
+    layer();
+    output = convs.at(0)->getData();
+    vec1<std::string> names = {"direct", "im2col", "winograd", "fft", "auto"};
+    chosen = names.at((int)convs.at(0)->selectAlgorithm());
+    double ret = milliseconds(layer);
+    for (int r=0; r<readers; ++r) {
+        delete convs.at(r);
+    }
+    return ret;
+}
+
+int main(void) {
+
+    vec1<Shape> shapes = {{1, 28, 28, 5, 1, 2}, {6, 14, 14, 5, 1, 0}, {16, 5, 5, 5, 1, 0}, {3, 32, 32, 3, 1, 1}, {4, 15, 15, 3, 2, 1}, {3, 64, 64, 11, 1, 5}, {1, 96, 96, 15, 2, 7}};
+    vec1<CG::ConvAlgorithm> algorithms = {CG::ConvAlgorithm::Im2col, CG::ConvAlgorithm::Winograd, CG::ConvAlgorithm::FFT, CG::ConvAlgorithm::Auto};
+    vec1<std::string>       names      = {"im2col", "winograd", "fft", "auto"};
+    size_t batch = 10;
+
+    bool ok = true;
+    for (int s=0; s<shapes.size(); ++s) {
+        Shape shape = shapes.at(s);
+        Result direct = run(shape, batch, CG::ConvAlgorithm::Direct);
+        std::cout << shape.channel << "x" << shape.height << "x" << shape.width << " kernel " << shape.kernel << "x" << shape.kernel << " stride " << shape.stride << " padding " << shape.padding << std::fixed << std::setprecision(3)
+                  << ": direct " << direct.forward << " / " << direct.backward << " ms" << std::endl;
+        for (int a=0; a<algorithms.size(); ++a) {
+            if (algorithms.at(a) == CG::ConvAlgorithm::Winograd && (shape.stride != 1 || shape.kernel > 5)) {
+                continue;
+            }
+            Result r = run(shape, batch, algorithms.at(a));
+            dtype error = std::max({maxRelativeError(direct.output, r.output), maxRelativeError(direct.gradInput, r.gradInput), maxRelativeError(direct.gradKernel, r.gradKernel), std::fabs(direct.gradBias - r.gradBias) / std::max<dtype>(1, std::fabs(direct.gradBias))});
+            ok = ok && error < 1e-9;
+            std::cout << "    " << std::setw(8) << std::left << names.at(a) << std::right << " " << r.forward << " / " << r.backward << " ms"
+                      << ", max relative error " << std::scientific << std::setprecision(2) << error << std::fixed << std::setprecision(3) << std::endl;
+        }
+    }
+    vec1<Layer> layers = {{6, 16, 14, 14, 5, 0}, {16, 32, 16, 16, 5, 2}, {32, 32, 16, 16, 3, 1}, {64, 64, 8, 8, 3, 1}, {8, 8, 64, 64, 11, 5}, {16, 16, 32, 32, 9, 4}};
+    for (int s=0; s<layers.size(); ++s) {
+        Layer layer = layers.at(s);
+        std::string chosen;
+        Result im2col = runLayer(layer, batch, CG::ConvAlgorithm::Im2col, chosen);
+        std::cout << "layer " << layer.inputs << " -> " << layer.outputs << " of " << layer.height << "x" << layer.width << " kernel " << layer.kernel << "x" << layer.kernel << " padding " << layer.padding
+                  << std::fixed << std::setprecision(3) << ": im2col " << im2col.forward << " / " << im2col.backward << " ms" << std::endl;
+        vec1<CG::ConvAlgorithm> algorithms = {CG::ConvAlgorithm::FFT, CG::ConvAlgorithm::Auto};
+        if (layer.kernel <= 5) {
+            algorithms.insert(algorithms.begin(), CG::ConvAlgorithm::Winograd);
+        }
+        for (CG::ConvAlgorithm algorithm : algorithms) {
+            Result r = runLayer(layer, batch, algorithm, chosen);
+            dtype error = std::max({maxRelativeError(im2col.output, r.output), maxRelativeError(im2col.gradInput, r.gradInput), maxRelativeError(im2col.gradKernel, r.gradKernel), std::fabs(im2col.gradBias - r.gradBias) / std::max<dtype>(1, std::fabs(im2col.gradBias))});
+            ok = ok && error < 1e-9;
+            std::cout << "    " << std::setw(8) << std::left << (algorithm == CG::ConvAlgorithm::Auto ? "auto" : chosen) << std::right << " " << r.forward << " / " << r.backward << " ms"
+                      << (algorithm == CG::ConvAlgorithm::Auto ? " (" + chosen + ")" : "") << ", max relative error " << std::scientific << std::setprecision(2) << error << std::fixed << std::setprecision(3) << std::endl;
+        }
+    }
+    for (size_t readers : {6, 16}) {
+        vec1<dtype> direct, winograd, automatic;
+        std::string chosen, unused;
+        double before    = runShared(readers, CG::ConvAlgorithm::Direct, direct, unused);
+        double shared    = runShared(readers, CG::ConvAlgorithm::Winograd, winograd, unused);
+        double after     = runShared(readers, CG::ConvAlgorithm::Auto, automatic, chosen);
+        dtype  error     = std::max(maxRelativeError(direct, winograd), maxRelativeError(direct, automatic));
+        ok = ok && error < 1e-9;
+        std::cout << readers << " readers of 1x28x28 kernel 5x5 padding 2, layer forward: direct " << std::fixed << std::setprecision(3) << before
+                  << " ms, winograd " << shared << " ms, auto (" << chosen << ") " << after << " ms" << std::endl;
+    }
+    std::cout << (ok ? "all algorithms agree" : "MISMATCH") << std::endl;
+    return ok ? 0 : 1;
+}
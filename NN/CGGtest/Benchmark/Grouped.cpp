@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include "../../ComputationGraph/CG.hpp"
+#include "Benchmark.hpp"
+
+/* Checks GroupedConvolution2d against the masked MultiConvolution2d, which multiplies the
+   unconnected pairs by zero, and times both */
+
+bool run(std::string name, CG::Tensor connection, size_t height, size_t width, size_t kernel, size_t batch)
+{
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+
+    size_t outputs = connection.size(0);
+    size_t inputs  = connection.size(1);
+
+    /* a 1x1 convolution spreads one map over the input channels */
+    CG::Leaf2 leaf(height, width);
+    CG::Tensor spread({inputs, 1, 1, 1});
+    for (int i=0; i<spread.numel(); ++i) {
+        spread.data()[i] = dist(engine);
+    }
+    CG::MultiConvolution2d input({&leaf}, spread, CG::Tensor(vec1<size_t>{inputs}), CG::Tensor());
+
+    CG::Tensor K({outputs, inputs, kernel, kernel});
+    CG::Tensor B(vec1<size_t>{outputs});
+    for (int i=0; i<K.numel(); ++i) {
+        K.data()[i] = dist(engine);
+    }
+    for (int i=0; i<B.numel(); ++i) {
+        B.data()[i] = dist(engine);
+    }
+    CG::MultiConvolution2d   dense({&input}, K, B, connection, 1, kernel/2, kernel/2, height, width);
+    CG::GroupedConvolution2d grouped({&input}, K, B, connection, 1, kernel/2, kernel/2, height, width);
+    dense.algorithm = grouped.algorithm = CG::ConvAlgorithm::Im2col; // the paths that differ
+    CG::setBatch(&dense, batch);
+    CG::setBatch(&grouped, batch);
+
+    leaf.forwardStep(0);
+    input.forwardStep(0);
+    for (int i=0; i<input.data.numel(); ++i) {
+        input.data.data()[i] = dist(engine);
+    }
+    dense.forwardStep(0);
+    grouped.forwardStep(0);
+    for (int i=0; i<dense.getGrad().size(); ++i) {
+        dense.getGrad()[i] = grouped.getGrad()[i] = dist(engine);
+    }
+    input.grad.fill(0);
+    dense.calcPartialDerivative();
+    CG::Tensor gradInput(input.grad);
+    input.grad.fill(0);
+    grouped.calcPartialDerivative();
+
+    dtype error = std::max({ maxError(dense.data.data(), grouped.data.data(), dense.data.numel())
+                           , maxError(gradInput.data(), input.grad.data(), gradInput.numel())
+                           , maxError(dense.gradBias.data(), grouped.gradBias.data(), outputs) });
+    size_t block = kernel * kernel;
+    for (int o=0; o<outputs; ++o) {
+        for (int c=0; c<inputs; ++c) { // the kernel gradients of unconnected pairs are only computed by the masked one, and dropped
+            if (connection.at(o, c) != 0) {
+                error = std::max(error, maxError(dense.gradKernel.data(o) + c * block, grouped.gradKernel.data(o) + c * block, block));
+            }
+        }
+    }
+
+    double forward0  = milliseconds([&]{ dense.calcData(); });
+    double forward1  = milliseconds([&]{ grouped.calcData(); });
+    double backward0 = milliseconds([&]{ dense.calcPartialDerivative(); });
+    double backward1 = milliseconds([&]{ grouped.calcPartialDerivative(); });
+
+    size_t pairs = 0;
+    for (int i=0; i<connection.numel(); ++i) {
+        pairs += (connection.data()[i] != 0);
+    }
+    std::cout << std::left << std::setw(24) << name << std::right << " pairs " << std::setw(4) << pairs << "/" << std::setw(4) << outputs * inputs
+              << " batch " << std::setw(3) << batch << std::fixed << std::setprecision(3)
+              << ": forward " << forward0 << " -> " << forward1 << " ms, backward " << backward0 << " -> " << backward1 << " ms"
+              << ", max error " << std::scientific << std::setprecision(2) << error << std::endl;
+    return error < 1e-10;
+}
+
+int main(void) {
+
+    vec2<dtype> table = { {1, 1, 1, 0, 0, 0}, {0, 1, 1, 1, 0, 0}, {0, 0, 1, 1, 1, 0}, {0, 0, 0, 1, 1, 1}
+                        , {1, 0, 0, 0, 1, 1}, {1, 1, 0, 0, 0, 1}, {1, 1, 1, 1, 0, 0}, {0, 1, 1, 1, 1, 0}
+                        , {0, 0, 1, 1, 1, 1}, {1, 0, 0, 1, 1, 1}, {1, 1, 0, 0, 1, 1}, {1, 1, 1, 0, 0, 1}
+                        , {1, 1, 0, 1, 1, 0}, {0, 1, 1, 0, 1, 1}, {1, 0, 1, 1, 0, 1}, {1, 1, 1, 1, 1, 1} }; // C3 of LeNet-5
+
+    bool ok = true;
+    for (size_t batch : {1, 100}) {
+        ok = run("LeNet-5 C3 14x14 5x5", CG::Tensor(table), 14, 14, 5, batch) && ok;
+        ok = run("4 groups 16x16 3x3", CG::getGroupConnection(32, 32, 4), 16, 16, 3, batch) && ok;
+        ok = run("depthwise 16x16 3x3", CG::getGroupConnection(32, 32, 32), 16, 16, 3, batch) && ok;
+    }
+    std::cout << (ok ? "grouped and masked agree" : "MISMATCH") << std::endl;
+    return ok ? 0 : 1;
+}
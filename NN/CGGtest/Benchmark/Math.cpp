@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include "../../ComputationGraph/CGkernel.hpp"
+#include "Benchmark.hpp"
+
+double ulps(dtype x, long double reference) // distance in units of the last place of the reference rounded to double
+{
+    dtype r = (dtype)reference;
+    dtype ulp = std::nextafter(std::fabs(r), INFINITY) - std::fabs(r);
+    return (double)(std::fabs((long double)x - reference) / ulp);
+}
+
+struct Function
+{
+    std::string name;
+    dtype       low;
+    dtype       high;
+    void        (*f)(const dtype*, dtype*, size_t);
+    long double (*reference)(long double);
+    double      bound; // documented in CGkernel.hpp
+};
+
+int main(void) {
+
+    std::cout << "instruction set " << CGK::instructionSet() << std::endl;
+
+    vec1<Function> functions = {
+          {"exp    ",   -708,  709, CGK::vexp,     [](long double x){ return std::exp(x); }, 1.5}
+        , {"exp    ",    -10,    0, CGK::vexp,     [](long double x){ return std::exp(x); }, 1.5} // the range of Softmax
+        , {"log    ",  1e-10,    1, CGK::vlog,     [](long double x){ return std::log(x); }, 1.0}
+        , {"log    ",      0, 1e30, CGK::vlog,     [](long double x){ return std::log(x); }, 1.0}
+        , {"tanh   ",    -10,   10, CGK::vtanh,    [](long double x){ return std::tanh(x); }, 3.0}
+        , {"tanh   ", -0.001, 0.001, CGK::vtanh,   [](long double x){ return std::tanh(x); }, 3.0}
+        , {"sigmoid",    -10,   10, CGK::vsigmoid, [](long double x){ return 1 / (1 + std::exp(-x)); }, 2.5}
+    };
+
+    size_t n = 1 << 16;
+    std::mt19937 engine(0);
+    bool ok = true;
+    for (int k=0; k<functions.size(); ++k) {
+        Function &F = functions.at(k);
+        std::uniform_real_distribution<dtype> dist(F.low, F.high);
+        vec1<dtype> x(n), y(n);
+        for (int i=0; i<n; ++i) {
+            x.at(i) = dist(engine);
+        }
+
+        CGK::setMathMode(CGK::MathMode::Exact);
+        double exact = milliseconds([&]{ F.f(x.data(), y.data(), n); });
+        CGK::setMathMode(CGK::MathMode::Fast);
+        double fast  = milliseconds([&]{ F.f(x.data(), y.data(), n); });
+
+        double error = 0;
+        for (int i=0; i<n; ++i) {
+            error = std::max(error, ulps(y.at(i), F.reference(x.at(i))));
+        }
+        ok = ok && error <= F.bound;
+
+        std::cout << F.name << " [" << F.low << ", " << F.high << "]" << std::fixed << std::setprecision(3)
+                  << ": exact " << exact << " ms, fast " << fast << " ms for " << n << " elements"
+                  << ", max error " << std::setprecision(2) << error << " ulp" << std::defaultfloat << std::endl;
+    }
+    std::cout << (ok ? "within the documented bounds" : "ERROR ABOVE THE DOCUMENTED BOUND") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "../../ComputationGraph/CG.hpp"
+#include "../../ComputationGraph/CGexecutor.hpp"
+#include "Benchmark.hpp"
+
+/* Runs the same graph with CGE::ParallelExecutor and the sequential CGE::Plan and compares the data
+   and gradient of every node. The input is read by two nodes and the hidden layer by three, so their
+   gradients are the sums of the private gradSink buffers of the executor */
+
+struct Network
+{
+    CG::Leaf1  input;
+    CG::Leaf1  target;
+    CG::Affine hidden;
+    CG::Tanh   tanh;
+    CG::Affine a, b, c;
+    CG::Affine skip;   // second reader of the input
+    CG::Add    ab;
+    CG::Sub    abc;
+    CG::Add    output;
+    CG::MSE    loss;
+
+    Network (vec1<vec2<dtype>> W)
+    : input (16), target (4), hidden (&input, W.at(0)), tanh (&hidden)
+    , a (&tanh, W.at(1)), b (&tanh, W.at(2)), c (&tanh, W.at(3)), skip (&input, W.at(4))
+    , ab (&a, &b), abc (&ab, &c), output (&abc, &skip), loss (&output, &target){}
+};
+
+vec2<dtype> randomMatrix(size_t rows, size_t columns, std::mt19937 &engine)
+{
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+    vec2<dtype> ret(rows, vec1<dtype>(columns));
+    for (int i=0; i<rows; ++i) {
+        for (int j=0; j<columns; ++j) {
+            ret.at(i).at(j) = dist(engine);
+        }
+    }
+    return ret;
+}
+
+dtype compare(const CGE::Plan &p, const CGE::Plan &q, bool gradients) // relative error over the data or the gradients of every step
+{
+    dtype ret = 0;
+    for (int i=0; i<p.steps.size(); ++i) {
+        const CG::Tensor &x = gradients ? p.steps.at(i)->grad : p.steps.at(i)->data;
+        const CG::Tensor &y = gradients ? q.steps.at(i)->grad : q.steps.at(i)->data;
+        ret = std::max(ret, maxRelativeError(vec1<dtype>(x.data(), x.data() + x.numel()), vec1<dtype>(y.data(), y.data() + y.numel())));
+    }
+    return ret;
+}
+
+dtype compareWeights(Network &x, Network &y)
+{
+    dtype ret = 0;
+    for (auto node : {&Network::hidden, &Network::a, &Network::b, &Network::c, &Network::skip}) {
+        const CG::Tensor &gx = (x.*node).gradWeight;
+        const CG::Tensor &gy = (y.*node).gradWeight;
+        ret = std::max(ret, maxRelativeError(vec1<dtype>(gx.data(), gx.data() + gx.numel()), vec1<dtype>(gy.data(), gy.data() + gy.numel())));
+    }
+    return ret;
+}
+
+bool run(size_t threads, size_t batch)
+{
+    std::mt19937 engine(0);
+    vec1<vec2<dtype>> W = {randomMatrix(17, 12, engine), randomMatrix(13, 4, engine), randomMatrix(13, 4, engine), randomMatrix(13, 4, engine), randomMatrix(17, 4, engine)};
+
+    Network sequential(W);
+    Network parallel(W);
+    CGE::Plan             planS(&sequential.loss);
+    CGE::ParallelExecutor planP(&parallel.loss, threads);
+    CG::setBatch(&sequential.loss, batch);
+    CG::setBatch(&parallel.loss, batch);
+
+    dtype dataError = 0, gradError = 0, weightError = 0;
+    for (int n=0; n<5; ++n) {
+        vec2<dtype> X = randomMatrix(batch, 16, engine);
+        vec2<dtype> Y = randomMatrix(batch, 4, engine);
+        sequential.input.getBatchInput(X);
+        sequential.target.getBatchInput(Y);
+        parallel.input.getBatchInput(X);
+        parallel.target.getBatchInput(Y);
+
+        planS.forward();
+        planP.forward();
+        dataError = std::max(dataError, compare(planS, planP, false));
+
+        planS.backward();
+        planP.backward();
+        gradError   = std::max(gradError, compare(planS, planP, true));
+        weightError = std::max(weightError, compareWeights(sequential, parallel));
+
+        planS.update(1e-2);
+        planP.update(1e-2);
+    }
+
+    std::cout << "threads " << threads << " batch " << std::setw(3) << batch << std::scientific << std::setprecision(2)
+              << ": max data error " << dataError << ", max gradient error " << gradError << ", max weight gradient error " << weightError << std::endl;
+    return dataError < 1e-12 && gradError < 1e-12 && weightError < 1e-12;
+}
+
+int main(void) {
+
+    bool ok = true;
+    for (size_t threads : {2, 4}) {
+        for (size_t batch : {1, 10}) {
+            ok = run(threads, batch) && ok;
+        }
+    }
+    std::cout << (ok ? "parallel and sequential plans agree" : "MISMATCH") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "../../ComputationGraph/CG.hpp"
+#include "Benchmark.hpp"
+
+using Span = type::Span;
+
+/* The MaxPooling2d backward pass before the argmax was recorded, for comparison: every input pixel
+   rescans the windows covering it and compares its value with their maxima */
+void referenceBackward(const CG::MaxPooling2d &pool, const unsigned int *count, const dtype *X, const dtype *Y, const dtype *G, dtype *dX)
+{
+    int bheight = pool.backward.at(0)->height;
+    int bwidth  = pool.backward.at(0)->width;
+    int height  = pool.height;
+    int width   = pool.width;
+    int sw = pool.sw, pt = pool.pt, pl = pool.pl, kheight = pool.kheight, kwidth = pool.kwidth;
+    for (int n=0; n<pool.batch; ++n) {
+        const dtype        *g     = G + n * pool.dsize;
+        const dtype        *y     = Y + n * pool.dsize;
+        const unsigned int *ties  = count + n * pool.dsize;
+        const dtype        *x     = X + n * pool.domsize;
+        dtype              *dx    = dX + n * pool.domsize;
+        for (int a=0; a<bheight; ++a) {
+            for (int b=0; b<bwidth; ++b) {
+                for (int i=(a+pt)%sw; i<kheight; i+=sw) {
+                    for (int j=(b+pl)%sw; j<kwidth; j+=sw) {
+                        int col = (a - i + pt) / sw;
+                        int row = (b - j + pl) / sw;
+                        if (   0 <= col && col < height && 0 <= row && row < width
+                            && (x[a * bwidth + b] == y[col * width + row])) {
+                            dx[a * bwidth + b] += g[col * width + row] / ties[col * width + row];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+vec1<unsigned int> countTies(const CG::MaxPooling2d &pool, const dtype *X, const dtype *Y) // inputs equal to the maximum of each window, by a rescan
+{
+    int bwidth = pool.backward.at(0)->width;
+    int bsize  = pool.domsize;
+    vec1<unsigned int> ret(pool.batch * pool.dsize, 0);
+    for (int n=0; n<pool.batch; ++n) {
+        for (int a=0; a<pool.height; ++a) {
+            for (int b=0; b<pool.width; ++b) {
+                for (int i=0; i<pool.kheight; ++i) {
+                    for (int j=0; j<pool.kwidth; ++j) {
+                        int col = a * (int)pool.sw + i - (int)pool.pt;
+                        int row = b * (int)pool.sw + j - (int)pool.pl;
+                        if (0 <= col && col < pool.domHeight && 0 <= row && row < bwidth
+                            && X[n * bsize + col * bwidth + row] == Y[n * pool.dsize + a * pool.width + b]) {
+                            ++ret.at(n * pool.dsize + a * pool.width + b);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return ret;
+}
+
+int main(void) {
+
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+
+    size_t batch = 100;
+    vec1<bool> rectified = {false, true}; // after a ReLU about half of the inputs are tied at 0
+
+    bool ok = true;
+    for (int r=0; r<rectified.size(); ++r) {
+        CG::Leaf2        input(28, 28);
+        CG::MaxPooling2d pool(&input, 2, 2, 2);
+        CG::setBatch(&pool, batch);
+        input.forwardStep(0);
+        for (int i=0; i<input.data.numel(); ++i) {
+            dtype x = dist(engine);
+            input.data.data()[i] = rectified.at(r) ? std::max<dtype>(0, x) : x;
+        }
+        pool.forwardStep(0);
+        for (int i=0; i<pool.getGrad().size(); ++i) {
+            pool.getGrad()[i] = dist(engine);
+        }
+
+        const dtype *X = input.data.data();
+        const dtype *Y = pool.data.data();
+        const dtype *G = pool.grad.data();
+        vec1<dtype> expect(input.data.numel(), 0);
+        referenceBackward(pool, pool.maxCount.at(0).data(), X, Y, G, expect.data());
+        input.grad.fill(0);
+        pool.calcPartialDerivative();
+        dtype error = 0;
+        for (int i=0; i<expect.size(); ++i) {
+            error = std::max(error, std::fabs(expect.at(i) - input.grad.data()[i]));
+        }
+        ok = ok && error < 1e-12;
+
+        vec1<dtype> dX(input.data.numel());
+        double forward = milliseconds([&]{ pool.calcData(); });
+        double before  = milliseconds([&]{ referenceBackward(pool, pool.maxCount.at(0).data(), X, Y, G, dX.data()); });
+        double after   = milliseconds([&]{ pool.calcPartialDerivative(); });
+
+        std::cout << "28x28 window 2x2 stride 2 batch " << batch << (rectified.at(r) ? " rectified" : " uniform  ") << std::fixed << std::setprecision(3)
+                  << ": forward " << forward << " ms, backward " << before << " -> " << after << " ms"
+                  << ", max error " << std::scientific << std::setprecision(2) << error << std::endl;
+    }
+
+    /* Two time steps: the backward pass of the first one must scatter to the maxima it recorded,
+       not to those of the last forward step */
+    {
+        CG::Leaf2        input(28, 28);
+        CG::MaxPooling2d pool(&input, 2, 2, 2);
+        CG::setBatch(&pool, batch);
+        vec1<vec1<dtype>> X(2), Y(2);
+        for (int t=0; t<2; ++t) {
+            input.forwardStep(t);
+            for (int i=0; i<input.data.at(t).size(); ++i) {
+                input.data.at(t)[i] = std::max<dtype>(0, dist(engine));
+            }
+            pool.forwardStep(t);
+            X.at(t).assign(input.data.at(t).begin(), input.data.at(t).end());
+            Y.at(t).assign(pool.data.at(t).begin(), pool.data.at(t).end());
+        }
+        dtype error = 0;
+        for (int t=1; t>=0; --t) {
+            pool.time = t;
+            for (int i=0; i<pool.getGrad().size(); ++i) {
+                pool.getGrad()[i] = dist(engine);
+            }
+            input.time = t;
+            Span dx = input.getGrad();
+            std::fill(dx.begin(), dx.end(), 0);
+            pool.calcPartialDerivative();
+            vec1<unsigned int> count = countTies(pool, X.at(t).data(), Y.at(t).data());
+            vec1<dtype> expect(X.at(t).size(), 0);
+            referenceBackward(pool, count.data(), X.at(t).data(), Y.at(t).data(), pool.grad.at(t).data(), expect.data());
+            for (int i=0; i<expect.size(); ++i) {
+                error = std::max(error, std::fabs(expect.at(i) - dx[i]));
+            }
+        }
+        ok = ok && error < 1e-12;
+        std::cout << "two time steps, backward in reverse: max error " << std::scientific << std::setprecision(2) << error << std::endl;
+    }
+    std::cout << (ok ? "argmax scatter agrees" : "MISMATCH") << std::endl;
+    return ok ? 0 : 1;
+}
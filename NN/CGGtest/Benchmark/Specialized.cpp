@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include "../../ComputationGraph/CG.hpp"
+#include "Benchmark.hpp"
+
+/* Times every shape of CGK::getFilterKernels against the generic loops, which run when the
+   specialized pointer of the node is cleared, and checks that both agree */
+
+struct Result
+{
+    vec1<dtype> output, gradInput, gradKernel;
+    double      forward, backward; // ms per call
+};
+
+Result measure(CG::Filter2d &node, CG::Leaf2 &input, CG::Convolution2d *conv, bool specialized)
+{
+    const CGK::FilterKernels *kernels = node.specialized;
+    if (!specialized) {
+        node.specialized = nullptr;
+    }
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+    for (int i=0; i<input.data.numel(); ++i) {
+        input.data.data()[i] = dist(engine);
+    }
+    node.calcData();
+    for (int i=0; i<node.getGrad().size(); ++i) {
+        node.getGrad()[i] = dist(engine);
+    }
+    input.grad.fill(0);
+    if (conv != nullptr) {
+        conv->gradKernel.fill(0);
+    }
+    node.calcPartialDerivative();
+
+    Result ret;
+    ret.output.assign(node.data.data(), node.data.data() + node.data.numel());
+    ret.gradInput.assign(input.grad.data(), input.grad.data() + input.grad.numel());
+    if (conv != nullptr) {
+        ret.gradKernel.assign(conv->gradKernel.data(), conv->gradKernel.data() + conv->gradKernel.numel());
+    }
+    ret.forward  = milliseconds([&]{ node.calcData(); });
+    ret.backward = milliseconds([&]{ node.calcPartialDerivative(); });
+    node.specialized = kernels;
+    return ret;
+}
+
+bool compare(std::string name, CG::Filter2d &node, CG::Leaf2 &input, CG::Convolution2d *conv, size_t batch)
+{
+    CG::setBatch(&node, batch);
+    input.forwardStep(0);
+    Result generic     = measure(node, input, conv, false);
+    Result specialized = measure(node, input, conv, true);
+    dtype  error = std::max({maxError(generic.output, specialized.output), maxError(generic.gradInput, specialized.gradInput), maxError(generic.gradKernel, specialized.gradKernel)});
+
+    std::cout << std::left << std::setw(30) << name << std::right << " batch " << std::setw(3) << batch << std::fixed << std::setprecision(3)
+              << ": forward " << generic.forward << " -> " << specialized.forward << " ms, backward " << generic.backward << " -> " << specialized.backward << " ms"
+              << ", max error " << std::scientific << std::setprecision(2) << error << std::endl;
+    return node.specialized != nullptr && error < 1e-12;
+}
+
+int main(void) {
+
+    std::mt19937 engine(1);
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+
+    bool ok = true;
+    for (size_t batch : {1, 100}) {
+        for (size_t k : {3, 5}) {
+            CG::Leaf2 input(28, 28);
+            vec1<vec1<vec1<dtype>>> kernel(1, vec1<vec1<dtype>>(k, vec1<dtype>(k)));
+            for (int i=0; i<k; ++i) {
+                for (int j=0; j<k; ++j) {
+                    kernel.at(0).at(i).at(j) = dist(engine);
+                }
+            }
+            CG::Convolution2d conv({&input}, kernel, 0, 1, 28, 28); // same padding
+            conv.algorithm = CG::ConvAlgorithm::Direct;
+            ok = compare("direct convolution " + std::to_string(k) + "x" + std::to_string(k), conv, input, &conv, batch) && ok;
+        }
+        for (size_t k : {2, 3}) {
+            CG::Leaf2 input(28, 28);
+            CG::MaxPooling2d     max(&input, k, k, 2);
+            CG::AveragePooling2d average(&input, k, k, 2);
+            ok = compare("max pooling " + std::to_string(k) + "x" + std::to_string(k) + " stride 2", max, input, nullptr, batch) && ok;
+            ok = compare("average pooling " + std::to_string(k) + "x" + std::to_string(k) + " stride 2", average, input, nullptr, batch) && ok;
+        }
+    }
+    std::cout << (ok ? "specialized and generic loops agree" : "MISMATCH") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "../../ComputationGraph/CG.hpp"
+#include "../../ComputationGraph/CGexecutor.hpp"
+#include "Benchmark.hpp"
+
+using ttype = type::ttype;
+
+/* Trains a sequence longer than the ring buffer of setWindow with truncatedBackward, and checks it
+   against the unbounded graph running backward over the same last steps: the storage must stay at
+   window slots while the losses and the weight gradients agree */
+
+struct Network
+{
+    CG::Leaf1  input;
+    CG::Leaf1  target;
+    CG::Affine hidden;
+    CG::Tanh   tanh;
+    CG::Affine output;
+    CG::MSE    loss;
+
+    Network (vec2<dtype> W1, vec2<dtype> W2)
+    : input (8), target (3), hidden (&input, W1), tanh (&hidden), output (&tanh, W2), loss (&output, &target){}
+};
+
+vec2<dtype> randomMatrix(size_t rows, size_t columns, std::mt19937 &engine)
+{
+    std::uniform_real_distribution<dtype> dist(-1, 1);
+    vec2<dtype> ret(rows, vec1<dtype>(columns));
+    for (int i=0; i<rows; ++i) {
+        for (int j=0; j<columns; ++j) {
+            ret.at(i).at(j) = dist(engine);
+        }
+    }
+    return ret;
+}
+
+int main(void) {
+
+    const ttype length = 50;
+    const ttype window = 4;
+
+    std::mt19937 engine(0);
+    vec2<dtype> W1 = randomMatrix(9, 6, engine);
+    vec2<dtype> W2 = randomMatrix(7, 3, engine);
+    vec2<dtype> X  = randomMatrix(length, 8, engine);
+    vec2<dtype> Y  = randomMatrix(length, 3, engine);
+
+    Network unbounded(W1, W2);
+    Network bounded(W1, W2);
+    CG::setWindow(&bounded.loss, window);
+    CGE::Plan planU(&unbounded.loss);
+    CGE::Plan planB(&bounded.loss);
+
+    dtype lossError = 0;
+    dtype gradError = 0;
+    for (ttype t=0; t<length; ++t) {
+        unbounded.input.getInput(X.at(t), t);
+        unbounded.target.getInput(Y.at(t), t);
+        bounded.input.getInput(X.at(t), t);
+        bounded.target.getInput(Y.at(t), t);
+        planU.forward(t);
+        planB.forward(t);
+        lossError = std::max(lossError, std::fabs(unbounded.loss.data.at(t).at(0) - bounded.loss.data.at(bounded.loss.slot(t)).at(0)));
+
+        if (t % window == window - 1) {
+            for (ttype s=t+1; s>t+1-window; --s) {
+                planU.backward(s - 1);
+            }
+            planB.truncatedBackward(t);
+            gradError = std::max({ gradError
+                                 , maxError(unbounded.hidden.gradWeight.data(), bounded.hidden.gradWeight.data(), bounded.hidden.gradWeight.numel())
+                                 , maxError(unbounded.output.gradWeight.data(), bounded.output.gradWeight.data(), bounded.output.gradWeight.numel()) });
+            planU.update(1e-2);
+            planB.update(1e-2);
+        }
+    }
+
+    size_t slots = 0;
+    vec1<CG::Node*> nodes = CG::getGraph(&bounded.loss);
+    for (int i=0; i<nodes.size(); ++i) {
+        slots = std::max({slots, nodes.at(i)->data.size(), nodes.at(i)->grad.size(), nodes.at(i)->f_count.size()});
+    }
+
+    std::cout << length << " steps, window " << window << ": time slots held " << unbounded.loss.data.size() << " -> " << slots
+              << std::scientific << std::setprecision(2) << ", max loss error " << lossError << ", max gradient error " << gradError << std::endl;
+    bool ok = slots == window && lossError < 1e-12 && gradError < 1e-12;
+    std::cout << (ok ? "ring buffer and unbounded agree" : "MISMATCH") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -1,10 +1,13 @@
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include "LoadDigits.hpp"
 #include "../../ComputationGraph/CGconverter.hpp"
 #include "../../ComputationGraph/CGgenerator.hpp"
 
+#define BATCH_SIZE 100
+
 int main(void) {
 
     vec2<dtype> data   = loadDigitsData("../../Data/Digits_data.csv");
@@ -17,8 +20,10 @@ int main(void) {
 
     for (int n=1; n<=1; ++n) {
         double loss = 0;
-        for (int i=0; i<DIGITS_TRAIN_SIZE; ++i) {
-            loss += fnn->train(data.at(i), target.at(i));
+        for (int i=0; i<DIGITS_TRAIN_SIZE; i+=BATCH_SIZE) {
+            vec2<dtype> x(data.begin() + i, data.begin() + i + BATCH_SIZE);
+            vec2<dtype> t(target.begin() + i, target.begin() + i + BATCH_SIZE);
+            loss += fnn->trainBatch(x, t);
         }
 
         int score = 0;
@@ -0,0 +1,74 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "LoadDigits.hpp"
+#include "../../ComputationGraph/CGconverter.hpp"
+#include "../../ComputationGraph/CGgenerator.hpp"
+
+#define BATCH_SIZE 10
+#define EPOCHS 10
+#define ETA 1e-3
+
+double accuracy(CGG::NN1d *fnn, vec2<dtype> &data, vec2<dtype> &target)
+{
+    vec2<dtype> x(data.begin() + DIGITS_TRAIN_SIZE, data.end());
+    vec2<dtype> y_hat = fnn->expectBatch(x);
+
+    int score = 0;
+    for (int i=0; i<DIGITS_TEST_SIZE; ++i) {
+        int expect = 0;
+        dtype max = y_hat.at(i).at(0);
+        for (int j=1; j<10; ++j) {
+            if (max < y_hat.at(i).at(j)) {
+                expect =j;
+                max = y_hat.at(i).at(j);
+            }
+        }
+        if (target.at(DIGITS_TRAIN_SIZE + i).at(expect) == 1) {
+            ++score;
+        }
+    }
+    return (double)score / 100;
+}
+
+int main(void) {
+
+    vec2<dtype> data   = loadDigitsData("../../Data/Digits_data.csv");
+    vec2<dtype> target = loadDigitsTarget("../../Data/Digits_target.csv");
+
+    vec2<dtype> trainData(data.begin(), data.begin() + DIGITS_TRAIN_SIZE);
+    vec2<dtype> trainTarget(target.begin(), target.begin() + DIGITS_TRAIN_SIZE);
+
+    /* Both runs start from the same weights */
+    CGC::Converter C;
+    C.convertAll(CGG::feedForwardReLU({784, 64, 64, 10}, "Softmax", "CEE")->loss, "Hogwild.txt");
+    CGG::NN1d* sync = CGG::parseFeedForward("Hogwild.txt");
+    CGG::NN1d* async = CGG::parseFeedForward("Hogwild.txt");
+
+    size_t threads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+    CGG::DataParallel1d synchronous(sync, threads);
+    CGG::Hogwild1d      hogwild(async, threads);
+
+    std::cout << "threads = " << threads << ", batch = " << BATCH_SIZE << std::endl;
+    for (int n=1; n<=EPOCHS; ++n) {
+        double syncLoss = 0;
+        for (int i=0; i<DIGITS_TRAIN_SIZE; i+=BATCH_SIZE * threads) {
+            size_t last = std::min<size_t>(i + BATCH_SIZE * threads, DIGITS_TRAIN_SIZE);
+            syncLoss += synchronous.trainBatch(vec2<dtype>(trainData.begin() + i, trainData.begin() + last), vec2<dtype>(trainTarget.begin() + i, trainTarget.begin() + last));
+            synchronous.update(ETA);
+        }
+        double asyncLoss = hogwild.train(trainData, trainTarget, ETA, BATCH_SIZE);
+
+        std::cout << std::setw(3) << n << ": "
+                  << "sync    loss = " << std::setw(11) << std::fixed << std::setprecision(3) << syncLoss
+                  << " accuracy = " << std::setw(7) << std::setprecision(3) << accuracy(sync, data, target) << "%"
+                  << " time = " << std::setw(8) << std::setprecision(3) << synchronous.seconds << "s" << std::endl;
+        std::cout << std::setw(3) << n << ": "
+                  << "hogwild loss = " << std::setw(11) << std::fixed << std::setprecision(3) << asyncLoss
+                  << " accuracy = " << std::setw(7) << std::setprecision(3) << accuracy(async, data, target) << "%"
+                  << " time = " << std::setw(8) << std::setprecision(3) << hogwild.seconds << "s" << std::endl;
+    }
+}
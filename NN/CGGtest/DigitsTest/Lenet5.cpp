@@ -1,6 +1,8 @@
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <thread>
 #include "LoadDigits.hpp"
 #include "../../ComputationGraph/CGconverter.hpp"
 #include "../../ComputationGraph/CGgenerator.hpp"
@@ -24,16 +26,27 @@ int main(void) {
 
     //CGG::NN2d* cnn = CGG::Lenet5(DIGITS_DATA_HEIGHT, DIGITS_DATA_WIDTH);
     CGG::NN2d* cnn = CGG::parseLenet5("CEE.txt");
+    std::cout << "fused element-wise nodes: " << cnn->fusedNodes << std::endl;
+
+    CGG::NN2d* server = CGG::parseLenet5("CEE.txt");
+    server->setInference(true);
+    server->setMemoryPlan(true);
+    std::cout << "inference memory: naive = " << server->memory->naiveBytes() << " bytes, planned = " << server->memory->plannedBytes() << " bytes" << std::endl;
+
+    CGG::DataParallel2d trainer(cnn, std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1);
 
     int x = 0;
     int y = DIGITS_TRAIN_SIZE;
 
     for (int n=1; n<=10000; ++n) {
-        double loss = 0;
+        CG::vec3<dtype> batchData(100);
+        vec2<dtype>     batchTarget(100);
         for (int i=0; i<100; ++i) {
             x = (x+1) % DIGITS_TRAIN_SIZE;
-            loss += cnn->train(data.at(x), target.at(x));
+            batchData.at(i)   = data.at(x);
+            batchTarget.at(i) = target.at(x);
         }
+        double loss = trainer.trainBatch(batchData, batchTarget);
 
         int score = 0;
         for (int i=0; i<100; ++i) {
@@ -52,8 +65,8 @@ int main(void) {
             }
         }
 
-        cnn->update(1e-3);
-        std::cout << std::setw(3) << n << ": " << "train loss = " << std::setw(9) << std::fixed << std::setprecision(5) << loss << " accuracy = " << std::setw(7) << std::fixed << std::setprecision(5) << (double)score << "%" << std::endl;
+        trainer.update(1e-3);
+        std::cout << std::setw(3) << n << ": " << "train loss = " << std::setw(9) << std::fixed << std::setprecision(5) << loss << " accuracy = " << std::setw(7) << std::fixed << std::setprecision(5) << (double)score << "%" << " samples/s = " << std::setw(9) << std::setprecision(1) << trainer.samplesPerSecond() << std::endl;
 
         if (n%10==0) {
             CGC::Converter C;
@@ -1,22 +1,63 @@
+#include <algorithm>
 #include <iostream>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <set>
+#include <typeinfo>
 #include <vector>
 #include "CG.hpp"
+#include "CGkernel.hpp"
+#include "Tensor.hpp"
 #include "Type.hpp"
 
 namespace CG
 {   
-    Node::Node (size_t domsize, size_t height, size_t width)
-    : domsize(domsize), height(height), width(width), dsize(height * width)
+    std::shared_ptr<Tensor> TransformCache::find(const vec1<size_t> &key)
     {
+        for (int i=0; i<keys.size(); ++i) {
+            if (keys.at(i) == key) {
+                return values.at(i);
+            }
+        }
+        return nullptr;
+    }
+
+    void TransformCache::insert(const vec1<size_t> &key, std::shared_ptr<Tensor> value)
+    {
+        for (int i=keys.size()-1; i>=0; --i) {
+            if (!std::equal(key.begin(), key.begin() + 2, keys.at(i).begin())) {
+                keys.erase(keys.begin() + i);
+                values.erase(values.begin() + i);
+            }
+        }
+        keys.push_back(key);
+        values.push_back(value);
+    }
+
+    void TransformCache::clear()
+    {
+        keys.clear();
+        values.clear();
+    }
+
+
+
+    Node::Node (size_t domsize, size_t height, size_t width, size_t channels)
+    : domsize(domsize), height(height), width(width), dsize(height * width), channels(channels)
+    {
+        assert (height % channels == 0);
         forward.resize(0);
 
-        data.resize(1);
-        data.at(0).resize(dsize);
-        grad.resize(1);
-        grad.at(0).resize(dsize);
+        data = Tensor({1, batch, height, width});
+        grad = Tensor({1, batch, height, width});
         f_count.resize(1);
         b_count.resize(1);
+        dataEpoch.resize(1);
+        gradEpoch.resize(1);
+        transformCache = std::make_shared<TransformCache>();
     }
 
     void Node::pushThis(Node *node) // push this as argument's forward node
@@ -25,36 +66,161 @@ namespace CG
         node->forward.push_back(this);
     }
 
-    void Node::calcData(){}
-    void Node::forwardPropagation(ttype time)
+    void Node::reserve(ttype time) // make room for the time step
     {
+        if (data.rank() == 0) { // dropped by a CheckpointPlan
+            restoreData();
+        }
         size_t T = data.size();
-        assert (T == grad.size());
-        if (T <= time) {
-            data.resize(time + 1);
-            grad.resize(time + 1);
-            for (int t=T; t<=time; ++t) {
-                data.at(t).resize(dsize);
-                grad.at(t).resize(dsize);
+        ttype  t = slot(time);
+        assert (inference || T == grad.size());
+        if (T <= t) {
+            data.resize(t + 1);
+            if (!inference) {
+                grad.resize(t + 1);
             }
-            f_count.resize(time + 1);
-            b_count.resize(time + 1);
+            f_count.resize(t + 1);
+            b_count.resize(t + 1);
+            dataEpoch.resize(t + 1);
+            gradEpoch.resize(t + 1);
         }
+    }
 
-        if (++b_count.at(time) < backward.size()) {
-            return;
-        } else { // When all the forward passes from the units in the preceding layer have been completed
-            b_count.at(time) = 0;
-        }
-        
-        for (int t=0; t<data.size(); ++t) {
-            for (int i=0; i<dsize; ++i) {
-                grad.at(t).at(i) = 0;
+    void Node::releaseData() // the activations are dropped until restoreData
+    {
+        data = Tensor();
+    }
+
+    void Node::restoreData() // contents are reset
+    {
+        data = Tensor({f_count.size(), batch, height, width});
+    }
+
+    ttype Node::slot(ttype time) const // storage index of a time step
+    {
+        return (window == 0) ? time : time % window;
+    }
+
+    void Node::setWindow(ttype window) // keeps the last window time steps, 0 keeps all
+    {
+        this->window = window;
+        if (window != 0 && data.size() > window) {
+            data.resize(window);
+            if (!inference) {
+                grad.resize(window);
             }
+            f_count.resize(window);
+            b_count.resize(window);
+            dataEpoch.resize(window);
+            gradEpoch.resize(window);
+        }
+    }
+
+    void Node::setBatch(size_t batch) // contents are reset
+    {
+        this->batch = batch;
+        if (data.rank() != 0) {
+            data.reshape({data.size(), batch, height, width});
+        }
+        if (!inference) {
+            grad.reshape({grad.size(), batch, height, width});
+        }
+    }
+
+    void Node::setInference(bool inference) // releases the gradients, or reallocates them to zero
+    {
+        this->inference = inference;
+        if (inference) {
+            grad = Tensor();
+        } else {
+            grad = Tensor({data.size(), batch, height, width});
+        }
+    }
+
+    Node* Node::replicate(vec1<Node*> /*nodes*/) // same kind over nodes, sharing the parameters
+    {
+        assert (false);
+        return nullptr;
+    }
+
+    Span Node::getData()
+    {
+        return data.at(slot(time));
+    }
+
+    Span Node::getGrad()
+    {
+        clearGrad(time);
+        return grad.at(slot(time));
+    }
+
+    void Node::clearGrad(ttype time) // zeroed on first use after a forward step
+    {
+        ttype t = slot(time);
+        if (gradEpoch.at(t) != dataEpoch.at(t)) {
+            Span g = grad.at(t);
+            std::fill(g.begin(), g.end(), 0);
+            gradEpoch.at(t) = dataEpoch.at(t);
+        }
+    }
+
+    Span Node::getDomData(size_t index)
+    {
+        return backward.at(index)->data.at(backward.at(index)->slot(time));
+    }
+
+    Span Node::getDomGrad(size_t index)
+    {
+        if (!gradSink.empty() && gradSink.at(index) != nullptr) {
+            return gradSink.at(index)->at(backward.at(index)->slot(time));
         }
+        backward.at(index)->clearGrad(time);
+        return backward.at(index)->grad.at(backward.at(index)->slot(time));
+    }
+
+    void Node::calcData(){}
+    void Node::forwardStep(ttype time) // assumes that all the preceding nodes have been calculated
+    {
+        reserve(time);
+        ++dataEpoch.at(slot(time));
 
         this->time = time;
         calcData();
+        activate();
+    }
+
+    void Node::activate() // epilogue of a fused element-wise node
+    {
+        if (activation == Activation::None) {
+            return;
+        }
+        Span y = getData();
+        if (activation == Activation::ReLU) { // a negative input leaves -0 for the mask
+            for (int i=0; i<y.size(); ++i) {
+                y[i] = (y[i] >= 0) ? y[i] + 0.0 : -0.0;
+            }
+            return;
+        }
+        for (int i=0; i<y.size(); ++i) {
+            y[i] = std::min(10.0, std::max(-10.0, y[i]));
+        }
+        if (activation == Activation::Sigmoid) {
+            CGK::vsigmoid(y.data(), y.data(), y.size());
+        } else {
+            CGK::vtanh(y.data(), y.data(), y.size());
+        }
+    }
+    void Node::forwardPropagation(ttype time)
+    {
+        reserve(time);
+
+        if (++b_count.at(slot(time)) < backward.size()) {
+            return;
+        } else { // When all the forward passes from the units in the preceding layer have been completed
+            b_count.at(slot(time)) = 0;
+        }
+        
+        forwardStep(time);
 
         for (int i=0; i<forward.size(); ++i) {
             forward.at(i)->forwardPropagation(time);
@@ -66,21 +232,47 @@ namespace CG
     }
 
     void Node::calcPartialDerivative(){}
-    void Node::backwardPropagation(ttype time)
-    {   
-        if (++f_count.at(time) < forward.size()) {
-            return;
-        } else { // When all the backpropagations from the units in the next layer have been completed
-            f_count.at(time) = 0;
-        }
-
+    void Node::backwardStep(ttype time) // assumes that all the following nodes have been differentiated
+    {
+        assert (!inference);
         if (forward.size() == 0) {
             assert (dsize == 1);
-            grad.at(time).at(0) = 1;
+            clearGrad(time);
+            for (int n=0; n<batch; ++n) {
+                grad.at(slot(time))[n] = 1;
+            }
         }
 
         this->time = time;
+        maskGradient();
         calcPartialDerivative();
+    }
+
+    void Node::maskGradient() // prologue of a fused element-wise node
+    {
+        if (activation == Activation::None) {
+            return;
+        }
+        Span  g = getGrad();
+        const dtype *y = getData().data();
+        for (int i=0; i<g.size(); ++i) {
+            switch (activation) {
+                case Activation::ReLU    : g[i] = std::signbit(y[i]) ? 0 : g[i]; break;
+                case Activation::Sigmoid : g[i] *= y[i] * (1 - y[i]);           break;
+                case Activation::Tanh    : g[i] *= 1 - y[i] * y[i];             break;
+                default : break;
+            }
+        }
+    }
+    void Node::backwardPropagation(ttype time)
+    {   
+        if (++f_count.at(slot(time)) < forward.size()) {
+            return;
+        } else { // When all the backpropagations from the units in the next layer have been completed
+            f_count.at(slot(time)) = 0;
+        }
+
+        backwardStep(time);
 
         for (int i=0; i<backward.size(); ++i) {
             backward.at(i)->backwardPropagation(time);
@@ -92,12 +284,13 @@ namespace CG
     }
 
     void Node::updateParameters(dtype eta){}
+    void Node::mergeGradients(Node* /*node*/){} // accumulates and clears the gradients of a replica
     void Node::update(dtype eta, ttype time)
     {
-        if (++f_count.at(time) < forward.size()) {
+        if (++f_count.at(slot(time)) < forward.size()) {
             return;
         } else { // When all the backpropagations from the units in the next layer have been completed
-            f_count.at(time) = 0;
+            f_count.at(slot(time)) = 0;
         }
 
         this->time = time;
@@ -120,24 +313,21 @@ namespace CG
         backward.resize(0);
     }
 
+    Node* Leaf1::replicate(vec1<Node*> /*nodes*/)
+    {
+        return new Leaf1(dsize);
+    }
+
     void Leaf1::getInput(vec1<dtype> input, ttype time)
     {
+        assert (batch == 1);
         assert (dsize == input.size());
-        size_t T = data.size();
-        if (time >= T) {
-            data.resize(time + 1);
-            grad.resize(time + 1);
-            for (int t=T; t<=time; ++t) {
-                data.at(t).resize(dsize);
-                grad.at(t).resize(dsize);
-            }
-            f_count.resize(time + 1);
-            b_count.resize(time + 1);
-        }
+        reserve(time);
 
         //data.at(time) = input;
+        dtype *y = data.at(slot(time)).data();
         for (int i=0; i<dsize; ++i) {
-            data.at(time).at(i) = input.at(i);
+            y[i] = input.at(i);
         }
     }
     void Leaf1::getInput(vec1<dtype> input)
@@ -145,6 +335,24 @@ namespace CG
         getInput(input, 0);
     }
 
+    void Leaf1::getBatchInput(vec2<dtype> input, ttype time)
+    {
+        assert (batch == input.size());
+        reserve(time);
+
+        dtype *y = data.at(slot(time)).data();
+        for (int n=0; n<batch; ++n) {
+            assert (dsize == input.at(n).size());
+            for (int i=0; i<dsize; ++i) {
+                y[n * dsize + i] = input.at(n).at(i);
+            }
+        }
+    }
+    void Leaf1::getBatchInput(vec2<dtype> input)
+    {
+        getBatchInput(input, 0);
+    }
+
 
 
     Leaf2::Leaf2 (size_t height, size_t width)
@@ -153,24 +361,21 @@ namespace CG
         backward.resize(0);
     }
 
+    Node* Leaf2::replicate(vec1<Node*> /*nodes*/)
+    {
+        return new Leaf2(height, width);
+    }
+
     void Leaf2::getInput(vec1<dtype> input, ttype time)
     {
+        assert (batch == 1);
         assert (dsize == input.size());
-        int T = data.size();
-        if (time >= T) {
-            data.resize(time + 1);
-            grad.resize(time + 1);
-            for (int t=T-1; t<=time; ++t) {
-                data.at(t).resize(dsize);
-                grad.at(t).resize(dsize);
-            }
-            f_count.resize(time + 1);
-            b_count.resize(time + 1);
-        }
+        reserve(time);
 
         //data.at(time) = input;
+        dtype *y = data.at(slot(time)).data();
         for (int i=0; i<dsize; ++i) {
-            data.at(time).at(i) = input.at(i);
+            y[i] = input.at(i);
         }
     }
     void Leaf2::getInput(vec1<dtype> input)
@@ -180,23 +385,15 @@ namespace CG
 
     void Leaf2::getInput(vec2<dtype> input, ttype time)
     {
+        assert (batch == 1);
         assert (height == input.size());
-        int T = data.size();
-        if (time >= T) {
-            data.resize(time + 1);
-            grad.resize(time + 1);
-            for (int t=T-1; t<=time; ++t) {
-                data.at(t).resize(dsize);
-                grad.at(t).resize(dsize);
-            }
-            f_count.resize(time + 1);
-            b_count.resize(time + 1);
-        }
+        reserve(time);
 
+        dtype *y = data.at(slot(time)).data();
         for (int i=0; i<height; ++i) {
             assert (input.at(i).size() == width);
             for (int j=0; j<width; ++j) {
-                data.at(time).at(i * width + j) = input.at(i).at(j);
+                y[i * width + j] = input.at(i).at(j);
             }
         }
     }
@@ -205,6 +402,27 @@ namespace CG
         getInput(input, 0);
     }
 
+    void Leaf2::getBatchInput(vec3<dtype> input, ttype time)
+    {
+        assert (batch == input.size());
+        reserve(time);
+
+        dtype *y = data.at(slot(time)).data();
+        for (int n=0; n<batch; ++n) {
+            assert (height == input.at(n).size());
+            for (int i=0; i<height; ++i) {
+                assert (input.at(n).at(i).size() == width);
+                for (int j=0; j<width; ++j) {
+                    y[n * dsize + i * width + j] = input.at(n).at(i).at(j);
+                }
+            }
+        }
+    }
+    void Leaf2::getBatchInput(vec3<dtype> input)
+    {
+        getBatchInput(input, 0);
+    }
+
 
 
     Concatenation::Concatenation (vec1<Node*> nodes)
@@ -229,36 +447,113 @@ namespace CG
     int Concatenation::whichNode(size_t index)
     {
         assert (index < domsize);
-        for (int i=0; i<backward.size()-1; ++i) {
-            if (dataSize.at(i) <= index && index < dataSize.at(i+1)) {
-                return i;
+        return std::upper_bound(dataSize.begin(), dataSize.end(), index) - dataSize.begin() - 1;
+    }
+
+    /* With one sample and one time step, an input read by nothing else keeps its data and gradient
+       inside ours. calcData renews the alias when either side was reallocated */
+    void Concatenation::alias()
+    {
+        if (batch != 1 || data.size() != 1 || inference) {
+            return;
+        }
+        for (int i=0; i<backward.size(); ++i) {
+            Node *node = backward.at(i);
+            if (node->forward.size() != 1 || node->data.size() != 1 || node->inference || node->data.data() == data.data() + dataSize.at(i)) {
+                continue;
             }
+            node->data.view(data, node->data.shape, dataSize.at(i)); // already filled by calcData
+            node->grad.view(grad, node->grad.shape, dataSize.at(i));
         }
-        return backward.size() - 1;
     }
 
-    void Concatenation::calcData()
+    Node* Concatenation::replicate(vec1<Node*> nodes)
+    {
+        return new Concatenation(nodes);
+    }
+
+    void Concatenation::calcData() // one block per input and sample
     {
-        for (int i=0; i<domsize; ++i) {
-            int index = whichNode(i);
-            size_t remain = i - dataSize.at(index);
-            data.at(time).at(i) = backward.at(index)->data.at(time).at(remain);
+        dtype *y = getData().data();
+        for (int i=0; i<backward.size(); ++i) {
+            const dtype *x    = getDomData(i).data();
+            const size_t size = backward.at(i)->dsize;
+            if (x == y + dataSize.at(i)) {
+                continue;
+            }
+            for (int n=0; n<batch; ++n) {
+                std::copy(x + n * size, x + (n + 1) * size, y + n * dsize + dataSize.at(i));
+            }
         }
+        alias();
     }
 
     void Concatenation::calcPartialDerivative()
     {
-        for (int i=0; i<domsize; ++i) {
-            int index = whichNode(i);
-            size_t remain = i - dataSize.at(index);
-            backward.at(index)->grad.at(time).at(remain) = grad.at(time).at(i);
+        const dtype *g = getGrad().data();
+        for (int i=0; i<backward.size(); ++i) {
+            Node *node = backward.at(i);
+            const size_t size = node->dsize;
+            const ttype  t    = node->slot(time);
+            if (   (gradSink.empty() || gradSink.at(i) == nullptr)
+                && node->grad.rank() != 0 && node->grad.data(t) == g + dataSize.at(i)) { // already holds its gradient
+                node->gradEpoch.at(t) = node->dataEpoch.at(t);
+                continue;
+            }
+            dtype *dx = getDomGrad(i).data();
+            for (int n=0; n<batch; ++n) {
+                const dtype *gn = g + n * dsize + dataSize.at(i);
+                for (int k=0; k<size; ++k) {
+                    dx[n * size + k] += gn[k];
+                }
+            }
+        }
+    }
+
+
+
+    Channel::Channel (Node *node1, size_t index)
+    : Node (node1->dsize, node1->height / node1->channels, node1->width), index(index)
+    {
+        assert (index < node1->channels);
+
+        backward.resize(1);
+        backward.at(0) = node1;
+
+        pushThis(node1);
+    }
+
+    Node* Channel::replicate(vec1<Node*> nodes)
+    {
+        return new Channel(nodes.at(0), index);
+    }
+
+    void Channel::calcData()
+    {
+        size_t channels = backward.at(0)->channels;
+        const dtype *x = getDomData(0).data();
+        dtype       *y = getData().data();
+        for (int n=0; n<batch; ++n) {
+            std::copy(x + (n * channels + index) * dsize, x + (n * channels + index + 1) * dsize, y + n * dsize);
+        }
+    }
+
+    void Channel::calcPartialDerivative()
+    {
+        size_t channels = backward.at(0)->channels;
+        const dtype *g  = getGrad().data();
+        dtype       *dx = getDomGrad(0).data();
+        for (int n=0; n<batch; ++n) {
+            for (int i=0; i<dsize; ++i) {
+                dx[(n * channels + index) * dsize + i] += g[n * dsize + i];
+            }
         }
     }
 
 
 
     MMtoM::MMtoM (Node *node1, Node *node2)
-    : Node (node1->dsize, node1->height, node1->width)
+    : Node (node1->dsize, node1->height, node1->width, node1->channels)
     {   
         assert (node1->dsize == node2->dsize);
         assert (node1->height == node2->height);
@@ -292,7 +587,7 @@ namespace CG
 
 
     MtoM::MtoM (Node *node1)
-    : Node (node1->dsize, node1->height, node1->width)
+    : Node (node1->dsize, node1->height, node1->width, node1->channels)
     {
         backward.resize(1);
         backward.at(0) = node1;
@@ -313,15 +608,17 @@ namespace CG
 
 
 
-    Filter2d::Filter2d (vec1<Node*> nodes, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width)
-    : Node (nodes.at(0)->dsize, height, width), kheight(kernelHeight), kwidth(kernelWidth), pt(topPadding), pl(leftPadding), sw(stride)
+    Filter2d::Filter2d (vec1<Node*> nodes, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width, size_t channels) // height and width of one output map
+    : Node (nodes.at(0)->dsize, channels * height, width, channels), kheight(kernelHeight), kwidth(kernelWidth), pt(topPadding), pl(leftPadding), sw(stride)
+    , mapHeight(height), domHeight(nodes.at(0)->height / nodes.at(0)->channels)
     {
         size_t channel = nodes.size();
 
         for (int c=0; c<channel; ++c) {
-            assert (kernelHeight <= nodes.at(c)->height);
+            assert (kernelHeight <= nodes.at(c)->height / nodes.at(c)->channels);
             assert (kernelWidth  <= nodes.at(c)->width);
             assert (nodes.at(c)->height * nodes.at(c)->width == nodes.at(c)->dsize);
+            assert (nodes.at(c)->height / nodes.at(c)->channels == domHeight);
         }
 
         backward.resize(channel);
@@ -329,11 +626,43 @@ namespace CG
             backward.at(c) = nodes.at(c);
             pushThis(nodes.at(c));
         }
+
+        getInterior(sw, pt, kheight, domHeight, height, interiorTop,  interiorBottom);
+        getInterior(sw, pl, kwidth,  nodes.at(0)->width,  width,  interiorLeft, interiorRight);
+        specialized = CGK::getFilterKernels(kheight, kwidth, sw);
+    }
+
+    void Filter2d::getInterior(int sw, int padding, int kernel, int bsize, int size, int &first, int &last) // outputs whose window is inside [0, bsize)
+    {
+        first = std::min(size, (padding + sw - 1) / sw);
+        last  = (bsize + padding < kernel) ? 0 : std::min(size, (bsize + padding - kernel) / sw + 1);
+        last  = std::max(first, last);
+    }
+
+    static dtype dotClamped(const dtype *x, int start, int bsize, const dtype *k, int kernel) // sum_j k[j] x[start + j] over the taps inside [0, bsize)
+    {
+        int first = std::max(0, -start);
+        int last  = std::min(kernel, bsize - start);
+        dtype sum = 0;
+        for (int j=first; j<last; ++j) {
+            sum += k[j] * x[start + j];
+        }
+        return sum;
+    }
+
+    static void scatterClamped(const dtype *x, dtype *dx, int start, int bsize, const dtype *k, dtype *gk, int kernel, dtype g) // both gradients of one kernel row
+    {
+        int first = std::max(0, -start);
+        int last  = std::min(kernel, bsize - start);
+        for (int j=first; j<last; ++j) {
+            dx[start + j] += k[j] * g;
+            gk[j]         += x[start + j] * g;
+        }
     }
 
     bool Filter2d::inDomain(int col, int row)
     {
-        size_t bheight = backward.at(0)->height;
+        size_t bheight = domHeight;
         size_t bwidth  = backward.at(0)->width;
         if (0 <= col && col < bheight && 0 <= row && row < bwidth) {
             return true;
@@ -346,7 +675,7 @@ namespace CG
     {
         size_t bwidth  = backward.at(index)->width;
         if (inDomain(col, row)) {
-            return backward.at(index)->data.at(time).at(col * bwidth + row);
+            return getDomData(index)[col * bwidth + row];
         } else {
             return 0;
         }
@@ -361,18 +690,29 @@ namespace CG
 
     Add::Add (Node *node1, Node *node2) : MMtoM (node1, node2){};
 
+    Node* Add::replicate(vec1<Node*> nodes)
+    {
+        return new Add(nodes.at(0), nodes.at(1));
+    }
+
     void Add::calcData()
     {
-        for (int i=0; i<domsize; ++i) {
-            data.at(time).at(i) = backward.at(0)->data.at(time).at(i) + backward.at(1)->data.at(time).at(i);
+        dtype       *y  = getData().data();
+        const dtype *x0 = getDomData(0).data();
+        const dtype *x1 = getDomData(1).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            y[i] = x0[i] + x1[i];
         }
     }
 
     void Add::calcPartialDerivative()
     {   
-        for (int i=0; i<domsize; ++i) {
-            backward.at(0)->grad.at(time).at(i) += 1 * grad.at(time).at(i);
-            backward.at(1)->grad.at(time).at(i) += 1 * grad.at(time).at(i);
+        const dtype *g   = getGrad().data();
+        dtype       *dx0 = getDomGrad(0).data();
+        dtype       *dx1 = getDomGrad(1).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            dx0[i] += 1 * g[i];
+            dx1[i] += 1 * g[i];
         }
     }
 
@@ -380,18 +720,29 @@ namespace CG
 
     Sub::Sub (Node *node1, Node *node2) : MMtoM (node1, node2){};
 
+    Node* Sub::replicate(vec1<Node*> nodes)
+    {
+        return new Sub(nodes.at(0), nodes.at(1));
+    }
+
     void Sub::calcData()
     {
-        for (int i=0; i<domsize; ++i) {
-            data.at(time).at(i) = backward.at(0)->data.at(time).at(i) - backward.at(1)->data.at(time).at(i);
+        dtype       *y  = getData().data();
+        const dtype *x0 = getDomData(0).data();
+        const dtype *x1 = getDomData(1).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            y[i] = x0[i] - x1[i];
         }
     }
 
     void Sub::calcPartialDerivative()
     {
-        for (int i=0; i<domsize; ++i) {
-            backward.at(0)->grad.at(time).at(i) +=  1 * grad.at(time).at(i);
-            backward.at(1)->grad.at(time).at(i) += -1 * grad.at(time).at(i);
+        const dtype *g   = getGrad().data();
+        dtype       *dx0 = getDomGrad(0).data();
+        dtype       *dx1 = getDomGrad(1).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            dx0[i] +=  1 * g[i];
+            dx1[i] += -1 * g[i];
         }
     }
 
@@ -399,19 +750,36 @@ namespace CG
 
     Dots::Dots (Node *node1, Node *node2) : MMto1 (node1, node2){};
 
+    Node* Dots::replicate(vec1<Node*> nodes)
+    {
+        return new Dots(nodes.at(0), nodes.at(1));
+    }
+
     void Dots::calcData()
     {   
-        data.at(time).at(0) = 0;
-        for (int i=0; i<domsize; ++i) {
-            data.at(time).at(0) += backward.at(0)->data.at(time).at(i) * backward.at(1)->data.at(time).at(i);
+        for (int n=0; n<batch; ++n) {
+            const dtype *x0 = getDomData(0).data() + n * domsize;
+            const dtype *x1 = getDomData(1).data() + n * domsize;
+            dtype sum = 0;
+            for (int i=0; i<domsize; ++i) {
+                sum += x0[i] * x1[i];
+            }
+            getData()[n] = sum;
         }
     }
 
     void Dots::calcPartialDerivative()
     {
-        for (int i=0; i<domsize; ++i) {
-            backward.at(0)->grad.at(time).at(i) += backward.at(1)->data.at(time).at(i) * grad.at(time).at(0);
-            backward.at(1)->grad.at(time).at(i) += backward.at(0)->data.at(time).at(i) * grad.at(time).at(0);
+        for (int n=0; n<batch; ++n) {
+            const dtype  g   = getGrad()[n];
+            const dtype *x0  = getDomData(0).data() + n * domsize;
+            const dtype *x1  = getDomData(1).data() + n * domsize;
+            dtype       *dx0 = getDomGrad(0).data() + n * domsize;
+            dtype       *dx1 = getDomGrad(1).data() + n * domsize;
+            for (int i=0; i<domsize; ++i) {
+                dx0[i] += x1[i] * g;
+                dx1[i] += x0[i] * g;
+            }
         }
     }
 
@@ -419,22 +787,38 @@ namespace CG
 
     MSE::MSE (Node *node1, Node *node2) : MMto1 (node1, node2){};
 
+    Node* MSE::replicate(vec1<Node*> nodes)
+    {
+        return new MSE(nodes.at(0), nodes.at(1));
+    }
+
     void MSE::calcData()
     {   
-        data.at(time).at(0) = 0;
-        for (int i=0; i<domsize; ++i) {
-            dtype err = backward.at(0)->data.at(time).at(i) - backward.at(1)->data.at(time).at(i);
-            data.at(time).at(0) += err * err;
+        for (int n=0; n<batch; ++n) {
+            const dtype *x0 = getDomData(0).data() + n * domsize;
+            const dtype *x1 = getDomData(1).data() + n * domsize;
+            dtype sum = 0;
+            for (int i=0; i<domsize; ++i) {
+                dtype err = x0[i] - x1[i];
+                sum += err * err;
+            }
+            getData()[n] = sum / domsize;
         }
-        data.at(time).at(0) /= domsize;
     }
 
     void MSE::calcPartialDerivative()
     {
-        for (int i=0; i<domsize; ++i) {
-            dtype err = backward.at(0)->data.at(time).at(i) - backward.at(1)->data.at(time).at(i);
-            backward.at(0)->grad.at(time).at(i) +=   2 * err * grad.at(time).at(0) / domsize;
-            backward.at(1)->grad.at(time).at(i) += - 2 * err * grad.at(time).at(0) / domsize;
+        for (int n=0; n<batch; ++n) {
+            const dtype  g   = getGrad()[n];
+            const dtype *x0  = getDomData(0).data() + n * domsize;
+            const dtype *x1  = getDomData(1).data() + n * domsize;
+            dtype       *dx0 = getDomGrad(0).data() + n * domsize;
+            dtype       *dx1 = getDomGrad(1).data() + n * domsize;
+            for (int i=0; i<domsize; ++i) {
+                dtype err = x0[i] - x1[i];
+                dx0[i] +=   2 * err * g / domsize;
+                dx1[i] += - 2 * err * g / domsize;
+            }
         }
     }
 
@@ -442,21 +826,108 @@ namespace CG
 
     CEE::CEE (Node *node1, Node *node2) : MMto1 (node1, node2){};
 
+    Node* CEE::replicate(vec1<Node*> nodes)
+    {
+        return new CEE(nodes.at(0), nodes.at(1));
+    }
+
     void CEE::calcData()
     {
-        data.at(time).at(0) = 0;
-        for (int i=0; i<domsize; ++i) {
-            dtype d1 = std::max(backward.at(0)->data.at(time).at(i), 1e-10);
-            data.at(time).at(0) -= backward.at(1)->data.at(time).at(i) * std::log(d1);
+        vec1<dtype> logp(domsize);
+        for (int n=0; n<batch; ++n) {
+            const dtype *x0 = getDomData(0).data() + n * domsize;
+            const dtype *x1 = getDomData(1).data() + n * domsize;
+            for (int i=0; i<domsize; ++i) {
+                logp[i] = std::max(x0[i], 1e-10);
+            }
+            CGK::vlog(logp.data(), logp.data(), domsize);
+            dtype sum = 0;
+            for (int i=0; i<domsize; ++i) {
+                sum -= x1[i] * logp[i];
+            }
+            getData()[n] = sum;
+        }
+    }
+
+    void CEE::calcPartialDerivative() // through the same clamp as the loss
+    {
+        vec1<dtype> d1(domsize), logp(domsize);
+        for (int n=0; n<batch; ++n) {
+            const dtype  g   = getGrad()[n];
+            const dtype *x0  = getDomData(0).data() + n * domsize;
+            const dtype *x1  = getDomData(1).data() + n * domsize;
+            dtype       *dx0 = getDomGrad(0).data() + n * domsize;
+            dtype       *dx1 = getDomGrad(1).data() + n * domsize;
+            for (int i=0; i<domsize; ++i) {
+                d1[i] = std::max(x0[i], 1e-10);
+            }
+            CGK::vlog(d1.data(), logp.data(), domsize);
+            for (int i=0; i<domsize; ++i) {
+                dx0[i] -= x1[i] / d1[i] * g;
+                dx1[i] -= logp[i] * g;
+            }
+        }
+    }
+
+
+
+    SoftmaxCrossEntropy::SoftmaxCrossEntropy (Node *node1, Node *node2) : MMto1 (node1, node2){};
+
+    Node* SoftmaxCrossEntropy::replicate(vec1<Node*> nodes)
+    {
+        return new SoftmaxCrossEntropy(nodes.at(0), nodes.at(1));
+    }
+
+    static dtype logSumExp(const dtype *x, size_t size, dtype *buffer) // max + log sum exp(x - max), which cannot overflow
+    {
+        dtype max = x[0];
+        for (int i=1; i<size; ++i) {
+            max = std::max(max, x[i]);
+        }
+        for (int i=0; i<size; ++i) {
+            buffer[i] = x[i] - max;
+        }
+        CGK::vexp(buffer, buffer, size);
+        dtype sum = 0;
+        for (int i=0; i<size; ++i) {
+            sum += buffer[i];
+        }
+        return max + std::log(sum);
+    }
+
+    void SoftmaxCrossEntropy::calcData() // - sum y log p with log p = x - logSumExp(x)
+    {
+        vec1<dtype> buffer(domsize);
+        for (int n=0; n<batch; ++n) {
+            const dtype *x0  = getDomData(0).data() + n * domsize;
+            const dtype *x1  = getDomData(1).data() + n * domsize;
+            const dtype  lse = logSumExp(x0, domsize, buffer.data());
+            dtype sum = 0;
+            for (int i=0; i<domsize; ++i) {
+                sum -= x1[i] * (x0[i] - lse);
+            }
+            getData()[n] = sum;
         }
     }
 
-    void CEE::calcPartialDerivative()
+    void SoftmaxCrossEntropy::calcPartialDerivative() // p sum y - y, i.e. p - y for a one-hot target
     {
-        for (int i=0; i<domsize; ++i) {
-            dtype d1 = std::max(backward.at(0)->data.at(time).at(i), 1e-10);
-            backward.at(0)->grad.at(time).at(i) -= backward.at(1)->data.at(time).at(i) / d1 * grad.at(time).at(0);
-            backward.at(1)->grad.at(time).at(i) -= std::log(backward.at(0)->data.at(time).at(i)) * grad.at(time).at(0);
+        vec1<dtype> p(domsize);
+        for (int n=0; n<batch; ++n) {
+            const dtype  g   = getGrad()[n];
+            const dtype *x0  = getDomData(0).data() + n * domsize;
+            const dtype *x1  = getDomData(1).data() + n * domsize;
+            dtype       *dx0 = getDomGrad(0).data() + n * domsize;
+            const dtype  lse = logSumExp(x0, domsize, p.data());
+            dtype mass = 0;
+            for (int i=0; i<domsize; ++i) {
+                mass += x1[i];
+                p[i] = x0[i] - lse;
+            }
+            CGK::vexp(p.data(), p.data(), domsize);
+            for (int i=0; i<domsize; ++i) {
+                dx0[i] += (p[i] * mass - x1[i]) * g;
+            }
         }
     }
 
@@ -464,17 +935,27 @@ namespace CG
     
     ReLU::ReLU (Node *node1) : MtoM (node1){};
 
+    Node* ReLU::replicate(vec1<Node*> nodes)
+    {
+        return new ReLU(nodes.at(0));
+    }
+
     void ReLU::calcData()
     {
-        for (int i=0; i<domsize; ++i) {
-            data.at(time).at(i) = (backward.at(0)->data.at(time).at(i) >= 0) ? backward.at(0)->data.at(time).at(i) : 0;
+        dtype       *y = getData().data();
+        const dtype *x = getDomData(0).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            y[i] = (x[i] >= 0) ? x[i] : 0;
         }
     }
 
     void ReLU::calcPartialDerivative()
     {
-        for (int i=0; i<domsize; ++i) {
-            backward.at(0)->grad.at(time).at(i) += (backward.at(0)->data.at(time).at(i) >= 0) ? 1 * grad.at(time).at(i) : 0;
+        const dtype *g  = getGrad().data();
+        const dtype *x  = getDomData(0).data();
+        dtype       *dx = getDomGrad(0).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            dx[i] += (x[i] >= 0) ? 1 * g[i] : 0;
         }
     }
 
@@ -482,37 +963,56 @@ namespace CG
 
     Sigmoid::Sigmoid (Node *node1) : MtoM (node1){};
 
+    Node* Sigmoid::replicate(vec1<Node*> nodes)
+    {
+        return new Sigmoid(nodes.at(0));
+    }
+
     void Sigmoid::calcData()
     {
-        for (int i=0; i<domsize; ++i) {
-            dtype x = std::min(10.0, std::max(-10.0, backward.at(0)->data.at(time).at(i)));
-            data.at(time).at(i) = 1 / (1 + std::exp(-x));
+        dtype       *y = getData().data();
+        const dtype *x = getDomData(0).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            y[i] = std::min(10.0, std::max(-10.0, x[i]));
         }
+        CGK::vsigmoid(y, y, batch * domsize);
     }
 
     void Sigmoid::calcPartialDerivative()
     {
-        for (int i=0; i<domsize; ++i) {
-            backward.at(0)->grad.at(time).at(i) = data.at(time).at(i) * (1 - (data.at(time).at(i))) * grad.at(time).at(i);
+        const dtype *g  = getGrad().data();
+        const dtype *y  = getData().data();
+        dtype       *dx = getDomGrad(0).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            dx[i] = y[i] * (1 - y[i]) * g[i];
         }
     }
 
 
     Tanh::Tanh (Node *node1) : MtoM (node1){};
 
+    Node* Tanh::replicate(vec1<Node*> nodes)
+    {
+        return new Tanh(nodes.at(0));
+    }
+
     void Tanh::calcData()
     {
-        for (int i=0; i<domsize; ++i) {
-            dtype x = std::min(10.0, std::max(-10.0, backward.at(0)->data.at(time).at(i)));
-            dtype e2x = std::exp(2 * x);
-            data.at(time).at(i) = (e2x - 1) / (e2x + 1);
+        dtype       *y = getData().data();
+        const dtype *x = getDomData(0).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            y[i] = std::min(10.0, std::max(-10.0, x[i]));
         }
+        CGK::vtanh(y, y, batch * domsize);
     }
 
     void Tanh::calcPartialDerivative()
     {
-        for (int i=0; i<domsize; ++i) {
-            backward.at(0)->grad.at(time).at(i) = (1 - (data.at(time).at(i)) * (data.at(time).at(i))) * grad.at(time).at(i);
+        const dtype *g  = getGrad().data();
+        const dtype *y  = getData().data();
+        dtype       *dx = getDomGrad(0).data();
+        for (int i=0; i<batch * domsize; ++i) {
+            dx[i] = (1 - y[i] * y[i]) * g[i];
         }
     }
 
@@ -520,33 +1020,50 @@ namespace CG
 
     Softmax::Softmax (Node *node1) : MtoM (node1){}
 
-    void Softmax::calcData()
+    Node* Softmax::replicate(vec1<Node*> nodes)
     {
-        dtype max = backward.at(0)->data.at(time).at(0);
-        for (int i=1; i<domsize; ++i) {
-            max = std::max(max, backward.at(0)->data.at(time).at(i));
-        }
-
-        dtype sum = 0;
-        for (int i=0; i<domsize; ++i) {
-            dtype z = std::max(backward.at(0)->data.at(time).at(i)-max, -10.0);
-            sum += std::exp(z);
-        }
-
-        for (int i=0; i<domsize; ++i) {
-            dtype z = std::max(backward.at(0)->data.at(time).at(i)-max, -10.0);
-            data.at(time).at(i) = std::exp(z) / sum;
-        }
+        return new Softmax(nodes.at(0));
     }
 
-    void Softmax::calcPartialDerivative() 
+    void Softmax::calcData()
     {
-        for (int i=0; i<domsize; ++i) {
-            for (int j=0; j<domsize; ++j) {
-                if (i == j) {
-                    backward.at(0)->grad.at(time).at(i) += data.at(time).at(j) * (1 - data.at(time).at(i)) * grad.at(time).at(j);
-                } else {
-                    backward.at(0)->grad.at(time).at(i) -= data.at(time).at(j) *      data.at(time).at(i)  * grad.at(time).at(j);
+        for (int n=0; n<batch; ++n) {
+            dtype       *y = getData().data() + n * dsize;
+            const dtype *x = getDomData(0).data() + n * domsize;
+
+            dtype max = x[0];
+            for (int i=1; i<domsize; ++i) {
+                max = std::max(max, x[i]);
+            }
+
+            for (int i=0; i<domsize; ++i) {
+                y[i] = std::max(x[i] - max, -10.0);
+            }
+            CGK::vexp(y, y, domsize);
+
+            dtype sum = 0;
+            for (int i=0; i<domsize; ++i) {
+                sum += y[i];
+            }
+            for (int i=0; i<domsize; ++i) {
+                y[i] /= sum;
+            }
+        }
+    }
+
+    void Softmax::calcPartialDerivative() 
+    {
+        for (int n=0; n<batch; ++n) {
+            const dtype *g  = getGrad().data() + n * dsize;
+            const dtype *y  = getData().data() + n * dsize;
+            dtype       *dx = getDomGrad(0).data() + n * domsize;
+            for (int i=0; i<domsize; ++i) {
+                for (int j=0; j<domsize; ++j) {
+                    if (i == j) {
+                        dx[i] += y[j] * (1 - y[i]) * g[j];
+                    } else {
+                        dx[i] -= y[j] *      y[i]  * g[j];
+                    }
                 }
             }
         }
@@ -556,39 +1073,46 @@ namespace CG
 
     Norm2::Norm2 (Node *node1) : Mto1 (node1){};
 
+    Node* Norm2::replicate(vec1<Node*> nodes)
+    {
+        return new Norm2(nodes.at(0));
+    }
+
     void Norm2::calcData()
     {
-        data.at(time).at(0) = 0;
-        for (int i=0; i<domsize; ++i) {
-            data.at(time).at(0) += backward.at(0)->data.at(time).at(i) * backward.at(0)->data.at(time).at(i);
+        for (int n=0; n<batch; ++n) {
+            const dtype *x = getDomData(0).data() + n * domsize;
+            dtype sum = 0;
+            for (int i=0; i<domsize; ++i) {
+                sum += x[i] * x[i];
+            }
+            getData()[n] = sqrt(sum);
         }
-        data.at(time).at(0) = sqrt(data.at(time).at(0));
     }
             
     void Norm2::calcPartialDerivative()
     {
-        for (int i=0; i<domsize; ++i) {
-            backward.at(0)->grad.at(time).at(i) += backward.at(0)->data.at(time).at(i) / data.at(time).at(0) * grad.at(time).at(0);
+        for (int n=0; n<batch; ++n) {
+            const dtype  g  = getGrad()[n];
+            const dtype  y  = getData()[n];
+            const dtype *x  = getDomData(0).data() + n * domsize;
+            dtype       *dx = getDomGrad(0).data() + n * domsize;
+            for (int i=0; i<domsize; ++i) {
+                dx[i] += x[i] / y * g;
+            }
         }
     }
 
     
     
-    Affine::Affine (Node *node1, vec2<dtype> Weight, dtype bias)
-    : Node (node1->dsize, Weight.at(0).size(), 1), bias(bias)
+    Affine::Affine (Node *node1, Tensor Weight, dtype bias)
+    : Node (node1->dsize, Weight.size(1), 1), bias(bias)
     {
-        assert (node1->dsize + 1 == Weight.size());
-        for (int i=1; i<Weight.size(); ++i) {
-            assert (Weight.at(i).size() == Weight.at(0).size());
-        }
+        assert (Weight.rank() == 2 && node1->dsize + 1 == Weight.size());
         assert (node1->width == 1);
-        
-        weight = Weight;
 
-        gradWeight.resize(domsize+1);
-        for (int i=0; i<=domsize; ++i) {
-            gradWeight.at(i).resize(height);
-        }
+        weight     = std::move(Weight);
+        gradWeight = Tensor({domsize+1, dsize});
 
         backward.resize(1);
         backward.at(0) = node1;
@@ -596,288 +1120,744 @@ namespace CG
         pushThis(node1);
     }
 
+    Affine::Affine (Node *node1, vec2<dtype> Weight, dtype bias)
+    : Affine (node1, Tensor(Weight), bias){} // rows are checked by the Tensor constructor
+
     Affine::Affine (Node *node1, vec2<dtype> Weight)
     : Affine (node1, Weight, 1){}
 
-    void Affine::calcData()
+    Node* Affine::replicate(vec1<Node*> nodes)
     {
-        for (int i=0; i<dsize; ++i) {
-            data.at(time).at(i) = 0;
-            for (int j=0; j<domsize; ++j) {
-                data.at(time).at(i) += weight.at(j).at(i) * backward.at(0)->data.at(time).at(j);
+        Affine *node = new Affine(nodes.at(0), Tensor({domsize+1, dsize}), bias);
+        node->weight.share(weight);
+        return node;
+    }
+
+    void Affine::calcData() // Y[batch][dsize] = X[batch][domsize] W + bias * W[domsize]
+    {
+        dtype       *Y = getData().data();
+        const dtype *X = getDomData(0).data();
+        const dtype *w = weight.data();
+
+        for (int n=0; n<batch; ++n) {
+            dtype *y = Y + n * dsize;
+            for (int i=0; i<dsize; ++i) {
+                y[i] = w[domsize * dsize + i] * bias;
             }
-            data.at(time).at(i) += weight.at(domsize).at(i) * bias;
         }
+        CGK::gemm(batch, dsize, domsize, X, w, Y);
     }
 
     void Affine::calcPartialDerivative()
     {
-        for (int i=0; i<domsize; ++i) {
+        const dtype *G  = getGrad().data();
+        const dtype *X  = getDomData(0).data();
+        dtype       *dX = getDomGrad(0).data();
+        const dtype *w  = weight.data();
+        dtype       *gw = gradWeight.data();
+
+        CGK::gemmBackward(batch, dsize, domsize, X, w, G, dX, gw); // dX and the weight gradient in one pass
+        for (int n=0; n<batch; ++n) {
+            const dtype *g = G + n * dsize;
             for (int j=0; j<dsize; ++j) {
-                backward.at(0)->grad.at(time).at(i) += weight.at(i).at(j) * grad.at(time).at(j);
+                gw[domsize * dsize + j] += bias * g[j];
             }
         }
+    }
 
-        for (int i=0; i<domsize; ++i) {
-            for (int j=0; j<dsize; ++j) {
-                gradWeight.at(i).at(j) += backward.at(0)->data.at(time).at(i) * grad.at(time).at(j);
+    void Affine::updateParameters(dtype eta)
+    {
+        dtype *w  = weight.data();
+        dtype *gw = gradWeight.data();
+        size_t n  = weight.numel();
+        if (sharedWeight != nullptr) { // a racing update may be lost, as Hogwild allows
+            std::atomic<dtype> *s = sharedWeight->data();
+            for (int i=0; i<n; ++i) {
+                w[i] = s[i].load(std::memory_order_relaxed) - eta * gw[i];
+                s[i].store(w[i], std::memory_order_relaxed);
+                gw[i] = 0;
             }
+            return;
         }
-        for (int j=0; j<dsize; ++j) {
-            gradWeight.at(domsize).at(j) += bias * grad.at(time).at(j);
+        for (int i=0; i<n; ++i) {
+            w[i] -= eta * gw[i];
+            gw[i] = 0;
         }
     }
 
-    void Affine::updateParameters(dtype eta)
+    void Affine::mergeGradients(Node *node)
     {
-        for (int i=0; i<=domsize; ++i) {
-            for (int j=0; j<dsize; ++j) {
-                weight.at(i).at(j) -= eta * gradWeight.at(i).at(j);
-                gradWeight.at(i).at(j) = 0;
-            }
+        Affine *aff = dynamic_cast<Affine*>(node);
+        assert (aff != nullptr && aff->gradWeight.numel() == gradWeight.numel());
+        dtype *gw = gradWeight.data();
+        dtype *go = aff->gradWeight.data();
+        size_t n  = gradWeight.numel();
+        for (int i=0; i<n; ++i) {
+            gw[i] += go[i];
+            go[i] = 0;
         }
     }
 
-
-
-    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width)
-    : Filter2d (nodes, Kernel.at(0).size(), Kernel.at(0).at(0).size(), stride, topPadding, leftPadding, height, width)
-    {   
-        assert (Kernel.size() == nodes.size());
-        for(int c=0; c<Kernel.size(); ++c) {
-            assert (Kernel.at(c).size() == kheight);
-            for (int i=0; i<kheight; ++i) {
-                assert (Kernel.at(c).at(i).size() == kwidth);
-            }
+    void Affine::readSharedWeight()
+    {
+        dtype              *w = weight.data();
+        std::atomic<dtype> *s = sharedWeight->data();
+        size_t              n = weight.numel();
+        for (int i=0; i<n; ++i) {
+            w[i] = s[i].load(std::memory_order_relaxed);
         }
+    }
 
-        kernel = Kernel;
 
-        this->bias = bias;
-        gradBias = 0;
 
-        gradKernel.resize(backward.size());
-        for (int c=0; c<backward.size(); ++c) {
-            gradKernel.at(c).resize(kheight);
-            for (int i=0; i<kheight; ++i) {
-                gradKernel.at(c).at(i).resize(kwidth);
+    static double elapsed(std::function<void()> f) // seconds
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static ConvAlgorithm fastest(const vec1<ConvAlgorithm> &algorithms, Node *node, std::function<void(ConvAlgorithm)> run) // forward passes on this machine and shape
+    {
+        /* After a first run of each, so that no allocation is timed. The input transforms of a cold run
+           are shared by every reader of the inputs, so each reader is charged its part of them */
+        size_t readers = node->backward.at(0)->forward.size();
+        for (ConvAlgorithm algorithm : algorithms) {
+            run(algorithm);
+        }
+        ConvAlgorithm ret  = algorithms.at(0);
+        double        best = INFINITY;
+        auto coldRun = [&](ConvAlgorithm algorithm) {
+            for (int i=0; i<node->backward.size(); ++i) {
+                TransformCache &cache = *node->backward.at(i)->transformCache;
+                std::lock_guard<std::mutex> guard(cache.lock);
+                cache.clear();
+            }
+            return elapsed([&]{ run(algorithm); });
+        };
+        for (ConvAlgorithm algorithm : algorithms) {
+            double cold = std::min(coldRun(algorithm), coldRun(algorithm));
+            double warm = std::min(elapsed([&]{ run(algorithm); }), elapsed([&]{ run(algorithm); }));
+            double cost = warm + std::max(0.0, cold - warm) / readers;
+            if (cost < best) {
+                ret  = algorithm;
+                best = cost;
             }
         }
+        return ret;
     }
 
-    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t stride, size_t height, size_t width)
-    : Convolution2d (nodes, Kernel, bias, stride, (stride*(height-1) + Kernel.at(0).size() - nodes.at(0)->height)/2, (stride*(width-1) + Kernel.at(0).at(0).size() - nodes.at(0)->width)/2, height, width)
+    static void loadTile(const dtype *x, int height, int width, int top, int left, size_t alpha, dtype *d) // alpha x alpha window at (top, left), 0 outside
     {
-        assert (stride * (height - 1) + Kernel.at(0).size()       >= nodes.at(0)->height);
-        assert (stride * (width  - 1) + Kernel.at(0).at(0).size() >= nodes.at(0)->width);
+        if (0 <= top && top + (int)alpha <= height && 0 <= left && left + (int)alpha <= width) {
+            for (int a=0; a<alpha; ++a) {
+                std::copy(x + (top + a) * width + left, x + (top + a) * width + left + alpha, d + a * alpha);
+            }
+            return;
+        }
+        for (int a=0; a<alpha; ++a) {
+            int row = top + a;
+            if (row < 0 || height <= row) {
+                std::fill(d + a * alpha, d + (a + 1) * alpha, 0);
+                continue;
+            }
+            for (int b=0; b<alpha; ++b) {
+                int col = left + b;
+                d[a * alpha + b] = (0 <= col && col < width) ? x[row * width + col] : 0;
+            }
+        }
     }
 
-    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t stride)
-    : Convolution2d (nodes, Kernel, bias, stride, (nodes.at(0)->height - Kernel.at(0).size() + (stride-1))/stride + 1, (nodes.at(0)->width - Kernel.at(0).at(0).size() + (stride-1))/stride + 1){}
+    static void addTile(const dtype *d, int height, int width, int top, int left, size_t alpha, dtype *x) // the inverse of loadTile
+    {
+        for (int a=std::max(0, -top); a<alpha && top + a<height; ++a) {
+            for (int b=std::max(0, -left); b<alpha && left + b<width; ++b) {
+                x[(top + a) * width + left + b] += d[a * alpha + b];
+            }
+        }
+    }
 
-    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t height, size_t width)
-    : Convolution2d (nodes, Kernel, bias, 1, height, width){}
+    static void storeTile(const dtype *Y, int height, int width, int top, int left, size_t m, dtype bias, dtype *y) // y = bias + the part of the tile inside the plane
+    {
+        int rows = std::min<int>(m, height - top);
+        int cols = std::min<int>(m, width  - left);
+        for (int a=0; a<rows; ++a) {
+            for (int b=0; b<cols; ++b) {
+                y[(top + a) * width + left + b] = bias + Y[a * m + b];
+            }
+        }
+    }
 
-    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias)
-    : Convolution2d (nodes, Kernel, bias, 1, nodes.at(0)->height - (Kernel.at(0).size()-1), nodes.at(0)->width - (Kernel.at(0).at(0).size()-1))
+    size_t Filter2d::winogradTile() // 0 if the shape does not qualify
     {
-        assert (Kernel.at(0).size()       <= nodes.at(0)->height);
-        assert (Kernel.at(0).at(0).size() <= nodes.at(0)->width);
+        if (sw != 1 || kheight != kwidth || kheight < 2 || 5 < kheight) {
+            return 0;
+        }
+        return 7 - kheight;
     }
 
-    void Convolution2d::calcData()
-    {    
-        size_t bheight = backward.at(0)->height;
-        size_t bwidth  = backward.at(0)->width;
-        for (int a=0; a<height; ++a) {
-            for (int b=0; b<width; ++b) {
-                int index = a * width + b;
-                data.at(time).at(index) = bias;
-                for (int c=0; c<backward.size(); ++c) {
-                    for (int i=0; i<kheight; ++i) {
-                        for (int j=0; j<kwidth; ++j) {
-                            data.at(time).at(index) += kernel.at(c).at(i).at(j) * getDomData(c, a * sw + i - pt, b * sw + j - pl);
-                        }
+    std::shared_ptr<Tensor> Filter2d::getWinogradInput(size_t index, const CGK::Winograd &w) // [alpha * alpha][maps][batch * tiles], BT d B
+    {
+        Node   *node = backward.at(index);
+        ttype   t    = node->slot(time);
+        size_t  th   = (mapHeight + w.m - 1) / w.m;
+        size_t  tw   = (width     + w.m - 1) / w.m;
+        vec1<size_t> key = {node->dataEpoch.at(t), t, batch, (size_t)ConvAlgorithm::Winograd, w.m, w.r, pt, pl, th, tw};
+
+        TransformCache &cache = *node->transformCache;
+        std::lock_guard<std::mutex> guard(cache.lock);
+        std::shared_ptr<Tensor> value = cache.find(key);
+        if (value) {
+            return value;
+        }
+
+        int    bwidth = node->width;
+        size_t maps   = node->channels;
+        size_t N      = batch * th * tw;
+        value = std::make_shared<Tensor>(vec1<size_t>{w.alpha * w.alpha, maps, N});
+        const dtype *X = getDomData(index).data();
+        dtype d[64];
+        for (int n=0; n<batch; ++n) {
+            for (int c=0; c<maps; ++c) {
+                const dtype *x = X + (n * maps + c) * domHeight * bwidth;
+                dtype       *v = value->data() + c * N + n * th * tw;
+                for (int ty=0; ty<th; ++ty) {
+                    for (int tx=0; tx<tw; ++tx) {
+                        loadTile(x, domHeight, bwidth, ty * w.m - pt, tx * w.m - pl, w.alpha, d);
+                        w.transformInput(d, v + ty * tw + tx, maps * N);
                     }
                 }
             }
         }
+        cache.insert(key, value);
+        return value;
     }
 
-    void Convolution2d::calcPartialDerivative()
+    /* Winograd convolution over the maps of every input, kernel [outputs][inputs][r][r]. Each element
+       of the tiles is one product U[outputs][inputs] V[inputs][tiles], a block of tiles at a time */
+
+    static Tensor transformKernels(const CGK::Winograd &w, const Tensor &kernel, size_t outputs, size_t inputs) // [alpha * alpha][outputs][inputs], G k G^T
     {
-        size_t bheight = backward.at(0)->height;
-        size_t bwidth  = backward.at(0)->width;
-        for (int c=0; c<backward.size(); ++c) {
-            for (int a=0; a<bheight; ++a) {
-                for (int b=0; b<bwidth; ++b) {
-                    //backward.at(0)->grad.at(0).at(a * bwidth + b) = 0;
-                    for (int i=(a+pt)%sw; i<kheight; i+=sw) {
-                        for (int j=(b+pl)%sw; j<kwidth; j+=sw) {
-                            int col = (a - i + pt) / sw;
-                            int row = (b - j + pl) / sw;
-                            if (0 <= col && col < height && 0 <= row && row < width) {
-                                backward.at(c)->grad.at(time).at(a * bwidth + b) += kernel.at(c).at(i).at(j) * grad.at(time).at(col * width + row);
-                            }
-                        }
-                    }
+        size_t alpha2 = w.alpha * w.alpha;
+        Tensor ret({alpha2, outputs, inputs});
+        dtype  U[64];
+        for (int o=0; o<outputs; ++o) {
+            for (int c=0; c<inputs; ++c) {
+                w.transformKernel(kernel.data() + (o * inputs + c) * w.r * w.r, U);
+                for (int i=0; i<alpha2; ++i) {
+                    ret.data()[(i * outputs + o) * inputs + c] = U[i];
                 }
             }
         }
-        for (int c=0; c<backward.size(); ++c) {
-            for (int i=0; i<kheight; ++i) {
-                for (int j=0; j<kwidth; ++j) {
-                    for (int a=0; a<height; ++a) {
-                        for (int b=0; b<width; ++b) {
-                            gradKernel.at(c).at(i).at(j) += getDomData(c, a * sw + i - pt, b * sw + j - pl) * grad.at(time).at(a * width + b);
+        return ret;
+    }
+
+    static size_t winogradBlock(const CGK::Winograd &w, size_t outputs, size_t inputs) // tiles per block, about 512 KB of scratch
+    {
+        return std::max<size_t>(8, (1 << 16) / (w.alpha * w.alpha * (outputs + 2 * inputs)) / 8 * 8);
+    }
+
+    static void packWinogradInput(Filter2d &node, const vec1<std::shared_ptr<Tensor>> &V, size_t alpha2, size_t j0, size_t nb, bool transpose, dtype *out, size_t stride) // [inputs][nb] or [nb][inputs] per element, stride apart
+    {
+        size_t inputs = 0;
+        for (int k=0; k<node.backward.size(); ++k) {
+            inputs += node.backward.at(k)->channels;
+        }
+        for (int i=0; i<alpha2; ++i) {
+            dtype *o = out + i * stride;
+            for (int k=0, c0=0; k<node.backward.size(); c0+=node.backward.at(k)->channels, ++k) {
+                size_t maps = node.backward.at(k)->channels;
+                size_t N    = V.at(k)->size(2);
+                for (int c=0; c<maps; ++c) {
+                    const dtype *v = V.at(k)->data() + (i * maps + c) * N + j0;
+                    if (transpose) {
+                        for (int j=0; j<nb; ++j) {
+                            o[j * inputs + c0 + c] = v[j];
                         }
+                    } else {
+                        std::copy(v, v + nb, o + (c0 + c) * nb);
                     }
-                    //std::cout << "grad : " << gradKernel.at(c).at(i).at(j) << std::endl;
                 }
             }
         }
-        for (int a=0; a<height; ++a) {
-            for (int b=0; b<width; ++b) {
-                gradBias += grad.at(time).at(a * width + b);
+    }
+
+    static void winogradForward(Filter2d &node, const CGK::Winograd &w, const Tensor &U, const dtype *bias, dtype *Y)
+    {
+        size_t alpha2  = w.alpha * w.alpha;
+        size_t outputs = node.channels;
+        size_t inputs  = U.size(2);
+        size_t size    = node.mapHeight * node.width;
+        size_t th      = (node.mapHeight + w.m - 1) / w.m;
+        size_t tw      = (node.width     + w.m - 1) / w.m;
+        size_t T       = th * tw;
+        size_t N       = node.batch * T;
+        vec1<std::shared_ptr<Tensor>> V(node.backward.size()); // held, the cache may be replaced meanwhile
+        for (int k=0; k<node.backward.size(); ++k) {
+            V.at(k) = node.getWinogradInput(k, w);
+        }
+
+        size_t B  = winogradBlock(w, outputs, inputs);
+        size_t sv = inputs  * B + 8; // off multiples of 4 KB, which would alias in cache
+        size_t sm = outputs * B + 8;
+        vec1<dtype> Vb(alpha2 * sv);
+        vec1<dtype> M(alpha2 * sm);
+        dtype tile[64];
+        for (size_t j0=0; j0<N; j0+=B) {
+            size_t nb = std::min(B, N - j0);
+            packWinogradInput(node, V, alpha2, j0, nb, false, Vb.data(), sv);
+            std::fill(M.begin(), M.end(), 0);
+            for (int i=0; i<alpha2; ++i) {
+                CGK::gemm(outputs, nb, inputs, U.data() + i * outputs * inputs, Vb.data() + i * sv, M.data() + i * sm);
+            }
+            for (int o=0; o<outputs; ++o) {
+                for (int j=0; j<nb; ++j) {
+                    size_t n = (j0 + j) / T;
+                    size_t t = (j0 + j) - n * T;
+                    w.transformOutput(M.data() + o * nb + j, tile, sm);
+                    storeTile(tile, node.mapHeight, node.width, t / tw * w.m, t % tw * w.m, w.m, bias[o], Y + (n * outputs + o) * size);
+                }
             }
         }
-        //std::cout << "bias : " << gradBias << std::endl;
     }
 
-    void Convolution2d::updateParameters(dtype eta)
+    static void winogradBackward(Filter2d &node, const CGK::Winograd &w, const Tensor &U, const Tensor &mask, const dtype *G, dtype *gradKernel, dtype *gradBias)
     {
-        for (int c=0; c<backward.size(); ++c) {
-            for (int i=0; i<kheight; ++i) {
-                for (int j=0; j<kwidth; ++j) {
-                    kernel.at(c).at(i).at(j) -= eta * gradKernel.at(c).at(i).at(j);
-                    gradKernel.at(c).at(i).at(j) = 0;
+        /* dM = A g AT for every output tile, dV = U^T dM and dU += dM V^T, then dx += B dV BT on the
+           overlapping input tiles and gradKernel = G^T dU G */
+        size_t alpha2  = w.alpha * w.alpha;
+        size_t outputs = node.channels;
+        size_t inputs  = U.size(2);
+        size_t size    = node.mapHeight * node.width;
+        size_t th      = (node.mapHeight + w.m - 1) / w.m;
+        size_t tw      = (node.width     + w.m - 1) / w.m;
+        size_t T       = th * tw;
+        size_t N       = node.batch * T;
+        int    bwidth  = node.backward.at(0)->width;
+        vec1<std::shared_ptr<Tensor>> V(node.backward.size());
+        for (int k=0; k<node.backward.size(); ++k) {
+            V.at(k) = node.getWinogradInput(k, w);
+        }
+        vec1<dtype> UT(alpha2 * inputs * outputs);
+        for (int i=0; i<alpha2; ++i) {
+            for (int o=0; o<outputs; ++o) {
+                for (int c=0; c<inputs; ++c) {
+                    UT.at((i * inputs + c) * outputs + o) = U.data()[(i * outputs + o) * inputs + c];
                 }
             }
         }
-        bias -= eta * gradBias;
-        gradBias = 0;
-    }
 
+        size_t B  = winogradBlock(w, outputs, inputs);
+        size_t sv = inputs  * B + 8;
+        size_t sm = outputs * B + 8;
+        vec1<dtype> VbT(alpha2 * sv);
+        vec1<dtype> dVb(alpha2 * sv);
+        vec1<dtype> dM(alpha2 * sm);
+        vec1<dtype> dU(alpha2 * outputs * inputs, 0);
+        dtype tile[64];
+        for (size_t j0=0; j0<N; j0+=B) {
+            size_t nb = std::min(B, N - j0);
+            for (int o=0; o<outputs; ++o) {
+                for (int j=0; j<nb; ++j) {
+                    size_t n = (j0 + j) / T;
+                    size_t t = (j0 + j) - n * T;
+                    loadTile(G + (n * outputs + o) * size, node.mapHeight, node.width, t / tw * w.m, t % tw * w.m, w.m, tile);
+                    w.transformOutputAdjoint(tile, dM.data() + o * nb + j, sm);
+                }
+            }
+            packWinogradInput(node, V, alpha2, j0, nb, true, VbT.data(), sv);
+            std::fill(dVb.begin(), dVb.end(), 0);
+            for (int i=0; i<alpha2; ++i) {
+                CGK::gemm(inputs, nb, outputs, UT.data() + i * inputs * outputs, dM.data() + i * sm, dVb.data() + i * sv);
+                CGK::gemm(outputs, inputs, nb, dM.data() + i * sm, VbT.data() + i * sv, dU.data() + i * outputs * inputs);
+            }
+            for (int k=0, c0=0; k<node.backward.size(); c0+=node.backward.at(k)->channels, ++k) {
+                size_t maps = node.backward.at(k)->channels;
+                dtype *dx   = node.getDomGrad(k).data();
+                for (int c=0; c<maps; ++c) {
+                    for (int j=0; j<nb; ++j) {
+                        size_t n = (j0 + j) / T;
+                        size_t t = (j0 + j) - n * T;
+                        w.transformInputAdjoint(dVb.data() + (c0 + c) * nb + j, tile, sv);
+                        addTile(tile, node.domHeight, bwidth, t / tw * w.m - node.pt, t % tw * w.m - node.pl, w.alpha, dx + (n * maps + c) * node.domHeight * bwidth);
+                    }
+                }
+            }
+        }
 
+        size_t r2 = w.r * w.r;
+        dtype  u[64], gk[64];
+        for (int o=0; o<outputs; ++o) {
+            for (int c=0; c<inputs; ++c) {
+                if (mask.rank() != 0 && mask.at(o, c) == 0) {
+                    continue;
+                }
+                for (int i=0; i<alpha2; ++i) {
+                    u[i] = dU.at((i * outputs + o) * inputs + c);
+                }
+                w.transformKernelAdjoint(u, gk);
+                dtype *out = gradKernel + (o * inputs + c) * r2;
+                for (int i=0; i<r2; ++i) {
+                    out[i] += gk[i];
+                }
+            }
+        }
+        for (int n=0; n<node.batch; ++n) {
+            for (int o=0; o<outputs; ++o) {
+                const dtype *g = G + (n * outputs + o) * size;
+                dtype sum = 0;
+                for (int index=0; index<size; ++index) {
+                    sum += g[index];
+                }
+                gradBias[o] += sum;
+            }
+        }
+    }
 
-    MaxPooling2d::MaxPooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width)
-    : Filter2d ({node1}, kernelHeight, kernelWidth, stride, topPadding, leftPadding, height, width)
-    {   
-        int bottomPadding = stride * (height - 1) + kernelHeight - node1->height - topPadding;
-        int rightPadding  = stride * (width  - 1) + kernelWidth  - node1->width  - leftPadding;
-        assert (topPadding  < kernelHeight && bottomPadding < kernelHeight);
-        assert (leftPadding < kernelWidth  && rightPadding  < kernelWidth);
+    void Filter2d::fftShape(size_t &rows, size_t &cols) // large enough not to wrap onto the input
+    {
+        size_t reachHeight = (mapHeight - 1) * sw + kheight;
+        size_t reachWidth  = (width     - 1) * sw + kwidth;
+        rows = CGK::fftSize(std::max(domHeight + pt, reachHeight > pt ? reachHeight - pt : 0));
+        cols = CGK::fftSize(std::max({(size_t)2, backward.at(0)->width + pl, reachWidth > pl ? reachWidth - pl : 0}));
+    }
 
-        maxCount.resize(this->height * this->width);
+    std::shared_ptr<Tensor> Filter2d::getFFTInput(size_t index, size_t rows, size_t cols) // [maps][batch][rows * (cols / 2 + 1) * 2]
+    {
+        Node *node = backward.at(index);
+        ttype t    = node->slot(time);
+        vec1<size_t> key = {node->dataEpoch.at(t), t, batch, (size_t)ConvAlgorithm::FFT, rows, cols};
+
+        TransformCache &cache = *node->transformCache;
+        std::lock_guard<std::mutex> guard(cache.lock);
+        std::shared_ptr<Tensor> value = cache.find(key);
+        if (value) {
+            return value;
+        }
+
+        int    bwidth = node->width;
+        size_t maps   = node->channels;
+        size_t F      = rows * (cols / 2 + 1);
+        value = std::make_shared<Tensor>(vec1<size_t>{maps, batch, F * 2});
+        const dtype *X = getDomData(index).data();
+        for (int n=0; n<batch; ++n) {
+            for (int c=0; c<maps; ++c) {
+                CGK::complex *f = reinterpret_cast<CGK::complex*>(value->data()) + (c * batch + n) * F;
+                CGK::rfft2d(X + (n * maps + c) * domHeight * bwidth, domHeight, bwidth, f, rows, cols);
+            }
+        }
+        cache.insert(key, value);
+        return value;
     }
 
-    MaxPooling2d::MaxPooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t height, size_t width)
-    : MaxPooling2d (node1, kernelHeight, kernelWidth, stride, (stride*(height-1) + kernelHeight - node1->height)/2, (stride*(width-1) + kernelWidth - node1->width)/2, height, width){}
+    /* FFT convolution over the maps of every input, y_o = ifft(sum_c X_c conj(K_oc)) on spectra
+       zero-padded to rows x cols, one inverse transform per output map */
 
-    MaxPooling2d::MaxPooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride)
-    : MaxPooling2d (node1, kernelHeight, kernelWidth, stride, (node1->height - kernelHeight + (stride-1))/stride + 1, (node1->width - kernelWidth + (stride-1))/stride + 1){}
+    static Tensor kernelSpectra(const Tensor &kernel, size_t outputs, size_t inputs, size_t kheight, size_t kwidth, size_t rows, size_t cols) // [outputs][inputs][rows * (cols / 2 + 1) * 2]
+    {
+        size_t F = rows * (cols / 2 + 1);
+        Tensor ret({outputs, inputs, F * 2});
+        for (int o=0; o<outputs; ++o) {
+            for (int c=0; c<inputs; ++c) {
+                const dtype  *k = kernel.data() + (o * inputs + c) * kheight * kwidth;
+                CGK::complex *K = reinterpret_cast<CGK::complex*>(ret.data()) + (o * inputs + c) * F;
+                CGK::rfft2d(k, kheight, kwidth, K, rows, cols);
+            }
+        }
+        return ret;
+    }
 
-    void MaxPooling2d::calcData()
+    static void fftForward(Filter2d &node, size_t rows, size_t cols, const Tensor &K, const Tensor &mask, const dtype *bias, dtype *Y)
     {
-        size_t bheight = backward.at(0)->height;
-        size_t bwidth  = backward.at(0)->width;
-        for (int a=0; a<height; ++a) {
-            for (int b=0; b<width; ++b) {
-                int count = 0;
-                dtype max = std::nan("");
-                for (int i=0; i<kheight; ++i) {
-                    for (int j=0; j<kwidth; ++j) {
-                        int col = a * sw + i - pt;
-                        int row = b * sw + j - pl;
-                        if (!inDomain(col, row)) {
+        size_t outputs = node.channels;
+        size_t inputs  = K.size(1);
+        size_t size    = node.mapHeight * node.width;
+        size_t F       = rows * (cols / 2 + 1);
+        vec1<std::shared_ptr<Tensor>> X(node.backward.size());
+        for (int k=0; k<node.backward.size(); ++k) {
+            X.at(k) = node.getFFTInput(k, rows, cols);
+        }
+
+        const CGK::complex *spectra = reinterpret_cast<const CGK::complex*>(K.data());
+        vec1<CGK::complex> Z(outputs * F);
+        vec1<dtype>        z(rows * cols);
+        for (int n=0; n<node.batch; ++n) {
+            std::fill(Z.begin(), Z.end(), CGK::complex(0));
+            for (int k=0, c0=0; k<node.backward.size(); c0+=node.backward.at(k)->channels, ++k) {
+                size_t maps = node.backward.at(k)->channels;
+                for (int c=0; c<maps; ++c) {
+                    const CGK::complex *x = reinterpret_cast<const CGK::complex*>(X.at(k)->data()) + (c * node.batch + n) * F;
+                    for (int o=0; o<outputs; ++o) {
+                        if (mask.rank() != 0 && mask.at(o, c0 + c) == 0) {
                             continue;
                         }
-                        dtype d = getDomData(col, row);
-                        if (std::isnan(max) || max < d) {
-                            max = d;
-                            count = 1;
-                        } else if (max == d) {
-                            ++count;
+                        const CGK::complex *kf = spectra + (o * inputs + c0 + c) * F;
+                        CGK::complex       *zo = Z.data() + o * F;
+                        for (int f=0; f<F; ++f) {
+                            zo[f] += CGK::cmulConj(x[f], kf[f]);
                         }
                     }
                 }
-                assert (!std::isnan(max));
-                data.at(time).at(a * width + b) = max;
-                maxCount.at(a * width + b) = count;
+            }
+            for (int o=0; o<outputs; ++o) {
+                CGK::irfft2d(Z.data() + o * F, rows, cols, z.data());
+                dtype *y = Y + (n * outputs + o) * size;
+                for (int a=0; a<node.mapHeight; ++a) {
+                    size_t row = (a * node.sw + rows - node.pt) % rows;
+                    for (int b=0; b<node.width; ++b) {
+                        size_t col = (b * node.sw + cols - node.pl) % cols;
+                        y[a * node.width + b] = bias[o] + z.at(row * cols + col);
+                    }
+                }
             }
         }
     }
 
-    void MaxPooling2d::calcPartialDerivative()
+    static void fftBackward(Filter2d &node, size_t rows, size_t cols, const Tensor &K, const Tensor &mask, const dtype *G, dtype *gradKernel, dtype *gradBias)
     {
-        size_t bheight = backward.at(0)->height;
-        size_t bwidth  = backward.at(0)->width;
-        for (int a=0; a<bheight; ++a) {
-            for (int b=0; b<bwidth; ++b) {
-                //backward.at(0)->grad.at(0).at(a * bwidth + b) = 0;
-                for (int i=(a+pt)%sw; i<kheight; i+=sw) {
-                    for (int j=(b+pl)%sw; j<kwidth; j+=sw) {
-                        int col = (a - i + pt) / sw;
-                        int row = (b - j + pl) / sw;
-                        if (   0 <= col && col < height && 0 <= row && row < width
-                            && (backward.at(0)->data.at(time).at(a * bwidth + b) == data.at(time).at(col * width + row))) {
-                            backward.at(0)->grad.at(time).at(a * bwidth + b) += grad.at(time).at(col * width + row) / maxCount.at(col * width + row);
+        /* g is scattered to where y was read, then dx_c = ifft(sum_o G_o K_oc) and gradKernel_oc =
+           ifft(sum_n X_c conj(G_o)) */
+        size_t outputs = node.channels;
+        size_t inputs  = K.size(1);
+        size_t size    = node.mapHeight * node.width;
+        size_t F       = rows * (cols / 2 + 1);
+        int    bwidth  = node.backward.at(0)->width;
+        vec1<std::shared_ptr<Tensor>> X(node.backward.size());
+        for (int k=0; k<node.backward.size(); ++k) {
+            X.at(k) = node.getFFTInput(k, rows, cols);
+        }
+
+        const CGK::complex *spectra = reinterpret_cast<const CGK::complex*>(K.data());
+        vec1<CGK::complex> Gf(outputs * F), Z(F);
+        vec1<CGK::complex> dK(outputs * inputs * F, CGK::complex(0));
+        vec1<dtype>        z(rows * cols);
+        for (int n=0; n<node.batch; ++n) {
+            for (int o=0; o<outputs; ++o) {
+                const dtype *g = G + (n * outputs + o) * size;
+                std::fill(z.begin(), z.end(), 0);
+                for (int a=0; a<node.mapHeight; ++a) {
+                    size_t row = (a * node.sw + rows - node.pt) % rows;
+                    for (int b=0; b<node.width; ++b) {
+                        size_t col = (b * node.sw + cols - node.pl) % cols;
+                        z.at(row * cols + col) += g[a * node.width + b];
+                        gradBias[o] += g[a * node.width + b];
+                    }
+                }
+                CGK::rfft2d(z.data(), rows, cols, Gf.data() + o * F, rows, cols);
+            }
+
+            for (int k=0, c0=0; k<node.backward.size(); c0+=node.backward.at(k)->channels, ++k) {
+                size_t maps = node.backward.at(k)->channels;
+                dtype *dx   = node.getDomGrad(k).data();
+                for (int c=0; c<maps; ++c) {
+                    const CGK::complex *x = reinterpret_cast<const CGK::complex*>(X.at(k)->data()) + (c * node.batch + n) * F;
+                    std::fill(Z.begin(), Z.end(), CGK::complex(0));
+                    for (int o=0; o<outputs; ++o) {
+                        if (mask.rank() != 0 && mask.at(o, c0 + c) == 0) {
+                            continue;
+                        }
+                        const CGK::complex *kf = spectra + (o * inputs + c0 + c) * F;
+                        const CGK::complex *gf = Gf.data() + o * F;
+                        CGK::complex       *d  = dK.data() + (o * inputs + c0 + c) * F;
+                        for (int f=0; f<F; ++f) {
+                            Z[f] += CGK::cmul(gf[f], kf[f]);
+                            d[f] += CGK::cmulConj(x[f], gf[f]);
+                        }
+                    }
+                    CGK::irfft2d(Z.data(), rows, cols, z.data());
+                    dtype *out = dx + (n * maps + c) * node.domHeight * bwidth;
+                    for (int i=0; i<node.domHeight; ++i) {
+                        for (int j=0; j<bwidth; ++j) {
+                            out[i * bwidth + j] += z.at(i * cols + j);
                         }
                     }
                 }
             }
         }
+
+        for (int o=0; o<outputs; ++o) {
+            for (int c=0; c<inputs; ++c) {
+                if (mask.rank() != 0 && mask.at(o, c) == 0) {
+                    continue;
+                }
+                CGK::irfft2d(dK.data() + (o * inputs + c) * F, rows, cols, z.data());
+                dtype *gk = gradKernel + (o * inputs + c) * node.kheight * node.kwidth;
+                for (int i=0; i<node.kheight; ++i) {
+                    for (int j=0; j<node.kwidth; ++j) {
+                        gk[i * node.kwidth + j] += z.at(i * cols + j);
+                    }
+                }
+            }
+        }
     }
 
 
 
-    AveragePooling2d::AveragePooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width)
-    : Filter2d ({node1}, kernelHeight, kernelWidth, stride, topPadding, leftPadding, height, width)
-    {   
-        int bottomPadding = stride * (height - 1) + kernelHeight - node1->height - topPadding;
-        int rightPadding  = stride * (width  - 1) + kernelWidth  - node1->width  - leftPadding;
-        assert (topPadding  < kernelHeight && bottomPadding < kernelHeight);
-        assert (leftPadding < kernelWidth  && rightPadding  < kernelWidth);
+    Convolution2d::Convolution2d (vec1<Node*> nodes, Tensor Kernel, dtype bias, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width)
+    : Filter2d (nodes, Kernel.size(1), Kernel.size(2), stride, topPadding, leftPadding, height, width)
+    {
+        assert (Kernel.rank() == 3 && Kernel.size() == nodes.size());
+        for (int c=0; c<nodes.size(); ++c) {
+            assert (nodes.at(c)->channels == 1); // see MultiConvolution2d
+        }
+
+        kernel = std::move(Kernel);
+
+        this->bias = Tensor(vec1<size_t>{1});
+        this->bias.data()[0] = bias;
+        gradBias = 0;
+
+        gradKernel = Tensor({backward.size(), kheight, kwidth});
+
+        kernelVersion   = std::make_shared<std::atomic<size_t>>(0);
+        winogradVersion = (size_t)-1;
+        fftVersion      = (size_t)-1;
     }
 
-    AveragePooling2d::AveragePooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t height, size_t width)
-    : AveragePooling2d (node1, kernelHeight, kernelWidth, stride, (stride*(height-1) + kernelHeight - node1->height)/2, (stride*(width-1) + kernelWidth - node1->width)/2, height, width){}
+    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width)
+    : Convolution2d (nodes, Tensor(Kernel), bias, stride, topPadding, leftPadding, height, width){} // rows are checked by the Tensor constructor
 
-    AveragePooling2d::AveragePooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride)
-    : AveragePooling2d (node1, kernelHeight, kernelWidth, stride, (node1->height - kernelHeight + (stride-1))/stride + 1, (node1->width - kernelWidth + (stride-1))/stride + 1){}
+    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t stride, size_t height, size_t width)
+    : Convolution2d (nodes, Kernel, bias, stride, (stride*(height-1) + Kernel.at(0).size() - nodes.at(0)->height)/2, (stride*(width-1) + Kernel.at(0).at(0).size() - nodes.at(0)->width)/2, height, width)
+    {
+        assert (stride * (height - 1) + Kernel.at(0).size()       >= nodes.at(0)->height);
+        assert (stride * (width  - 1) + Kernel.at(0).at(0).size() >= nodes.at(0)->width);
+    }
+
+    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t stride)
+    : Convolution2d (nodes, Kernel, bias, stride, (nodes.at(0)->height - Kernel.at(0).size() + (stride-1))/stride + 1, (nodes.at(0)->width - Kernel.at(0).at(0).size() + (stride-1))/stride + 1){}
+
+    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t height, size_t width)
+    : Convolution2d (nodes, Kernel, bias, 1, height, width){}
 
-    void AveragePooling2d::calcData()
+    Convolution2d::Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias)
+    : Convolution2d (nodes, Kernel, bias, 1, nodes.at(0)->height - (Kernel.at(0).size()-1), nodes.at(0)->width - (Kernel.at(0).at(0).size()-1))
     {
-        size_t bheight = backward.at(0)->height;
-        size_t bwidth  = backward.at(0)->width;
-        for (int a=0; a<height; ++a) {
-            for (int b=0; b<width; ++b) {
-                dtype sum = 0;
-                for (int i=0; i<kheight; ++i) {
-                    for (int j=0; j<kwidth; ++j) {
-                        int col = a * sw + i - pt;
-                        int row = b * sw + j - pl;
-                        sum += getDomData(col, row);
+        assert (Kernel.at(0).size()       <= nodes.at(0)->height);
+        assert (Kernel.at(0).at(0).size() <= nodes.at(0)->width);
+    }
+
+    Node* Convolution2d::replicate(vec1<Node*> nodes)
+    {
+        Convolution2d *node = new Convolution2d(nodes, Tensor({backward.size(), kheight, kwidth}), 0, sw, pt, pl, height, width);
+        node->kernel.share(kernel);
+        node->bias.share(bias);
+        node->algorithm = algorithm;
+        node->kernelVersion = kernelVersion;
+        return node;
+    }
+
+    ConvAlgorithm Convolution2d::selectAlgorithm()
+    {
+        if (algorithm != ConvAlgorithm::Auto) {
+            return algorithm;
+        }
+        if (chosenBatch != batch) {
+            vec1<ConvAlgorithm> algorithms = {ConvAlgorithm::Direct, ConvAlgorithm::Im2col, ConvAlgorithm::FFT};
+            if (winogradTile() != 0) {
+                algorithms.push_back(ConvAlgorithm::Winograd);
+            }
+            chosen      = fastest(algorithms, this, [this](ConvAlgorithm a){ calcData(a); });
+            chosenBatch = batch;
+        }
+        return chosen;
+    }
+
+    void Convolution2d::calcData()
+    {
+        calcData(selectAlgorithm());
+    }
+
+    void Convolution2d::calcData(ConvAlgorithm algorithm)
+    {
+        switch (algorithm) {
+            case ConvAlgorithm::Im2col   : calcDataIm2col(); break;
+            case ConvAlgorithm::Winograd : calcDataWinograd(); break;
+            case ConvAlgorithm::FFT      : calcDataFFT(); break;
+            default                      : calcDataDirect(); break;
+        }
+    }
+
+    void Convolution2d::calcPartialDerivative()
+    {
+        switch (selectAlgorithm()) {
+            case ConvAlgorithm::Im2col   : calcPartialDerivativeIm2col(); break;
+            case ConvAlgorithm::Winograd : calcPartialDerivativeWinograd(); break;
+            case ConvAlgorithm::FFT      : calcPartialDerivativeFFT(); break;
+            default                      : calcPartialDerivativeDirect(); break;
+        }
+    }
+
+    static void getColumnRange(int sw, int offset, int bwidth, int width, int &first, int &last) // outputs whose tap offset falls inside [0, bwidth)
+    {
+        first = (offset >= 0) ? 0 : (-offset + sw - 1) / sw;
+        last  = (bwidth - offset <= 0) ? 0 : std::min(width, (bwidth - offset + sw - 1) / sw);
+        first = std::min(first, last);
+    }
+
+    void Convolution2d::im2col() // columns[(c * kheight + i) * kwidth + j][n * dsize + a * width + b] = X_c[n][a*sw + i - pt][b*sw + j - pl], 0 outside
+    {
+        int bheight = backward.at(0)->height;
+        int bwidth  = backward.at(0)->width;
+        int bsize   = bheight * bwidth;
+        size_t depth = backward.size() * kheight * kwidth;
+        if (columns.rank() == 0 || columns.size(1) != batch * dsize) {
+            columns     = Tensor({depth, batch * dsize});
+            gradColumns = Tensor({depth, batch * dsize});
+        }
+
+        for (int c=0; c<backward.size(); ++c) {
+            for (int i=0; i<kheight; ++i) {
+                for (int j=0; j<kwidth; ++j) {
+                    int first, last;
+                    getColumnRange(sw, j - (int)pl, bwidth, width, first, last);
+                    for (int n=0; n<batch; ++n) {
+                        const dtype *x   = getDomData(c).data() + n * bsize;
+                        dtype       *col = columns.data((c * kheight + i) * kwidth + j) + n * dsize;
+                        for (int a=0; a<height; ++a) {
+                            int    row = a * sw + i - pt;
+                            dtype *out = col + a * width;
+                            if (row < 0 || bheight <= row) {
+                                std::fill(out, out + width, 0);
+                                continue;
+                            }
+                            const dtype *in = x + row * bwidth + j - (int)pl;
+                            std::fill(out, out + first, 0);
+                            for (int b=first; b<last; ++b) {
+                                out[b] = in[b * sw];
+                            }
+                            std::fill(out + last, out + width, 0);
+                        }
                     }
                 }
-                data.at(time).at(a * width + b) = sum / (kheight * kwidth);
             }
         }
     }
 
-    void AveragePooling2d::calcPartialDerivative()
+    void Convolution2d::col2im() // scatter gradColumns back onto the input gradients
     {
-        size_t bheight = backward.at(0)->height;
-        size_t bwidth  = backward.at(0)->width;
-        for (int a=0; a<bheight; ++a) {
-            for (int b=0; b<bwidth; ++b) {
-                //backward.at(0)->grad.at(0).at(a * bwidth + b) = 0;
-                for (int i=(a+pt)%sw; i<kheight; i+=sw) {
-                    for (int j=(b+pl)%sw; j<kwidth; j+=sw) {
-                        int col = (a - i + pt) / sw;
-                        int row = (b - j + pl) / sw;
-                        if (   0 <= col && col < height && 0 <= row && row < width) {
-                            backward.at(0)->grad.at(time).at(a * bwidth + b) += grad.at(time).at(col * width + row) / (kheight * kwidth);
+        int bheight = backward.at(0)->height;
+        int bwidth  = backward.at(0)->width;
+        int bsize   = bheight * bwidth;
+
+        for (int c=0; c<backward.size(); ++c) {
+            for (int i=0; i<kheight; ++i) {
+                for (int j=0; j<kwidth; ++j) {
+                    int first, last;
+                    getColumnRange(sw, j - (int)pl, bwidth, width, first, last);
+                    for (int n=0; n<batch; ++n) {
+                        dtype       *dx  = getDomGrad(c).data() + n * bsize;
+                        const dtype *col = gradColumns.data((c * kheight + i) * kwidth + j) + n * dsize;
+                        for (int a=0; a<height; ++a) {
+                            int row = a * sw + i - pt;
+                            if (row < 0 || bheight <= row) {
+                                continue;
+                            }
+                            dtype       *out = dx + row * bwidth + j - (int)pl;
+                            const dtype *in  = col + a * width;
+                            for (int b=first; b<last; ++b) {
+                                out[b * sw] += in[b];
+                            }
                         }
                     }
                 }
@@ -885,15 +1865,906 @@ namespace CG
         }
     }
 
+    void Convolution2d::calcDataIm2col() // Y[1][batch * dsize] = K columns
+    {
+        dtype *Y = getData().data();
+        std::fill(Y, Y + batch * dsize, bias.data()[0]);
+        im2col();
+        CGK::gemm(1, batch * dsize, columns.size(), kernel.data(), columns.data(), Y);
+    }
 
-
-    size_t getSumSizeOfData(vec1<Node*> nodes)
+    void Convolution2d::calcPartialDerivativeIm2col() // gradKernel += G columns^T, gradColumns = K^T G
     {
-        size_t ret = 0;
-        for (int i=0; i<nodes.size(); ++i) {
-            ret += nodes.at(i)->dsize;
+        const dtype *G = getGrad().data();
+        im2col();
+        gradColumns.fill(0);
+        CGK::gemmBackward(1, batch * dsize, columns.size(), kernel.data(), columns.data(), G, gradKernel.data(), gradColumns.data());
+        col2im();
+        for (int index=0; index<batch * dsize; ++index) {
+            gradBias += G[index];
         }
-        return ret;
+    }
+
+    void Convolution2d::prepareWinograd(const CGK::Winograd &w) // rebuilt after the kernel changed
+    {
+        if (winogradVersion == *kernelVersion && winogradKernel.rank() != 0 && winogradKernel.size(0) == w.alpha * w.alpha) {
+            return;
+        }
+        winogradVersion = *kernelVersion;
+        winogradKernel  = transformKernels(w, kernel, 1, backward.size());
+    }
+
+    void Convolution2d::calcDataWinograd() // y = AT [sum_c (G k_c G^T) . (BT d_c B)] A for every m x m output tile
+    {
+        assert (winogradTile() > 0);
+        const CGK::Winograd &w = CGK::getWinograd(winogradTile(), kheight);
+        prepareWinograd(w);
+        winogradForward(*this, w, winogradKernel, bias.data(), getData().data());
+    }
+
+    void Convolution2d::calcPartialDerivativeWinograd()
+    {
+        assert (winogradTile() > 0);
+        const CGK::Winograd &w = CGK::getWinograd(winogradTile(), kheight);
+        prepareWinograd(w);
+        winogradBackward(*this, w, winogradKernel, Tensor(), getGrad().data(), gradKernel.data(), &gradBias);
+    }
+
+    void Convolution2d::prepareFFT(size_t rows, size_t cols) // rebuilt after the kernel changed
+    {
+        if (fftVersion == *kernelVersion && fftKernel.rank() != 0 && fftKernel.size(2) == rows * (cols / 2 + 1) * 2) {
+            return;
+        }
+        fftVersion = *kernelVersion;
+        fftKernel  = kernelSpectra(kernel, 1, backward.size(), kheight, kwidth, rows, cols);
+    }
+
+    void Convolution2d::calcDataFFT()
+    {
+        size_t rows, cols;
+        fftShape(rows, cols);
+        prepareFFT(rows, cols);
+        fftForward(*this, rows, cols, fftKernel, Tensor(), bias.data(), getData().data());
+    }
+
+    void Convolution2d::calcPartialDerivativeFFT()
+    {
+        size_t rows, cols;
+        fftShape(rows, cols);
+        prepareFFT(rows, cols);
+        fftBackward(*this, rows, cols, fftKernel, Tensor(), getGrad().data(), gradKernel.data(), &gradBias);
+    }
+
+    void Convolution2d::calcDataDirect() // checked border columns, branch-free interior
+    {    
+        int bheight = backward.at(0)->height;
+        int bwidth  = backward.at(0)->width;
+        int bsize   = bheight * bwidth;
+
+        for (int n=0; n<batch; ++n) {
+            dtype *y = getData().data() + n * dsize;
+            for (int index=0; index<dsize; ++index) {
+                y[index] = bias.data()[0];
+            }
+            for (int c=0; c<backward.size(); ++c) {
+                const dtype *x = getDomData(c).data() + n * bsize;
+                const dtype *k = kernel.data(c);
+                for (int a=0; a<height; ++a) {
+                    dtype *yrow = y + a * width;
+                    for (int i=0; i<kheight; ++i) {
+                        int col = a * sw + i - pt;
+                        if (col < 0 || bheight <= col) {
+                            continue;
+                        }
+                        const dtype *xrow = x + col * bwidth;
+                        const dtype *krow = k + i * kwidth;
+                        for (int b=0; b<interiorLeft; ++b) {
+                            yrow[b] += dotClamped(xrow, b * sw - pl, bwidth, krow, kwidth);
+                        }
+                        if (specialized != nullptr) {
+                            specialized->convolution(xrow + interiorLeft * sw - pl, krow, yrow + interiorLeft, interiorRight - interiorLeft);
+                        } else {
+                            for (int j=0; j<kwidth; ++j) { // taps outside, so that the loop vectorizes
+                                const dtype *xj = xrow + interiorLeft * sw + j - pl;
+                                dtype        kj = krow[j];
+                                for (int b=interiorLeft; b<interiorRight; ++b) {
+                                    yrow[b] += kj * xj[(b - interiorLeft) * sw];
+                                }
+                            }
+                        }
+                        for (int b=interiorRight; b<width; ++b) {
+                            yrow[b] += dotClamped(xrow, b * sw - pl, bwidth, krow, kwidth);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void Convolution2d::calcPartialDerivativeDirect()
+    {
+        int bheight = backward.at(0)->height;
+        int bwidth  = backward.at(0)->width;
+        int bsize   = bheight * bwidth;
+
+        for (int n=0; n<batch; ++n) {
+            const dtype *g = getGrad().data() + n * dsize;
+            for (int c=0; c<backward.size(); ++c) { // scatter over the receptive field
+                const dtype *x  = getDomData(c).data() + n * bsize;
+                dtype       *dx = getDomGrad(c).data() + n * bsize;
+                const dtype *k  = kernel.data(c);
+                dtype       *gk = gradKernel.data(c);
+                for (int a=0; a<height; ++a) {
+                    const dtype *grow = g + a * width;
+                    for (int i=0; i<kheight; ++i) {
+                        int col = a * sw + i - pt;
+                        if (col < 0 || bheight <= col) {
+                            continue;
+                        }
+                        const dtype *xrow  = x  + col * bwidth;
+                        dtype       *dxrow = dx + col * bwidth;
+                        const dtype *krow  = k  + i * kwidth;
+                        dtype       *gkrow = gk + i * kwidth;
+                        for (int b=0; b<interiorLeft; ++b) {
+                            scatterClamped(xrow, dxrow, b * sw - pl, bwidth, krow, gkrow, kwidth, grow[b]);
+                        }
+                        if (specialized != nullptr) {
+                            specialized->convolutionBackward(xrow + interiorLeft * sw - pl, dxrow + interiorLeft * sw - pl, krow, gkrow, grow + interiorLeft, interiorRight - interiorLeft);
+                        } else {
+                            for (int j=0; j<kwidth; ++j) {
+                                const dtype *xj  = xrow  + interiorLeft * sw + j - pl;
+                                dtype       *dxj = dxrow + interiorLeft * sw + j - pl;
+                                dtype        kj  = krow[j];
+                                dtype        sum = 0;
+                                for (int b=interiorLeft; b<interiorRight; ++b) {
+                                    dxj[(b - interiorLeft) * sw] += kj * grow[b];
+                                    sum                         += xj[(b - interiorLeft) * sw] * grow[b];
+                                }
+                                gkrow[j] += sum;
+                            }
+                        }
+                        for (int b=interiorRight; b<width; ++b) {
+                            scatterClamped(xrow, dxrow, b * sw - pl, bwidth, krow, gkrow, kwidth, grow[b]);
+                        }
+                    }
+                }
+            }
+            for (int index=0; index<dsize; ++index) {
+                gradBias += g[index];
+            }
+        }
+    }
+
+    void Convolution2d::updateParameters(dtype eta)
+    {
+        dtype *k  = kernel.data();
+        dtype *gk = gradKernel.data();
+        size_t n  = kernel.numel();
+        for (int i=0; i<n; ++i) {
+            k[i] -= eta * gk[i];
+            gk[i] = 0;
+        }
+        bias.data()[0] -= eta * gradBias;
+        gradBias = 0;
+        ++*kernelVersion; // invalidates the transforms of every replica
+    }
+
+    void Convolution2d::mergeGradients(Node *node)
+    {
+        Convolution2d *conv = dynamic_cast<Convolution2d*>(node);
+        assert (conv != nullptr && conv->gradKernel.numel() == gradKernel.numel());
+        dtype *gk = gradKernel.data();
+        dtype *go = conv->gradKernel.data();
+        size_t n  = gradKernel.numel();
+        for (int i=0; i<n; ++i) {
+            gk[i] += go[i];
+            go[i] = 0;
+        }
+        gradBias += conv->gradBias;
+        conv->gradBias = 0;
+    }
+
+
+
+    MultiConvolution2d::MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width)
+    : Filter2d (nodes, Kernel.size(2), Kernel.size(3), stride, topPadding, leftPadding, height, width, Kernel.size(0)), domChannels(getSumOfChannels(nodes))
+    {
+        assert (Kernel.rank() == 4 && Kernel.size(1) == domChannels);
+        assert (Bias.numel() == channels);
+        assert (Mask.rank() == 0 || (Mask.rank() == 2 && Mask.size(0) == channels && Mask.size(1) == domChannels));
+        for (int k=0; k<nodes.size(); ++k) {
+            assert (nodes.at(k)->width == nodes.at(0)->width);
+        }
+
+        kernel = std::move(Kernel);
+        bias   = std::move(Bias);
+        mask   = std::move(Mask);
+
+        gradKernel = Tensor(kernel.shape);
+        gradBias   = Tensor(bias.shape);
+
+        kernelVersion   = std::make_shared<std::atomic<size_t>>(0);
+        winogradVersion = (size_t)-1;
+        fftVersion      = (size_t)-1;
+
+        if (mask.rank() != 0) { // unconnected pairs start at zero and stay there
+            size_t block = kheight * kwidth;
+            for (int o=0; o<channels; ++o) {
+                for (int c=0; c<domChannels; ++c) {
+                    if (mask.at(o, c) == 0) {
+                        std::fill(kernel.data(o) + c * block, kernel.data(o) + (c + 1) * block, 0);
+                    }
+                }
+            }
+        }
+    }
+
+    MultiConvolution2d::MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask, size_t stride, size_t height, size_t width)
+    : MultiConvolution2d (nodes, Kernel, Bias, Mask, stride, (stride*(height-1) + Kernel.size(2) - nodes.at(0)->height/nodes.at(0)->channels)/2, (stride*(width-1) + Kernel.size(3) - nodes.at(0)->width)/2, height, width)
+    {
+        assert (stride * (height - 1) + kheight >= domHeight);
+        assert (stride * (width  - 1) + kwidth  >= nodes.at(0)->width);
+    }
+
+    MultiConvolution2d::MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask, size_t stride)
+    : MultiConvolution2d (nodes, Kernel, Bias, Mask, stride, (nodes.at(0)->height/nodes.at(0)->channels - Kernel.size(2) + (stride-1))/stride + 1, (nodes.at(0)->width - Kernel.size(3) + (stride-1))/stride + 1){}
+
+    MultiConvolution2d::MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask, size_t height, size_t width)
+    : MultiConvolution2d (nodes, Kernel, Bias, Mask, 1, height, width){}
+
+    MultiConvolution2d::MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask)
+    : MultiConvolution2d (nodes, Kernel, Bias, Mask, 1, nodes.at(0)->height/nodes.at(0)->channels - (Kernel.size(2)-1), nodes.at(0)->width - (Kernel.size(3)-1)){}
+
+    Node* MultiConvolution2d::replicate(vec1<Node*> nodes)
+    {
+        MultiConvolution2d *node = new MultiConvolution2d(nodes, Tensor(kernel.shape), Tensor(bias.shape), mask, sw, pt, pl, mapHeight, width);
+        node->kernel.share(kernel);
+        node->bias.share(bias);
+        node->algorithm = algorithm;
+        node->kernelVersion = kernelVersion;
+        return node;
+    }
+
+    void MultiConvolution2d::im2col() // columns[(c * kheight + i) * kwidth + j][n * size + a * width + b] = X_c[n][a*sw + i - pt][b*sw + j - pl], 0 outside
+    {
+        int bwidth  = backward.at(0)->width;
+        int bsize   = domHeight * bwidth; // of one map
+        int size    = mapHeight * width;
+        size_t depth = domChannels * kheight * kwidth;
+        if (columns.rank() == 0 || columns.size(1) != batch * size) {
+            columns     = Tensor({depth, batch * size});
+            gradColumns = Tensor({depth, batch * size});
+        }
+
+        for (int c=0, k=0, ck=0; c<domChannels; ++c, ++ck) { // map ck of input k
+            if (ck == backward.at(k)->channels) {
+                ++k;
+                ck = 0;
+            }
+            size_t cin = backward.at(k)->channels;
+            for (int i=0; i<kheight; ++i) {
+                for (int j=0; j<kwidth; ++j) {
+                    int first, last;
+                    getColumnRange(sw, j - (int)pl, bwidth, width, first, last);
+                    for (int n=0; n<batch; ++n) {
+                        const dtype *x   = getDomData(k).data() + (n * cin + ck) * bsize;
+                        dtype       *col = columns.data((c * kheight + i) * kwidth + j) + n * size;
+                        for (int a=0; a<mapHeight; ++a) {
+                            int    row = a * sw + i - pt;
+                            dtype *out = col + a * width;
+                            if (row < 0 || domHeight <= row) {
+                                std::fill(out, out + width, 0);
+                                continue;
+                            }
+                            const dtype *in = x + row * bwidth + j - (int)pl;
+                            std::fill(out, out + first, 0);
+                            for (int b=first; b<last; ++b) {
+                                out[b] = in[b * sw];
+                            }
+                            std::fill(out + last, out + width, 0);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void MultiConvolution2d::col2im() // scatter gradColumns back onto the input gradients
+    {
+        int bwidth  = backward.at(0)->width;
+        int bsize   = domHeight * bwidth;
+        int size    = mapHeight * width;
+
+        for (int c=0, k=0, ck=0; c<domChannels; ++c, ++ck) {
+            if (ck == backward.at(k)->channels) {
+                ++k;
+                ck = 0;
+            }
+            size_t cin = backward.at(k)->channels;
+            for (int i=0; i<kheight; ++i) {
+                for (int j=0; j<kwidth; ++j) {
+                    int first, last;
+                    getColumnRange(sw, j - (int)pl, bwidth, width, first, last);
+                    for (int n=0; n<batch; ++n) {
+                        dtype       *dx  = getDomGrad(k).data() + (n * cin + ck) * bsize;
+                        const dtype *col = gradColumns.data((c * kheight + i) * kwidth + j) + n * size;
+                        for (int a=0; a<mapHeight; ++a) {
+                            int row = a * sw + i - pt;
+                            if (row < 0 || domHeight <= row) {
+                                continue;
+                            }
+                            dtype       *out = dx + row * bwidth + j - (int)pl;
+                            const dtype *in  = col + a * width;
+                            for (int b=first; b<last; ++b) {
+                                out[b * sw] += in[b];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    ConvAlgorithm MultiConvolution2d::selectAlgorithm()
+    {
+        if (algorithm != ConvAlgorithm::Auto) {
+            return algorithm;
+        }
+        if (chosenBatch != batch) {
+            vec1<ConvAlgorithm> algorithms = {ConvAlgorithm::Im2col, ConvAlgorithm::FFT};
+            if (winogradTile() != 0) {
+                algorithms.push_back(ConvAlgorithm::Winograd);
+            }
+            chosen      = fastest(algorithms, this, [this](ConvAlgorithm a){ calcData(a); });
+            chosenBatch = batch;
+        }
+        return chosen;
+    }
+
+    void MultiConvolution2d::calcData()
+    {
+        calcData(selectAlgorithm());
+    }
+
+    void MultiConvolution2d::calcData(ConvAlgorithm algorithm)
+    {
+        switch (algorithm) {
+            case ConvAlgorithm::Winograd : calcDataWinograd(); break;
+            case ConvAlgorithm::FFT      : calcDataFFT(); break;
+            default                      : calcDataIm2col(); break;
+        }
+    }
+
+    void MultiConvolution2d::calcPartialDerivative()
+    {
+        switch (selectAlgorithm()) {
+            case ConvAlgorithm::Winograd : calcPartialDerivativeWinograd(); break;
+            case ConvAlgorithm::FFT      : calcPartialDerivativeFFT(); break;
+            default                      : calcPartialDerivativeIm2col(); break;
+        }
+    }
+
+    void MultiConvolution2d::calcDataIm2col() // output[channels][batch * size] = K columns
+    {
+        size_t size = mapHeight * width;
+        dtype *Y = getData().data();
+        if (output.numel() != batch * dsize) {
+            output = Tensor({channels, batch * size});
+        }
+        dtype *O = (batch == 1) ? Y : output.data(); // a single sample is already in place
+        for (int o=0; o<channels; ++o) {
+            std::fill(O + o * batch * size, O + (o + 1) * batch * size, bias.data()[o]);
+        }
+        im2col();
+        multiply(O);
+        if (batch != 1) {
+            for (int n=0; n<batch; ++n) {
+                for (int o=0; o<channels; ++o) {
+                    std::copy(O + (o * batch + n) * size, O + (o * batch + n + 1) * size, Y + (n * channels + o) * size);
+                }
+            }
+        }
+    }
+
+    void MultiConvolution2d::calcPartialDerivativeIm2col() // gradKernel += G columns^T, gradColumns = K^T G
+    {
+        size_t size = mapHeight * width;
+        const dtype *G = getGrad().data();
+        if (batch != 1) {
+            if (output.numel() != batch * dsize) {
+                output = Tensor({channels, batch * size});
+            }
+            for (int n=0; n<batch; ++n) {
+                for (int o=0; o<channels; ++o) {
+                    std::copy(G + (n * channels + o) * size, G + (n * channels + o + 1) * size, output.data() + (o * batch + n) * size);
+                }
+            }
+            G = output.data();
+        }
+        im2col();
+        gradColumns.fill(0);
+        multiplyBackward(G);
+        col2im();
+        for (int o=0; o<channels; ++o) {
+            dtype sum = 0;
+            for (int index=0; index<batch * size; ++index) {
+                sum += G[o * batch * size + index];
+            }
+            gradBias.data()[o] += sum;
+        }
+    }
+
+    void MultiConvolution2d::prepareWinograd(const CGK::Winograd &w) // rebuilt after the kernel changed
+    {
+        if (winogradVersion == *kernelVersion && winogradKernel.rank() != 0 && winogradKernel.size(0) == w.alpha * w.alpha) {
+            return;
+        }
+        winogradVersion = *kernelVersion;
+        winogradKernel  = transformKernels(w, kernel, channels, domChannels);
+    }
+
+    void MultiConvolution2d::calcDataWinograd()
+    {
+        assert (winogradTile() > 0);
+        const CGK::Winograd &w = CGK::getWinograd(winogradTile(), kheight);
+        prepareWinograd(w);
+        winogradForward(*this, w, winogradKernel, bias.data(), getData().data());
+    }
+
+    void MultiConvolution2d::calcPartialDerivativeWinograd()
+    {
+        assert (winogradTile() > 0);
+        const CGK::Winograd &w = CGK::getWinograd(winogradTile(), kheight);
+        prepareWinograd(w);
+        winogradBackward(*this, w, winogradKernel, mask, getGrad().data(), gradKernel.data(), gradBias.data());
+    }
+
+    void MultiConvolution2d::prepareFFT(size_t rows, size_t cols)
+    {
+        if (fftVersion == *kernelVersion && fftKernel.rank() != 0 && fftKernel.size(2) == rows * (cols / 2 + 1) * 2) {
+            return;
+        }
+        fftVersion = *kernelVersion;
+        fftKernel  = kernelSpectra(kernel, channels, domChannels, kheight, kwidth, rows, cols);
+    }
+
+    void MultiConvolution2d::calcDataFFT()
+    {
+        size_t rows, cols;
+        fftShape(rows, cols);
+        prepareFFT(rows, cols);
+        fftForward(*this, rows, cols, fftKernel, mask, bias.data(), getData().data());
+    }
+
+    void MultiConvolution2d::calcPartialDerivativeFFT()
+    {
+        size_t rows, cols;
+        fftShape(rows, cols);
+        prepareFFT(rows, cols);
+        fftBackward(*this, rows, cols, fftKernel, mask, getGrad().data(), gradKernel.data(), gradBias.data());
+    }
+
+    void MultiConvolution2d::multiply(dtype *O)
+    {
+        CGK::gemm(channels, columns.size(1), columns.size(0), kernel.data(), columns.data(), O);
+    }
+
+    void MultiConvolution2d::multiplyBackward(const dtype *G)
+    {
+        CGK::gemmBackward(channels, columns.size(1), columns.size(0), kernel.data(), columns.data(), G, gradKernel.data(), gradColumns.data());
+    }
+
+    void MultiConvolution2d::updateParameters(dtype eta) // the gradients of unconnected pairs are dropped
+    {
+        size_t block = kheight * kwidth;
+        for (int o=0; o<channels; ++o) {
+            for (int c=0; c<domChannels; ++c) {
+                dtype *k  = kernel.data(o) + c * block;
+                dtype *gk = gradKernel.data(o) + c * block;
+                dtype  m  = (mask.rank() == 0) ? 1 : mask.at(o, c);
+                for (int i=0; i<block; ++i) {
+                    k[i] -= m * eta * gk[i];
+                    gk[i] = 0;
+                }
+            }
+            bias.data()[o] -= eta * gradBias.data()[o];
+            gradBias.data()[o] = 0;
+        }
+        ++*kernelVersion;
+    }
+
+    void MultiConvolution2d::mergeGradients(Node *node)
+    {
+        MultiConvolution2d *conv = dynamic_cast<MultiConvolution2d*>(node);
+        assert (conv != nullptr && conv->gradKernel.numel() == gradKernel.numel());
+        dtype *gk = gradKernel.data();
+        dtype *go = conv->gradKernel.data();
+        size_t n  = gradKernel.numel();
+        for (int i=0; i<n; ++i) {
+            gk[i] += go[i];
+            go[i] = 0;
+        }
+        for (int o=0; o<channels; ++o) {
+            gradBias.data()[o] += conv->gradBias.data()[o];
+            conv->gradBias.data()[o] = 0;
+        }
+    }
+
+
+
+    GroupedConvolution2d::GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width)
+    : MultiConvolution2d (nodes, Kernel, Bias, Connection, stride, topPadding, leftPadding, height, width)
+    {
+        assert (mask.rank() == 2);
+    }
+
+    GroupedConvolution2d::GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection, size_t stride, size_t height, size_t width)
+    : MultiConvolution2d (nodes, Kernel, Bias, Connection, stride, height, width)
+    {
+        assert (mask.rank() == 2);
+    }
+
+    GroupedConvolution2d::GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection, size_t stride)
+    : MultiConvolution2d (nodes, Kernel, Bias, Connection, stride)
+    {
+        assert (mask.rank() == 2);
+    }
+
+    GroupedConvolution2d::GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection, size_t height, size_t width)
+    : MultiConvolution2d (nodes, Kernel, Bias, Connection, height, width)
+    {
+        assert (mask.rank() == 2);
+    }
+
+    GroupedConvolution2d::GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection)
+    : MultiConvolution2d (nodes, Kernel, Bias, Connection)
+    {
+        assert (mask.rank() == 2);
+    }
+
+    Node* GroupedConvolution2d::replicate(vec1<Node*> nodes)
+    {
+        GroupedConvolution2d *node = new GroupedConvolution2d(nodes, Tensor(kernel.shape), Tensor(bias.shape), mask, sw, pt, pl, mapHeight, width);
+        node->kernel.share(kernel);
+        node->bias.share(bias);
+        node->algorithm = algorithm;
+        node->kernelVersion = kernelVersion;
+        return node;
+    }
+
+    void GroupedConvolution2d::multiply(dtype *O) // one product per run of connected input channels
+    {
+        size_t block = kheight * kwidth;
+        size_t depth = columns.size(0);
+        size_t N     = columns.size(1);
+        size_t step  = std::max<size_t>(64, (1 << 15) / depth / 8 * 8);
+        for (size_t j=0; j<N; j+=step) {
+            size_t n = std::min(step, N - j);
+            for (int o=0; o<channels; ++o) {
+                for (int c=0; c<domChannels; ++c) {
+                    if (mask.at(o, c) == 0) {
+                        continue;
+                    }
+                    int last = c + 1;
+                    while (last < domChannels && mask.at(o, last) != 0) {
+                        ++last;
+                    }
+                    CGK::gemm(1, n, (last - c) * block, kernel.data(o) + c * block, depth, columns.data(c * block) + j, N, O + o * N + j, N);
+                    c = last;
+                }
+            }
+        }
+    }
+
+    void GroupedConvolution2d::multiplyBackward(const dtype *G)
+    {
+        size_t block = kheight * kwidth;
+        size_t depth = columns.size(0);
+        size_t N     = columns.size(1);
+        size_t step  = std::max<size_t>(64, (1 << 15) / depth / 8 * 8);
+        for (size_t j=0; j<N; j+=step) {
+            size_t n = std::min(step, N - j);
+            for (int o=0; o<channels; ++o) {
+                for (int c=0; c<domChannels; ++c) {
+                    if (mask.at(o, c) == 0) {
+                        continue;
+                    }
+                    int last = c + 1;
+                    while (last < domChannels && mask.at(o, last) != 0) {
+                        ++last;
+                    }
+                    CGK::gemmBackward(1, n, (last - c) * block, kernel.data(o) + c * block, depth, columns.data(c * block) + j, N, G + o * N + j, N, gradKernel.data(o) + c * block, gradColumns.data(c * block) + j);
+                    c = last;
+                }
+            }
+        }
+    }
+
+
+
+    MaxPooling2d::MaxPooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width) // each channel is pooled separately
+    : Filter2d ({node1}, kernelHeight, kernelWidth, stride, topPadding, leftPadding, height, width, node1->channels)
+    {   
+        int bottomPadding = stride * (height - 1) + kernelHeight - domHeight - topPadding;
+        int rightPadding  = stride * (width  - 1) + kernelWidth  - node1->width  - leftPadding;
+        assert (topPadding  < kernelHeight && bottomPadding < kernelHeight);
+        assert (leftPadding < kernelWidth  && rightPadding  < kernelWidth);
+
+        resizeMaxima();
+    }
+
+    void MaxPooling2d::reserve(ttype time)
+    {
+        Node::reserve(time);
+        resizeMaxima();
+    }
+
+    void MaxPooling2d::setWindow(ttype window)
+    {
+        Node::setWindow(window);
+        resizeMaxima();
+    }
+
+    void MaxPooling2d::setBatch(size_t batch)
+    {
+        Node::setBatch(batch);
+        resizeMaxima();
+    }
+
+    void MaxPooling2d::setInference(bool inference) // the maxima are only needed by the backward pass
+    {
+        Node::setInference(inference);
+        resizeMaxima();
+        maxCount.shrink_to_fit();
+        argmax.shrink_to_fit();
+    }
+
+    void MaxPooling2d::resizeMaxima() // one slot per time step kept, like f_count
+    {
+        size_t T = inference ? 0 : f_count.size();
+        maxCount.resize(T);
+        argmax.resize(T);
+        for (int t=0; t<T; ++t) {
+            maxCount.at(t).resize(batch * dsize);
+            argmax.at(t).resize(batch * dsize);
+        }
+    }
+
+    MaxPooling2d::MaxPooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t height, size_t width)
+    : MaxPooling2d (node1, kernelHeight, kernelWidth, stride, (stride*(height-1) + kernelHeight - node1->height/node1->channels)/2, (stride*(width-1) + kernelWidth - node1->width)/2, height, width){}
+
+    MaxPooling2d::MaxPooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride)
+    : MaxPooling2d (node1, kernelHeight, kernelWidth, stride, (node1->height/node1->channels - kernelHeight + (stride-1))/stride + 1, (node1->width - kernelWidth + (stride-1))/stride + 1){}
+
+    Node* MaxPooling2d::replicate(vec1<Node*> nodes)
+    {
+        return new MaxPooling2d(nodes.at(0), kheight, kwidth, sw, pt, pl, mapHeight, width);
+    }
+
+    void Filter2d::getWindow(int a, int b, int &i0, int &i1, int &j0, int &j1) // taps of the window of (a, b) inside the input
+    {
+        if (interiorTop <= a && a < interiorBottom && interiorLeft <= b && b < interiorRight) {
+            i0 = 0;
+            i1 = kheight;
+            j0 = 0;
+            j1 = kwidth;
+            return;
+        }
+        int top  = a * sw - pt;
+        int left = b * sw - pl;
+        i0 = std::max(0, -top);
+        i1 = std::min<int>(kheight, domHeight - top);
+        j0 = std::max(0, -left);
+        j1 = std::min<int>(kwidth,  backward.at(0)->width  - left);
+    }
+
+    void MaxPooling2d::calcData()
+    {
+        int bwidth = backward.at(0)->width;
+        int bsize  = domsize / channels;
+        int size   = dsize / channels;
+        for (int n=0; n<batch * channels; ++n) { // one map at a time
+            const dtype  *x     = getDomData(0).data() + n * bsize;
+            dtype        *y     = getData().data() + n * size;
+            unsigned int *count = inference ? nullptr : maxCount.at(slot(time)).data() + n * size;
+            int          *first = inference ? nullptr : argmax.at(slot(time)).data() + n * size;
+            for (int a=0; a<mapHeight; ++a) {
+                int left  = width; // left to the specialized loop
+                int right = width;
+                if (specialized != nullptr && interiorTop <= a && a < interiorBottom) {
+                    left  = interiorLeft;
+                    right = interiorRight;
+                    specialized->maxPool(x, (a * sw - (int)pt) * bwidth + left * sw - (int)pl, bwidth, y + a * width + left,
+                                         count == nullptr ? nullptr : count + a * width + left, first == nullptr ? nullptr : first + a * width + left, right - left);
+                }
+                for (int b=0; b<width; ++b) {
+                    if (left <= b && b < right) {
+                        continue;
+                    }
+                    int i0, i1, j0, j1;
+                    getWindow(a, b, i0, i1, j0, j1);
+                    int offset = (a * sw - (int)pt) * bwidth + b * sw - (int)pl; // of tap (0, 0), which may lie in the padding
+                    int cnt = 0;
+                    int arg = -1;
+                    dtype max = std::nan("");
+                    for (int i=i0; i<i1; ++i) {
+                        for (int j=j0; j<j1; ++j) {
+                            dtype d = x[offset + i * bwidth + j];
+                            if (std::isnan(max) || max < d) {
+                                max = d;
+                                cnt = 1;
+                                arg = offset + i * bwidth + j;
+                            } else if (max == d) {
+                                ++cnt;
+                            }
+                        }
+                    }
+                    assert (!std::isnan(max));
+                    y[a * width + b] = max;
+                    if (count != nullptr) {
+                        count[a * width + b] = cnt;
+                        first[a * width + b] = arg; // within the map
+                    }
+                }
+            }
+        }
+    }
+
+    void MaxPooling2d::calcPartialDerivative() // a scatter to the recorded maximum
+    {
+        int bwidth = backward.at(0)->width;
+        int bsize  = domsize / channels;
+        int size   = dsize / channels;
+        for (int n=0; n<batch * channels; ++n) {
+            const dtype        *g     = getGrad().data() + n * size;
+            const dtype        *y     = getData().data() + n * size;
+            const unsigned int *count = maxCount.at(slot(time)).data() + n * size;
+            const int          *first = argmax.at(slot(time)).data() + n * size;
+            const dtype        *x     = getDomData(0).data() + n * bsize;
+            dtype              *dx    = getDomGrad(0).data() + n * bsize;
+            for (int index=0; index<size; ++index) {
+                if (count[index] == 1) {
+                    dx[first[index]] += g[index];
+                    continue;
+                }
+                int a = index / width;
+                int b = index % width;
+                int i0, i1, j0, j1;
+                getWindow(a, b, i0, i1, j0, j1);
+                int    offset = (a * sw - (int)pt) * bwidth + b * sw - (int)pl;
+                dtype  ga     = g[index] / count[index];
+                for (int i=i0; i<i1; ++i) {
+                    for (int j=j0; j<j1; ++j) {
+                        if (x[offset + i * bwidth + j] == y[index]) {
+                            dx[offset + i * bwidth + j] += ga;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+
+
+    AveragePooling2d::AveragePooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width) // each channel is pooled separately
+    : Filter2d ({node1}, kernelHeight, kernelWidth, stride, topPadding, leftPadding, height, width, node1->channels)
+    {   
+        int bottomPadding = stride * (height - 1) + kernelHeight - domHeight - topPadding;
+        int rightPadding  = stride * (width  - 1) + kernelWidth  - node1->width  - leftPadding;
+        assert (topPadding  < kernelHeight && bottomPadding < kernelHeight);
+        assert (leftPadding < kernelWidth  && rightPadding  < kernelWidth);
+    }
+
+    AveragePooling2d::AveragePooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t height, size_t width)
+    : AveragePooling2d (node1, kernelHeight, kernelWidth, stride, (stride*(height-1) + kernelHeight - node1->height/node1->channels)/2, (stride*(width-1) + kernelWidth - node1->width)/2, height, width){}
+
+    AveragePooling2d::AveragePooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride)
+    : AveragePooling2d (node1, kernelHeight, kernelWidth, stride, (node1->height/node1->channels - kernelHeight + (stride-1))/stride + 1, (node1->width - kernelWidth + (stride-1))/stride + 1){}
+
+    Node* AveragePooling2d::replicate(vec1<Node*> nodes)
+    {
+        return new AveragePooling2d(nodes.at(0), kheight, kwidth, sw, pt, pl, mapHeight, width);
+    }
+
+    void AveragePooling2d::calcData() // the padding counts as zeros
+    {
+        int bwidth = backward.at(0)->width;
+        int bsize  = domsize / channels;
+        int size   = dsize / channels;
+        for (int n=0; n<batch * channels; ++n) { // one map at a time
+            const dtype *x = getDomData(0).data() + n * bsize;
+            dtype       *y = getData().data() + n * size;
+            for (int a=0; a<mapHeight; ++a) {
+                int left  = width; // left to the specialized loop
+                int right = width;
+                if (specialized != nullptr && interiorTop <= a && a < interiorBottom) {
+                    left  = interiorLeft;
+                    right = interiorRight;
+                    specialized->averagePool(x + (a * sw - (int)pt) * bwidth + left * sw - (int)pl, bwidth, y + a * width + left, right - left);
+                }
+                for (int b=0; b<width; ++b) {
+                    if (left <= b && b < right) {
+                        continue;
+                    }
+                    int i0, i1, j0, j1;
+                    getWindow(a, b, i0, i1, j0, j1);
+                    int offset = (a * sw - (int)pt) * bwidth + b * sw - (int)pl; // of tap (0, 0), which may lie in the padding
+                    dtype sum = 0;
+                    for (int i=i0; i<i1; ++i) {
+                        for (int j=j0; j<j1; ++j) {
+                            sum += x[offset + i * bwidth + j];
+                        }
+                    }
+                    y[a * width + b] = sum / (kheight * kwidth);
+                }
+            }
+        }
+    }
+
+    void AveragePooling2d::calcPartialDerivative()
+    {
+        int bwidth = backward.at(0)->width;
+        int bsize  = domsize / channels;
+        int size   = dsize / channels;
+        for (int n=0; n<batch * channels; ++n) {
+            const dtype *g  = getGrad().data() + n * size;
+            dtype       *dx = getDomGrad(0).data() + n * bsize;
+            for (int a=0; a<mapHeight; ++a) {
+                int left  = width;
+                int right = width;
+                if (specialized != nullptr && interiorTop <= a && a < interiorBottom) {
+                    left  = interiorLeft;
+                    right = interiorRight;
+                    specialized->averagePoolBackward(dx + (a * sw - (int)pt) * bwidth + left * sw - (int)pl, bwidth, g + a * width + left, right - left);
+                }
+                for (int b=0; b<width; ++b) {
+                    if (left <= b && b < right) {
+                        continue;
+                    }
+                    int i0, i1, j0, j1;
+                    getWindow(a, b, i0, i1, j0, j1);
+                    int   offset = (a * sw - (int)pt) * bwidth + b * sw - (int)pl;
+                    dtype ga     = g[a * width + b] / (kheight * kwidth);
+                    for (int i=i0; i<i1; ++i) {
+                        for (int j=j0; j<j1; ++j) {
+                            dx[offset + i * bwidth + j] += ga;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+
+
+    size_t getSumSizeOfData(vec1<Node*> nodes)
+    {
+        size_t ret = 0;
+        for (int i=0; i<nodes.size(); ++i) {
+            ret += nodes.at(i)->dsize;
+        }
+        return ret;
+    }
+
+    size_t getSumOfChannels(vec1<Node*> nodes)
+    {
+        size_t ret = 0;
+        for (int i=0; i<nodes.size(); ++i) {
+            ret += nodes.at(i)->channels;
+        }
+        return ret;
+    }
+
+    Tensor getGroupConnection(size_t outputs, size_t inputs, size_t groups)
+    {
+        assert (outputs % groups == 0 && inputs % groups == 0);
+        Tensor ret({outputs, inputs});
+        for (int o=0; o<outputs; ++o) {
+            for (int c=0; c<inputs; ++c) {
+                ret.at(o, c) = (o / (outputs / groups) == c / (inputs / groups));
+            }
+        }
+        return ret;
     }
 
     size_t getSumSizeOfHeight(vec1<Node*> nodes)
@@ -905,17 +2776,498 @@ namespace CG
         return ret;
     }
 
+    vec1<Node*> getGraph(Node *node) // every node connected to the argument
+    {
+        vec1<Node*> ret;
+        std::set<Node*> visited;
+        vec1<Node*> stack = {node};
+        visited.insert(node);
+        while (!stack.empty()) {
+            Node *temp = stack.back();
+            stack.pop_back();
+            ret.push_back(temp);
+            for (int i=0; i<temp->backward.size(); ++i) {
+                if (visited.insert(temp->backward.at(i)).second) {
+                    stack.push_back(temp->backward.at(i));
+                }
+            }
+            for (int i=0; i<temp->forward.size(); ++i) {
+                if (visited.insert(temp->forward.at(i)).second) {
+                    stack.push_back(temp->forward.at(i));
+                }
+            }
+        }
+        return ret;
+    }
+
+    void setBatch(Node *node, size_t batch)
+    {
+        vec1<Node*> nodes = getGraph(node);
+        for (int i=0; i<nodes.size(); ++i) {
+            if (nodes.at(i)->batch != batch) {
+                nodes.at(i)->setBatch(batch);
+            }
+        }
+    }
+
+    void setInference(Node *node, bool inference)
+    {
+        vec1<Node*> nodes = getGraph(node);
+        for (int i=0; i<nodes.size(); ++i) {
+            if (nodes.at(i)->inference != inference) {
+                nodes.at(i)->setInference(inference);
+            }
+        }
+    }
+
+    void setWindow(Node *node, ttype window)
+    {
+        vec1<Node*> nodes = getGraph(node);
+        for (int i=0; i<nodes.size(); ++i) {
+            nodes.at(i)->setWindow(window);
+        }
+    }
+
+    void detach(Node *node) // from the forward edges of its inputs
+    {
+        for (int i=0; i<node->backward.size(); ++i) {
+            vec1<Node*> &forward = node->backward.at(i)->forward;
+            forward.erase(std::find(forward.begin(), forward.end(), node));
+        }
+    }
+
+    static void unlink(Node *node)
+    {
+        detach(node);
+        node->backward.clear();
+    }
+
+    Node* fuseSoftmaxCrossEntropy(Node *loss) // CEE(Softmax(x), y) -> SoftmaxCrossEntropy(x, y)
+    {
+        if (typeid(*loss) != typeid(CEE) || typeid(*loss->backward.at(0)) != typeid(Softmax)) {
+            return loss;
+        }
+        Node *softmax = loss->backward.at(0);
+        Node *target  = loss->backward.at(1);
+        if (softmax->forward.size() != 1) { // the probabilities feed something other than the loss
+            return loss;
+        }
+        Node *ret = new SoftmaxCrossEntropy(softmax->backward.at(0), target);
+        ret->setWindow(loss->window);
+        ret->setBatch(loss->batch);
+        ret->setInference(loss->inference);
+        unlink(loss);
+        unlink(softmax);
+        delete loss;
+        delete softmax;
+        return ret;
+    }
+
+    static Activation getActivation(Node *node)
+    {
+        if (typeid(*node) == typeid(ReLU)) {
+            return Activation::ReLU;
+        } else if (typeid(*node) == typeid(Sigmoid)) {
+            return Activation::Sigmoid;
+        } else if (typeid(*node) == typeid(Tanh)) {
+            return Activation::Tanh;
+        }
+        return Activation::None;
+    }
+
+    size_t fuseActivations(Node *node, vec1<Node*> keep) // folds ReLU, Sigmoid and Tanh into their producer
+    {
+        size_t ret = 0;
+        bool changed = true;
+        while (changed) { // until ReLU o ReLU chains are collapsed
+            changed = false;
+            vec1<Node*> nodes = getGraph(node);
+            for (int i=0; i<nodes.size(); ++i) {
+                Node *temp = nodes.at(i);
+                Activation activation = getActivation(temp);
+                if (activation == Activation::None || temp->forward.empty() || std::find(keep.begin(), keep.end(), temp) != keep.end()) {
+                    continue;
+                }
+                Node *producer = temp->backward.at(0);
+                if (   typeid(*producer) != typeid(Affine) && typeid(*producer) != typeid(Convolution2d) && typeid(*producer) != typeid(MultiConvolution2d) && typeid(*producer) != typeid(GroupedConvolution2d)
+                    && typeid(*producer) != typeid(Add)) {
+                    continue;
+                }
+                if (   producer->forward.size() != 1
+                    || (producer->activation != Activation::None && (producer->activation != Activation::ReLU || activation != Activation::ReLU))) {
+                    continue;
+                }
+                unlink(temp);
+                producer->activation = activation;
+                producer->forward = temp->forward;
+                for (int j=0; j<temp->forward.size(); ++j) {
+                    vec1<Node*> &inputs = temp->forward.at(j)->backward;
+                    std::replace(inputs.begin(), inputs.end(), temp, producer);
+                }
+                delete temp;
+                ++ret;
+                changed = true;
+            }
+        }
+        return ret;
+    }
+
+    using Layer = vec1<vec1<Node*>>; // a row per channel: its Convolution2d, then the per-channel nodes
+
+    static bool sameFilter(Filter2d *a, Filter2d *b)
+    {
+        return    a->kheight == b->kheight && a->kwidth == b->kwidth && a->sw == b->sw && a->pt == b->pt && a->pl == b->pl
+               && a->height == b->height && a->width == b->width;
+    }
+
+    static bool sameKind(Node *a, Node *b) // nodes that one multi-channel node can replace
+    {
+        if (typeid(*a) != typeid(*b) || a->activation != Activation::None || b->activation != Activation::None || a->backward.size() != 1) {
+            return false;
+        }
+        if (typeid(*a) == typeid(AveragePooling2d) || typeid(*a) == typeid(MaxPooling2d)) {
+            return sameFilter(dynamic_cast<Filter2d*>(a), dynamic_cast<Filter2d*>(b));
+        }
+        return getActivation(a) != Activation::None;
+    }
+
+    static Node* liftNode(Node *node, Node *input) // node over every channel of the input
+    {
+        if (typeid(*node) == typeid(AveragePooling2d)) {
+            AveragePooling2d *pool = dynamic_cast<AveragePooling2d*>(node);
+            return new AveragePooling2d(input, pool->kheight, pool->kwidth, pool->sw, pool->pt, pool->pl, pool->height, pool->width);
+        } else if (typeid(*node) == typeid(MaxPooling2d)) {
+            MaxPooling2d *pool = dynamic_cast<MaxPooling2d*>(node);
+            return new MaxPooling2d(input, pool->kheight, pool->kwidth, pool->sw, pool->pt, pool->pl, pool->height, pool->width);
+        } else if (typeid(*node) == typeid(ReLU)) {
+            return new ReLU(input);
+        } else if (typeid(*node) == typeid(Sigmoid)) {
+            return new Sigmoid(input);
+        } else if (typeid(*node) == typeid(Tanh)) {
+            return new Tanh(input);
+        }
+        assert (false);
+        return nullptr;
+    }
+
+    static void extendRows(Layer &rows) // while every channel continues with the same kind
+    {
+        while (true) {
+            bool extend = true;
+            for (int o=0; o<rows.size() && extend; ++o) {
+                Node *last = rows.at(o).back();
+                extend = last->forward.size() == 1 && sameKind(last->forward.at(0), rows.at(0).back()->forward.at(0));
+            }
+            if (!extend) {
+                return;
+            }
+            for (int o=0; o<rows.size(); ++o) {
+                rows.at(o).push_back(rows.at(o).back()->forward.at(0));
+            }
+        }
+    }
+
+    static vec1<Node*> getEnds(Layer &rows)
+    {
+        vec1<Node*> ret(rows.size());
+        for (int o=0; o<rows.size(); ++o) {
+            ret.at(o) = rows.at(o).back();
+        }
+        return ret;
+    }
+
+    static Node* findConcatenation(vec1<Node*> nodes) // the only reader of the nodes, nullptr otherwise
+    {
+        if (nodes.empty() || nodes.at(0)->forward.size() != 1) {
+            return nullptr;
+        }
+        Node *concat = nodes.at(0)->forward.at(0);
+        if (typeid(*concat) != typeid(Concatenation) || concat->backward.size() != nodes.size()) {
+            return nullptr;
+        }
+        for (int i=0; i<nodes.size(); ++i) {
+            if (   nodes.at(i)->forward.size() != 1 || nodes.at(i)->forward.at(0) != concat
+                || std::count(concat->backward.begin(), concat->backward.end(), nodes.at(i)) != 1) {
+                return nullptr;
+            }
+        }
+        return concat;
+    }
+
+    static void sortRows(Layer &rows, Node *concat) // in the order of the Concatenation
+    {
+        for (int i=0; i<rows.size(); ++i) {
+            for (int o=i; o<rows.size(); ++o) {
+                if (rows.at(o).back() == concat->backward.at(i)) {
+                    std::swap(rows.at(i), rows.at(o));
+                }
+            }
+        }
+    }
+
+    static Node* buildLayer(Layer &rows, vec1<Node*> inputs, vec1<Node*> sources, vec1<Node*> &created) // returns the last node
+    {
+        Convolution2d *first = dynamic_cast<Convolution2d*>(rows.at(0).at(0));
+        size_t         block = first->kheight * first->kwidth;
+        Tensor kernel({rows.size(), inputs.size(), first->kheight, first->kwidth});
+        Tensor bias(vec1<size_t>{rows.size()});
+        Tensor mask({rows.size(), inputs.size()});
+        bool   dense = true;
+        for (int o=0; o<rows.size(); ++o) {
+            Convolution2d *conv = dynamic_cast<Convolution2d*>(rows.at(o).at(0));
+            bias.data()[o] = conv->bias.data()[0];
+            for (int k=0; k<conv->backward.size(); ++k) {
+                size_t c = std::find(inputs.begin(), inputs.end(), conv->backward.at(k)) - inputs.begin();
+                mask.at(o, c) = 1;
+                for (int i=0; i<block; ++i) {
+                    kernel.data(o)[c * block + i] += conv->kernel.data(k)[i];
+                }
+            }
+            for (int c=0; c<inputs.size(); ++c) {
+                dense = dense && mask.at(o, c) != 0;
+            }
+        }
+        Node *ret;
+        if (dense) {
+            ret = new MultiConvolution2d(sources, kernel, bias, Tensor(), first->sw, first->pt, first->pl, first->height, first->width);
+        } else {
+            ret = new GroupedConvolution2d(sources, kernel, bias, mask, first->sw, first->pt, first->pl, first->height, first->width);
+        }
+        created.push_back(ret);
+        for (int k=1; k<rows.at(0).size(); ++k) {
+            ret = liftNode(rows.at(0).at(k), ret);
+            created.push_back(ret);
+        }
+        return ret;
+    }
+
+    static void replaceNode(Node *node, Node *next) // the readers of node read next instead
+    {
+        next->forward.insert(next->forward.end(), node->forward.begin(), node->forward.end());
+        for (int i=0; i<node->forward.size(); ++i) {
+            vec1<Node*> &backward = node->forward.at(i)->backward;
+            std::replace(backward.begin(), backward.end(), node, next);
+        }
+        node->forward.clear();
+    }
+
+    static void replaceLayers(vec1<Node*> created, vec1<Node*> removed, Node *like) // the created take the settings of like
+    {
+        for (int i=0; i<created.size(); ++i) {
+            created.at(i)->setWindow(like->window);
+            created.at(i)->setBatch(like->batch);
+            created.at(i)->setInference(like->inference);
+        }
+        for (int i=0; i<removed.size(); ++i) {
+            unlink(removed.at(i));
+        }
+        for (int i=0; i<removed.size(); ++i) {
+            delete removed.at(i);
+        }
+    }
+
+    static bool planLayers(vec1<Node*> inputs, bool lifted, vec1<Layer> &layers, Node *&concat) // convolutions reading only the inputs, until a Concatenation
+    {
+        if (lifted && (concat = findConcatenation(inputs)) != nullptr) {
+            return true;
+        }
+
+        vec1<Node*> convs;
+        for (int i=0; i<inputs.size(); ++i) {
+            for (int j=0; j<inputs.at(i)->forward.size(); ++j) {
+                Node *next = inputs.at(i)->forward.at(j);
+                if (typeid(*next) == typeid(Convolution2d)) {
+                    if (std::find(convs.begin(), convs.end(), next) == convs.end()) {
+                        convs.push_back(next);
+                    }
+                } else if (lifted) { // a lifted channel read by something else
+                    return false;
+                }
+            }
+        }
+        if (convs.size() < (lifted ? 1 : 2)) {
+            return false;
+        }
+
+        Layer rows(convs.size());
+        for (int o=0; o<convs.size(); ++o) {
+            Convolution2d *conv = dynamic_cast<Convolution2d*>(convs.at(o));
+            if (conv->activation != Activation::None || !sameFilter(conv, dynamic_cast<Filter2d*>(convs.at(0)))) {
+                return false;
+            }
+            for (int c=0; c<conv->backward.size(); ++c) {
+                if (std::find(inputs.begin(), inputs.end(), conv->backward.at(c)) == inputs.end()) {
+                    return false;
+                }
+            }
+            rows.at(o) = {conv};
+        }
+        extendRows(rows);
+        layers.push_back(rows);
+
+        return planLayers(getEnds(rows), true, layers, concat);
+    }
+
+    size_t stackChannels(Node *node) // returns the number of nodes removed
+    {
+        size_t ret = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            vec1<Node*> nodes = getGraph(node);
+            for (int s=0; s<nodes.size() && !changed; ++s) {
+                Node        *start  = nodes.at(s);
+                Node        *concat = nullptr;
+                vec1<Layer>  layers;
+                if (start->channels != 1 || !planLayers({start}, false, layers, concat)) {
+                    continue;
+                }
+                sortRows(layers.back(), concat);
+
+                vec1<Node*> inputs = {start};
+                Node        *multi = start;
+                vec1<Node*>  created;
+                vec1<Node*>  removed = {concat};
+                for (int l=0; l<layers.size(); ++l) {
+                    Layer &rows = layers.at(l);
+                    multi = buildLayer(rows, inputs, {multi}, created);
+                    for (int o=0; o<rows.size(); ++o) {
+                        removed.insert(removed.end(), rows.at(o).begin(), rows.at(o).end());
+                    }
+                    inputs = getEnds(rows);
+                }
+                replaceNode(concat, multi);
+                replaceLayers(created, removed, start);
+                ret += removed.size() - created.size();
+                changed = true;
+            }
+        }
+        return ret;
+    }
+
+    static vec1<Node*> getSources(vec1<Node*> &inputs) // the node the inputs are Channels of, the inputs otherwise
+    {
+        Node *source = inputs.at(0)->backward.empty() ? nullptr : inputs.at(0)->backward.at(0);
+        if (source == nullptr || source->channels != inputs.size()) {
+            return inputs;
+        }
+        vec1<Node*> sorted(inputs.size(), nullptr);
+        for (int c=0; c<inputs.size(); ++c) {
+            Channel *channel = dynamic_cast<Channel*>(inputs.at(c));
+            if (channel == nullptr || typeid(*channel) != typeid(Channel) || channel->backward.at(0) != source || sorted.at(channel->index) != nullptr) {
+                return inputs;
+            }
+            sorted.at(channel->index) = channel;
+        }
+        inputs = sorted;
+        return {source};
+    }
+
+    static size_t getDepth(Node *node, std::map<Node*, size_t> &depth) // longest path from an input
+    {
+        if (depth.find(node) == depth.end()) {
+            size_t ret = 0;
+            for (int i=0; i<node->backward.size(); ++i) {
+                ret = std::max(ret, getDepth(node->backward.at(i), depth) + 1);
+            }
+            depth[node] = ret;
+        }
+        return depth.at(node);
+    }
+
+    size_t mergeSiblings(Node *node) // returns the number of convolutions merged
+    {
+        size_t ret = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            vec1<Node*> nodes = getGraph(node);
+            std::map<Node*, size_t> depth;
+            std::stable_sort(nodes.begin(), nodes.end(), [&depth](Node *a, Node *b){ return getDepth(a, depth) < getDepth(b, depth); }); // inputs first
+            for (int s=0; s<nodes.size() && !changed; ++s) {
+                if (typeid(*nodes.at(s)) != typeid(Convolution2d) || nodes.at(s)->activation != Activation::None) {
+                    continue;
+                }
+                Convolution2d  *first  = dynamic_cast<Convolution2d*>(nodes.at(s));
+                vec1<Node*>     inputs = first->backward;
+                std::set<Node*> set(inputs.begin(), inputs.end());
+                if (set.size() != inputs.size()) {
+                    continue;
+                }
+
+                Layer rows; // siblings in the order they read the first input
+                for (int i=0; i<inputs.at(0)->forward.size(); ++i) {
+                    Node *next = inputs.at(0)->forward.at(i);
+                    if (   typeid(*next) != typeid(Convolution2d) || next->activation != Activation::None
+                        || !sameFilter(first, dynamic_cast<Filter2d*>(next)) || next->backward.size() != inputs.size()
+                        || std::set<Node*>(next->backward.begin(), next->backward.end()) != set) {
+                        continue;
+                    }
+                    if (std::find_if(rows.begin(), rows.end(), [next](const vec1<Node*> &row){ return row.at(0) == next; }) == rows.end()) {
+                        rows.push_back({next});
+                    }
+                }
+                if (rows.size() < 2) {
+                    continue;
+                }
+                extendRows(rows);
+                vec1<Node*> ends = getEnds(rows);
+                bool read = true;
+                for (int o=0; o<ends.size(); ++o) {
+                    read = read && !ends.at(o)->forward.empty();
+                }
+                if (!read) { // an output of the graph must stay
+                    continue;
+                }
+
+                Node *concat = findConcatenation(ends);
+                if (concat != nullptr) {
+                    sortRows(rows, concat);
+                }
+                vec1<Node*> channels = inputs;
+                vec1<Node*> sources  = getSources(channels);
+                vec1<Node*> created;
+                vec1<Node*> removed;
+                Node *multi = buildLayer(rows, channels, sources, created);
+                for (int o=0; o<rows.size(); ++o) {
+                    removed.insert(removed.end(), rows.at(o).begin(), rows.at(o).end());
+                }
+                if (concat != nullptr) {
+                    replaceNode(concat, multi);
+                    removed.push_back(concat);
+                } else { // every other reader gets its channel
+                    for (int o=0; o<rows.size(); ++o) {
+                        Node *channel = new Channel(multi, o);
+                        created.push_back(channel);
+                        replaceNode(rows.at(o).back(), channel);
+                    }
+                }
+                if (sources.size() == 1 && sources.at(0) != inputs.at(0)) { // Channel nodes of a source now read whole
+                    for (int c=0; c<channels.size(); ++c) {
+                        if (channels.at(c)->forward.size() == rows.size()) {
+                            removed.push_back(channels.at(c));
+                        }
+                    }
+                }
+                replaceLayers(created, removed, first);
+                ret += rows.size();
+                changed = true;
+            }
+        }
+        return ret;
+    }
+
     void dumpNode(Node const node1, std::string name, ttype time)
     {
         std::cout << name << " back size = " << node1.backward.size() << std::endl;
         std::cout << name << " forw size = " << node1.forward.size() << std::endl;
         std::cout << name << " data size = " << node1.dsize << std::endl;
         std::cout << name << " data      = ";
-        for (int i=0; i<node1.dsize; ++i) { std::cout << node1.data.at(time).at(i) << ((i==node1.dsize-1) ? "" : " "); }
+        for (int i=0; i<node1.dsize; ++i) { std::cout << node1.data.at(node1.slot(time)).at(i) << ((i==node1.dsize-1) ? "" : " "); }
         std::cout << std::endl;
         std::cout << name << " grad size = " << node1.dsize << std::endl;
         std::cout << name << " grad      = ";
-        for (int i=0; i<node1.dsize; ++i) { std::cout << node1.grad.at(time).at(i) << ((i==node1.dsize-1) ? "" : " "); }
+        for (int i=0; i<node1.dsize; ++i) { std::cout << node1.grad.at(node1.slot(time)).at(i) << ((i==node1.dsize-1) ? "" : " "); }
         std::cout << std::endl;
     }
     void dumpNode(Node const node1, std::string name)
@@ -2,10 +2,20 @@
 #define CG_HPP
 
 #include <iostream>
+#include <atomic>
 #include <cassert>
+#include <memory>
+#include <mutex>
 #include <vector>
+#include "Tensor.hpp"
 #include "Type.hpp"
 
+namespace CGK
+{
+    class Winograd;
+    struct FilterKernels;
+}
+
 namespace CG
 {
     template<typename T> using vec1 = type::vec1<T>;
@@ -13,6 +23,23 @@ namespace CG
     template<typename T> using vec3 = type::vec3<T>;
     using dtype = type::dtype;
     using ttype = type::ttype;
+    using Tensor = type::Tensor;
+    using Span   = type::Span;
+
+    class TransformCache // transforms of the data of a node, shared by its readers
+    {
+        public :
+            std::mutex                    lock;
+            vec1<vec1<size_t>>            keys;   // producer epoch and slot first
+            vec1<std::shared_ptr<Tensor>> values; // replaced, never overwritten
+
+            std::shared_ptr<Tensor> find(const vec1<size_t> &key);
+            void insert(const vec1<size_t> &key, std::shared_ptr<Tensor> value); // drops the transforms of older data
+            void clear();
+    };
+
+    enum class Activation { None, ReLU, Sigmoid, Tanh };
+
     class Node
     {
         public :
@@ -20,27 +47,59 @@ namespace CG
             const size_t height;
             const size_t width;
             const size_t dsize;
-            vec2<dtype>  data;
-            vec2<dtype>  grad;
+            const size_t channels; // maps stacked along the height
+            size_t       batch = 1;
+            bool         inference = false; // no gradient buffers
+            bool         checkpoint = false; // keeps its data under a CheckpointPlan
+            Tensor       data; // [time][batch][height][width]
+            Tensor       grad;
             vec1<Node*>  forward;
             vec1<Node*>  backward;
             ttype        time = 0;
+            ttype        window = 0; // time slots of the ring buffer, 0 for unbounded
             vec1<int>    f_count;
             vec1<int>    b_count;
+            vec1<size_t> dataEpoch; // forward steps taken at each time
+            vec1<size_t> gradEpoch; // dataEpoch of the last clear of each slot
+            vec1<Tensor*> gradSink; // per input, where calcPartialDerivative writes
+            std::shared_ptr<TransformCache> transformCache;
+            Activation   activation = Activation::None; // folded in by fuseActivations
 
-            Node (size_t domsize, size_t height, size_t width);
+            Node (size_t domsize, size_t height, size_t width, size_t channels = 1);
+            virtual ~Node () = default;
 
             void pushThis(Node *node);
 
+            virtual void reserve(ttype time);
+            ttype slot(ttype time) const;
+            virtual void setWindow(ttype window);
+            virtual void setBatch(size_t batch);
+            virtual void setInference(bool inference);
+            void releaseData();
+            void restoreData();
+
+            virtual Node* replicate(vec1<Node*> nodes);
+
+            Span getData();
+            Span getGrad();
+            void clearGrad(ttype time);
+            Span getDomData(size_t index);
+            Span getDomGrad(size_t index);
+
             virtual void calcData();
+            void activate();
+            void forwardStep(ttype time);
             virtual void forwardPropagation(ttype time);
             virtual void forwardPropagation();
 
             virtual void calcPartialDerivative();
+            void maskGradient();
+            void backwardStep(ttype time);
             virtual void backwardPropagation(ttype time);
             virtual void backwardPropagation();
 
             virtual void updateParameters(dtype eta);
+            virtual void mergeGradients(Node *node);
             virtual void update(dtype eta, ttype time);
             virtual void update(dtype eta);
     };
@@ -50,8 +109,12 @@ namespace CG
         public :
             Leaf1 (size_t size);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             void getInput(vec1<dtype> input, ttype time);
             void getInput(vec1<dtype> input);
+            void getBatchInput(vec2<dtype> input, ttype time);
+            void getBatchInput(vec2<dtype> input);
     };
 
     class Leaf2 : public Node
@@ -59,20 +122,41 @@ namespace CG
         public :
             Leaf2 (size_t height, size_t width);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             void getInput(vec1<dtype> input, ttype time);
             void getInput(vec1<dtype> input);
             void getInput(vec2<dtype> input, ttype time);
             void getInput(vec2<dtype> input);
+            void getBatchInput(vec3<dtype> input, ttype time);
+            void getBatchInput(vec3<dtype> input);
     };
 
     class Concatenation : public Node
     {
         public :
-            vec1<size_t> dataSize;
+            vec1<size_t> dataSize; // offset of each input in a sample
 
             Concatenation (vec1<Node*> nodes);
 
             int whichNode(size_t index);
+            void alias();
+
+            virtual Node* replicate(vec1<Node*> nodes);
+
+            virtual void calcData();
+
+            virtual void calcPartialDerivative();
+    };
+
+    class Channel : public Node // one map of a multi-channel node
+    {
+        public :
+            const size_t index;
+
+            Channel (Node *node1, size_t index);
+
+            virtual Node* replicate(vec1<Node*> nodes);
 
             virtual void calcData();
 
@@ -111,13 +195,29 @@ namespace CG
             const size_t pl;
             const size_t pt;
             const size_t sw;
+            const size_t mapHeight; // rows of one output map
+            const size_t domHeight; // rows of one input map
+            int          interiorTop;    // outputs whose whole window is inside the input
+            int          interiorBottom;
+            int          interiorLeft;
+            int          interiorRight;
+            const CGK::FilterKernels *specialized; // nullptr when the generic loops run
+
+            Filter2d (vec1<Node*> nodes, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width, size_t channels = 1);
 
-            Filter2d (vec1<Node*> nodes, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width);
+            static void getInterior(int sw, int padding, int kernel, int bsize, int size, int &first, int &last);
+            void getWindow(int a, int b, int &i0, int &i1, int &j0, int &j1);
 
             bool inDomain(int col, int row);
 
+            using Node::getDomData;
             dtype getDomData(int index, int col, int row);
             dtype getDomData(int col, int row);
+
+            size_t winogradTile();
+            std::shared_ptr<Tensor> getWinogradInput(size_t index, const CGK::Winograd &w);
+            void fftShape(size_t &rows, size_t &cols);
+            std::shared_ptr<Tensor> getFFTInput(size_t index, size_t rows, size_t cols);
     };
 
     class Add : public MMtoM
@@ -125,6 +225,8 @@ namespace CG
         public :
             Add (Node *node1, Node *node2);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -135,6 +237,8 @@ namespace CG
         public :
             Sub (Node *node1, Node *node2);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -145,6 +249,8 @@ namespace CG
         public :
             Dots (Node *node1, Node *node2);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -155,6 +261,8 @@ namespace CG
         public : 
             MSE (Node *node1, Node *node2);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -165,6 +273,20 @@ namespace CG
         public : 
             CEE (Node *node1, Node *node2);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
+            virtual void calcData();
+
+            virtual void calcPartialDerivative();
+    };
+
+    class SoftmaxCrossEntropy : public MMto1 // CEE o Softmax over the logits
+    {
+        public :
+            SoftmaxCrossEntropy (Node *node1, Node *node2);
+
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -175,6 +297,8 @@ namespace CG
         public :
             ReLU (Node *node1);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -185,6 +309,8 @@ namespace CG
         public :
             Sigmoid (Node *node1);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -195,6 +321,8 @@ namespace CG
         public :
             Tanh (Node *node1);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -205,6 +333,8 @@ namespace CG
         public : 
             Softmax (Node *node1);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -215,6 +345,8 @@ namespace CG
         public :
             Norm2 (Node *node1);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
             
             virtual void calcPartialDerivative();
@@ -223,50 +355,173 @@ namespace CG
     class Affine : public Node
     {
         public :
-            vec2<dtype> weight;
-            vec2<dtype> gradWeight;
+            Tensor      weight; // [domsize + 1][dsize]
+            Tensor      gradWeight;
             const dtype bias;
+            std::shared_ptr<vec1<std::atomic<dtype>>> sharedWeight; // set by CGG::Hogwild1d
             
+            Affine (Node *node1, Tensor Weight, dtype bias);
             Affine (Node *node1, vec2<dtype> Weight, dtype bias);
             Affine (Node *node1, vec2<dtype> Weight);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
 
             virtual void updateParameters(dtype eta);
+            virtual void mergeGradients(Node *node);
+
+            void readSharedWeight();
+    };
+
+    enum class ConvAlgorithm
+    {
+        Direct,   // loops over the receptive fields
+        Im2col,   // matrix products over unfolded patches
+        Winograd, // stride 1, square kernels from 2x2 to 5x5
+        FFT,      // products of zero-padded spectra
+        Auto      // the fastest, timed at each batch size
     };
 
     class Convolution2d : public Filter2d
     {
         public :
-            vec3<dtype> kernel;
-            vec3<dtype> gradKernel;
-            dtype       bias;
-            dtype       gradBias;
-
+            Tensor        kernel; // [channel][kheight][kwidth]
+            Tensor        gradKernel;
+            Tensor        bias;   // [1]
+            dtype         gradBias;
+            ConvAlgorithm algorithm = ConvAlgorithm::Auto;
+            ConvAlgorithm chosen;          // by Auto at chosenBatch
+            size_t        chosenBatch = 0;
+            Tensor        columns;     // scratch of Im2col
+            Tensor        gradColumns;
+            std::shared_ptr<std::atomic<size_t>> kernelVersion; // bumped by updateParameters
+            size_t        winogradVersion; // kernelVersion of winogradKernel
+            Tensor        winogradKernel;  // [alpha * alpha][1][channel], G k G^T
+            size_t        fftVersion;      // kernelVersion of fftKernel
+            Tensor        fftKernel;       // [1][channel][rows * (cols / 2 + 1) * 2]
+
+            Convolution2d (vec1<Node*> nodes, Tensor Kernel, dtype bias, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width);
             Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width);
             Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t stride, size_t height, size_t width);
             Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t stride);
             Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias, size_t height, size_t width);
             Convolution2d (vec1<Node*> nodes, vec3<dtype> Kernel, dtype bias);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
+            ConvAlgorithm selectAlgorithm();
+
             virtual void calcData();
+            void calcData(ConvAlgorithm algorithm);
+            void calcDataDirect();
+            void calcDataIm2col();
+            void calcDataWinograd();
+            void calcDataFFT();
 
             virtual void calcPartialDerivative();
+            void calcPartialDerivativeDirect();
+            void calcPartialDerivativeIm2col();
+            void calcPartialDerivativeWinograd();
+            void calcPartialDerivativeFFT();
+
+            void im2col();
+            void col2im();
+            void prepareWinograd(const CGK::Winograd &w);
+            void prepareFFT(size_t rows, size_t cols);
 
             virtual void updateParameters(dtype eta);
+            virtual void mergeGradients(Node *node);
+    };
+
+    class MultiConvolution2d : public Filter2d // every output channel over every input channel
+    {
+        public :
+            const size_t domChannels; // of all the inputs, in order
+            Tensor kernel; // [channels][domChannels][kheight][kwidth]
+            Tensor gradKernel;
+            Tensor bias;   // [channels]
+            Tensor gradBias;
+            Tensor mask;   // [channels][domChannels] of 0 and 1, empty when dense
+            Tensor columns;     // scratch of im2col
+            Tensor gradColumns;
+            Tensor output;      // [channels][batch * maps]
+            ConvAlgorithm algorithm = ConvAlgorithm::Auto;
+            ConvAlgorithm chosen;
+            size_t        chosenBatch = 0;
+            std::shared_ptr<std::atomic<size_t>> kernelVersion;
+            size_t        winogradVersion;
+            Tensor        winogradKernel; // [alpha * alpha][channels][domChannels]
+            size_t        fftVersion;
+            Tensor        fftKernel;      // [channels][domChannels][rows * (cols / 2 + 1) * 2]
+
+            MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width);
+            MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask, size_t stride, size_t height, size_t width);
+            MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask, size_t stride);
+            MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask, size_t height, size_t width);
+            MultiConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Mask);
+
+            virtual Node* replicate(vec1<Node*> nodes);
+
+            ConvAlgorithm selectAlgorithm();
+
+            virtual void calcData();
+            void calcData(ConvAlgorithm algorithm);
+            void calcDataIm2col();
+            void calcDataWinograd();
+            void calcDataFFT();
+
+            virtual void calcPartialDerivative();
+            void calcPartialDerivativeIm2col();
+            void calcPartialDerivativeWinograd();
+            void calcPartialDerivativeFFT();
+
+            void im2col();
+            void col2im();
+            void prepareWinograd(const CGK::Winograd &w);
+            void prepareFFT(size_t rows, size_t cols);
+            virtual void multiply(dtype *O);               // O[channels][batch * maps] += K columns
+            virtual void multiplyBackward(const dtype *G); // gradKernel += G columns^T, gradColumns += K^T G
+
+            virtual void updateParameters(dtype eta);
+            virtual void mergeGradients(Node *node);
+    };
+
+    class GroupedConvolution2d : public MultiConvolution2d // only the connected pairs of the mask
+    {
+        public :
+            GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width);
+            GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection, size_t stride, size_t height, size_t width);
+            GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection, size_t stride);
+            GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection, size_t height, size_t width);
+            GroupedConvolution2d (vec1<Node*> nodes, Tensor Kernel, Tensor Bias, Tensor Connection);
+
+            virtual Node* replicate(vec1<Node*> nodes);
+
+            virtual void multiply(dtype *O);
+            virtual void multiplyBackward(const dtype *G);
     };
 
     class MaxPooling2d : public Filter2d
     {
         public :
-            vec1<unsigned int> maxCount;
+            vec2<unsigned int> maxCount; // [time][batch * dsize], ties for the maximum
+            vec2<int>          argmax;   // [time][batch * dsize], first maximum
 
             MaxPooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t topPadding, size_t leftPadding, size_t height, size_t width);
             MaxPooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t height, size_t width);
             MaxPooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride);
 
+            virtual void reserve(ttype time);
+            virtual void setWindow(ttype window);
+            virtual void setBatch(size_t batch);
+            virtual void setInference(bool inference);
+            void resizeMaxima();
+
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -279,6 +534,8 @@ namespace CG
             AveragePooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride, size_t height, size_t width);
             AveragePooling2d (Node *node1, size_t kernelHeight, size_t kernelWidth, size_t stride);
 
+            virtual Node* replicate(vec1<Node*> nodes);
+
             virtual void calcData();
 
             virtual void calcPartialDerivative();
@@ -286,6 +543,19 @@ namespace CG
 
     size_t getSumSizeOfData(vec1<Node*> nodes);
     size_t getSumSizeOfHeight(vec1<Node*> nodes);
+    size_t getSumOfChannels(vec1<Node*> nodes);
+    Tensor getGroupConnection(size_t outputs, size_t inputs, size_t groups); // block diagonal, depthwise when groups == inputs
+
+    vec1<Node*> getGraph(Node *node);
+    void setBatch(Node *node, size_t batch);
+    void setInference(Node *node, bool inference);
+    void setWindow(Node *node, ttype window);
+
+    void detach(Node *node);
+    Node* fuseSoftmaxCrossEntropy(Node *loss);
+    size_t fuseActivations(Node *node, vec1<Node*> keep);
+    size_t stackChannels(Node *node);
+    size_t mergeSiblings(Node *node);
 
     void dumpNode(Node const node1, std::string name, ttype time); 
     void dumpNode(Node const node1, std::string name);
@@ -34,6 +34,14 @@ namespace CGC
 
         toString(node);
 
+        if (node->activation != CG::Activation::None) { // written back as a separate node
+            const char *name[] = {"", "ReLU", "Sigmoid", "Tanh"};
+            *out << "id " << ++*id << std::endl;
+            *out << "Node " << name[(int)node->activation] << std::endl;
+            *out << "back " << p2i[node] << std::endl;
+            p2i[node] = *id;
+        }
+
       /*for (int i=0; i<node->forward.size(); ++i) {
             convert(node->forward.at(i), id);
         }*/
@@ -71,6 +79,16 @@ namespace CGC
                 *out << " " << p2i[node->backward.at(i)];
             }
             *out << std::endl;
+        } else if (typeid(*node) == typeid(CG::Channel)) {
+            if (p2i.find(node->backward.at(0)) == p2i.end()) {
+                convert(node->backward.at(0));
+            }
+            CG::Channel *chan = dynamic_cast<CG::Channel*>(node);
+            assert (chan != nullptr);
+            *out << "id " << p2i[chan] << std::endl;
+            *out << "Node Channel" << std::endl;
+            *out << "back " << p2i[chan->backward.at(0)] << std::endl;
+            *out << "index " << chan->index << std::endl;
         } else if (typeid(*node) == typeid(CG::Add)) {
             if (p2i.find(node->backward.at(0)) == p2i.end()) {
                 convert(node->backward.at(0));
@@ -121,6 +139,16 @@ namespace CGC
             *out << "id " << p2i[node] << std::endl;
             *out << "Node CEE" << std::endl;
             *out << "back " << p2i[node->backward.at(0)] << " " << p2i[node->backward.at(1)] << std::endl;
+        } else if (typeid(*node) == typeid(CG::SoftmaxCrossEntropy)) {
+            if (p2i.find(node->backward.at(0)) == p2i.end()) {
+                convert(node->backward.at(0));
+            }
+            if (p2i.find(node->backward.at(1)) == p2i.end()) {
+                convert(node->backward.at(1));
+            }
+            *out << "id " << p2i[node] << std::endl;
+            *out << "Node SoftmaxCrossEntropy" << std::endl;
+            *out << "back " << p2i[node->backward.at(0)] << " " << p2i[node->backward.at(1)] << std::endl;
         } else if (typeid(*node) == typeid(CG::ReLU)) {
             if (p2i.find(node->backward.at(0)) == p2i.end()) {
                 convert(node->backward.at(0));
@@ -167,12 +195,12 @@ namespace CGC
             *out << "back " << p2i[aff->backward.at(0)] << std::endl;
             *out << "bias " << aff->bias << std::endl;
             *out << "weight " << aff->domsize << " " << aff->dsize << std::endl;
-            for (int i=0; i<aff->weight.size(); ++i) {
-                for (int j=0; j<aff->weight.at(i).size(); ++j) {
+            for (int i=0; i<=aff->domsize; ++i) {
+                for (int j=0; j<aff->dsize; ++j) {
                     if (j != 0) {
                         *out << " ";
                     }
-                    *out << aff->weight.at(i).at(j);
+                    *out << aff->weight.at(i, j);
                 }
                 *out << std::endl;
             }
@@ -198,20 +226,77 @@ namespace CGC
             *out << "data " << conv->height << " " << conv->width << std::endl;
             *out << "stride " << conv->sw << std::endl;
             *out << "padding " << conv->pt << " " << conv->pt << std::endl;
-            *out << "bias " << conv->bias << std::endl;
+            *out << "bias " << conv->bias.data()[0] << std::endl;
             *out << "kernel " << conv->kheight << " " << conv->kwidth << std::endl;
             for (int c=0; c<conv->backward.size(); ++c) {
-                for (int i=0; i<conv->kernel.at(c).size(); ++i) {
-                    for (int j=0; j<conv->kernel.at(c).at(i).size(); ++j) {
+                for (int i=0; i<conv->kheight; ++i) {
+                    for (int j=0; j<conv->kwidth; ++j) {
                         if (j != 0) {
                             *out << " ";
                         }
-                        *out << conv->kernel.at(c).at(i).at(j);
+                        *out << conv->kernel.at(c, i, j);
                     }
                     *out << std::endl;
                 }
                 //*out << std::endl;
             }
+        } else if (typeid(*node) == typeid(CG::MultiConvolution2d) || typeid(*node) == typeid(CG::GroupedConvolution2d)) {
+            for (int i=0; i<node->backward.size(); ++i) {
+                if (p2i.find(node->backward.at(i)) == p2i.end()) {
+                    convert(node->backward.at(i));
+                }
+            }
+            CG::MultiConvolution2d *conv = dynamic_cast<CG::MultiConvolution2d*>(node);
+            assert (conv != nullptr);
+            size_t cin     = conv->domChannels;
+            bool   grouped = typeid(*node) == typeid(CG::GroupedConvolution2d); // only the connected pairs are written
+            *out << "id " << p2i[conv] << std::endl;
+            *out << (grouped ? "Node GroupedConvolution2d" : "Node MultiConvolution2d") << std::endl;
+            *out << "back";
+            for (int i=0; i<node->backward.size(); ++i) {
+                *out << " " << p2i[node->backward.at(i)];
+            }
+            *out << std::endl;
+            *out << "channel " << conv->channels << " " << cin << std::endl;
+            *out << "data " << conv->mapHeight << " " << conv->width << std::endl;
+            *out << "stride " << conv->sw << std::endl;
+            *out << "padding " << conv->pt << " " << conv->pl << std::endl;
+            *out << "bias";
+            for (int o=0; o<conv->channels; ++o) {
+                *out << " " << conv->bias.data()[o];
+            }
+            *out << std::endl;
+            if (grouped) {
+                *out << "connection" << std::endl;
+            } else {
+                *out << "mask " << (conv->mask.rank() != 0) << std::endl;
+            }
+            for (int o=0; o<conv->channels && conv->mask.rank() != 0; ++o) {
+                for (int c=0; c<cin; ++c) {
+                    if (c != 0) {
+                        *out << " ";
+                    }
+                    *out << conv->mask.at(o, c);
+                }
+                *out << std::endl;
+            }
+            *out << "kernel " << conv->kheight << " " << conv->kwidth << std::endl;
+            for (int o=0; o<conv->channels; ++o) {
+                for (int c=0; c<cin; ++c) {
+                    if (grouped && conv->mask.at(o, c) == 0) {
+                        continue;
+                    }
+                    for (int i=0; i<conv->kheight; ++i) {
+                        for (int j=0; j<conv->kwidth; ++j) {
+                            if (j != 0) {
+                                *out << " ";
+                            }
+                            *out << conv->kernel.data(o)[(c * conv->kheight + i) * conv->kwidth + j];
+                        }
+                        *out << std::endl;
+                    }
+                }
+            }
         } else if (typeid(*node) == typeid(CG::MaxPooling2d)) {
             if (p2i.find(node->backward.at(0)) == p2i.end()) {
                 convert(node->backward.at(0));
@@ -220,7 +305,7 @@ namespace CGC
             assert (maxp != nullptr);
             *out << "id " << p2i[maxp] << std::endl;
             *out << "Node MaxPooling2d" << std::endl;
-            *out << "data " << maxp->height << " " << maxp->width << std::endl;
+            *out << "data " << maxp->mapHeight << " " << maxp->width << std::endl;
             *out << "back " << p2i[maxp->backward.at(0)] << std::endl;
             *out << "stride " << maxp->sw << std::endl;
             *out << "padding " << maxp->pt << " " << maxp->pt << std::endl;
@@ -233,7 +318,7 @@ namespace CGC
             assert (maxp != nullptr);
             *out << "id " << p2i[maxp] << std::endl;
             *out << "Node AveragePooling2d" << std::endl;
-            *out << "data " << maxp->height << " " << maxp->width << std::endl;
+            *out << "data " << maxp->mapHeight << " " << maxp->width << std::endl;
             *out << "back " << p2i[maxp->backward.at(0)] << std::endl;
             *out << "stride " << maxp->sw << std::endl;
             *out << "padding " << maxp->pt << " " << maxp->pt << std::endl;
@@ -0,0 +1,411 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <set>
+#include <vector>
+#include "Type.hpp"
+#include "CG.hpp"
+#include "CGexecutor.hpp"
+
+namespace CGE
+{
+    vec1<CG::Node*> sortTopologically(CG::Node *top) // post-order over the backward edges, without recursion
+    {
+        vec1<CG::Node*> ret;
+        std::set<CG::Node*> visited;
+        vec1<std::pair<CG::Node*, size_t>> stack = {{top, 0}};
+        visited.insert(top);
+        while (!stack.empty()) {
+            CG::Node *node  = stack.back().first;
+            size_t    index = stack.back().second;
+            if (index < node->backward.size()) {
+                ++stack.back().second;
+                CG::Node *next = node->backward.at(index);
+                if (visited.insert(next).second) {
+                    stack.push_back({next, 0});
+                }
+            } else {
+                ret.push_back(node);
+                stack.pop_back();
+            }
+        }
+        return ret;
+    }
+
+    vec1<CG::Node*> replicate(vec1<CG::Node*> steps) // sharing the parameters
+    {
+        std::map<CG::Node*, CG::Node*> copy;
+        vec1<CG::Node*> ret(steps.size());
+        for (int i=0; i<steps.size(); ++i) {
+            CG::Node *node = steps.at(i);
+            vec1<CG::Node*> nodes(node->backward.size());
+            for (int j=0; j<nodes.size(); ++j) {
+                assert (copy.count(node->backward.at(j)) == 1);
+                nodes.at(j) = copy.at(node->backward.at(j));
+            }
+            ret.at(i) = node->replicate(nodes);
+            ret.at(i)->activation = node->activation;
+            copy[node] = ret.at(i);
+        }
+        return ret;
+    }
+
+
+
+    Plan::Plan (CG::Node *top)
+    : top(top)
+    {
+        steps = sortTopologically(top);
+    }
+
+    Plan::~Plan (){}
+
+    void Plan::forward(ttype time)
+    {
+        for (int i=0; i<steps.size(); ++i) {
+            steps.at(i)->forwardStep(time);
+        }
+    }
+    void Plan::forward()
+    {
+        forward(0);
+    }
+
+    void Plan::backward(ttype time)
+    {
+        assert (top->forward.size() == 0); // only a loss can seed the gradients
+        for (int i=steps.size()-1; i>=0; --i) {
+            steps.at(i)->backwardStep(time);
+        }
+    }
+    void Plan::backward()
+    {
+        backward(0);
+    }
+    void Plan::truncatedBackward(ttype time) // over the slots of the ring buffer, newest first
+    {
+        ttype length = (top->window == 0 || top->window > time) ? time + 1 : top->window;
+        for (ttype t=0; t<length; ++t) {
+            backward(time - t);
+        }
+    }
+
+    void Plan::update(dtype eta)
+    {
+        for (int i=0; i<steps.size(); ++i) {
+            steps.at(i)->updateParameters(eta);
+        }
+    }
+
+
+
+    CheckpointPlan::CheckpointPlan (CG::Node *top)
+    : CheckpointPlan (top, 0){}
+
+    CheckpointPlan::CheckpointPlan (CG::Node *top, size_t interval) // interval 0: the marked nodes, or every sqrt(n)-th step
+    : Plan (top)
+    {
+        for (int i=0; i<steps.size(); ++i) {
+            index[steps.at(i)] = i;
+        }
+
+        lastUse.resize(steps.size());
+        for (int i=0; i<steps.size(); ++i) {
+            lastUse.at(i) = i;
+            for (int c=0; c<steps.at(i)->backward.size(); ++c) {
+                lastUse.at(index.at(steps.at(i)->backward.at(c))) = i;
+            }
+        }
+
+        bool marked = false;
+        for (int i=0; i<steps.size(); ++i) {
+            marked = marked || steps.at(i)->checkpoint;
+        }
+        if (interval == 0 && !marked) {
+            interval = std::max<size_t>(1, std::sqrt((double)steps.size()));
+        }
+
+        keep.resize(steps.size());
+        for (int i=0; i<steps.size(); ++i) {
+            keep.at(i) = steps.at(i)->checkpoint || steps.at(i)->backward.empty() || (interval != 0 && i % interval == interval - 1);
+        }
+        keep.back() = true;
+        for (int c=0; c<top->backward.size(); ++c) { // so that the output can still be read after training
+            keep.at(index.at(top->backward.at(c))) = true;
+        }
+    }
+
+    void CheckpointPlan::forward(ttype time) // dropped nodes get their buffers back in forwardStep
+    {
+        for (int i=0; i<steps.size(); ++i) {
+            steps.at(i)->forwardStep(time);
+            for (int c=0; c<steps.at(i)->backward.size(); ++c) {
+                size_t j = index.at(steps.at(i)->backward.at(c));
+                if (lastUse.at(j) == i && !keep.at(j)) {
+                    steps.at(j)->releaseData();
+                }
+            }
+        }
+    }
+
+    void CheckpointPlan::backward(ttype time)
+    {
+        assert (top->forward.size() == 0);
+        for (int i=steps.size()-1; i>=0; --i) {
+            recompute(i, time);
+            for (int c=0; c<steps.at(i)->backward.size(); ++c) {
+                recompute(index.at(steps.at(i)->backward.at(c)), time);
+            }
+            steps.at(i)->backwardStep(time);
+            if (!keep.at(i)) { // the steps left to run never read it
+                steps.at(i)->releaseData();
+            }
+        }
+    }
+
+    void CheckpointPlan::recompute(size_t step, ttype time) // rebuilds the data of a dropped node
+    {
+        CG::Node *node = steps.at(step);
+        if (node->data.rank() != 0) {
+            return;
+        }
+        for (int c=0; c<node->backward.size(); ++c) {
+            recompute(index.at(node->backward.at(c)), time);
+        }
+        node->restoreData();
+        node->time = time;
+        node->calcData();
+        node->activate();
+    }
+
+
+
+    static thread_local ThreadPool *currentPool  = nullptr;
+    static thread_local size_t      currentIndex = 0;
+
+    ThreadPool::ThreadPool (size_t size)
+    : pending(0), queued(0), next(0), stop(false)
+    {
+        assert (size > 0);
+        for (int i=0; i<size; ++i) {
+            workers.push_back(std::unique_ptr<Worker>(new Worker()));
+        }
+        for (int i=0; i<size; ++i) {
+            threads.push_back(std::thread(&ThreadPool::work, this, i));
+        }
+    }
+
+    ThreadPool::~ThreadPool ()
+    {
+        {
+            std::lock_guard<std::mutex> guard(sleep);
+            stop = true;
+        }
+        wake.notify_all();
+        for (int i=0; i<threads.size(); ++i) {
+            threads.at(i).join();
+        }
+    }
+
+    size_t ThreadPool::size()
+    {
+        return workers.size();
+    }
+
+    void ThreadPool::submit(std::function<void()> task) // a worker's own tasks stay on its deque
+    {
+        size_t i = (currentPool == this) ? currentIndex : (next++ % workers.size());
+        pending.fetch_add(1);
+        queued.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> guard(workers.at(i)->lock);
+            workers.at(i)->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> guard(sleep);
+        }
+        wake.notify_one();
+    }
+
+    void ThreadPool::wait()
+    {
+        std::unique_lock<std::mutex> guard(sleep);
+        done.wait(guard, [this]{ return pending.load() == 0; });
+    }
+
+    bool ThreadPool::pop(size_t index, std::function<void()> &task) // newest first, for locality
+    {
+        std::lock_guard<std::mutex> guard(workers.at(index)->lock);
+        if (workers.at(index)->tasks.empty()) {
+            return false;
+        }
+        task = std::move(workers.at(index)->tasks.back());
+        workers.at(index)->tasks.pop_back();
+        return true;
+    }
+
+    bool ThreadPool::steal(size_t index, std::function<void()> &task) // oldest first
+    {
+        for (int k=1; k<workers.size(); ++k) {
+            Worker *victim = workers.at((index + k) % workers.size()).get();
+            std::lock_guard<std::mutex> guard(victim->lock);
+            if (!victim->tasks.empty()) {
+                task = std::move(victim->tasks.front());
+                victim->tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ThreadPool::work(size_t index)
+    {
+        currentPool  = this;
+        currentIndex = index;
+        while (true) {
+            std::function<void()> task;
+            if (pop(index, task) || steal(index, task)) {
+                queued.fetch_sub(1);
+                task();
+                if (pending.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> guard(sleep);
+                    done.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleep);
+            wake.wait(guard, [this]{ return queued.load() > 0 || stop; });
+            if (stop && queued.load() == 0) {
+                return;
+            }
+        }
+    }
+
+
+
+    ParallelExecutor::ParallelExecutor (CG::Node *top, size_t threads)
+    : Plan (top)
+    {
+        pool = new ThreadPool(threads);
+        count.reset(new std::atomic<int>[steps.size()]);
+
+        for (int i=0; i<steps.size(); ++i) {
+            index[steps.at(i)] = i;
+        }
+
+        successors.resize(steps.size());
+        predecessors.resize(steps.size());
+        for (int i=0; i<steps.size(); ++i) {
+            CG::Node *node = steps.at(i);
+            for (int c=0; c<node->backward.size(); ++c) {
+                size_t j = index.at(node->backward.at(c));
+                predecessors.at(i).push_back(j);
+                successors.at(j).push_back(i);
+            }
+        }
+
+        sinks.resize(steps.size());
+        sources.resize(steps.size());
+        for (int i=0; i<steps.size(); ++i) { // fan-out nodes get their gradients through private buffers
+            CG::Node *node = steps.at(i);
+            sinks.at(i).resize(node->backward.size(), nullptr);
+            for (int c=0; c<node->backward.size(); ++c) {
+                size_t j = predecessors.at(i).at(c);
+                if (successors.at(j).size() > 1) {
+                    buffers.push_back(std::unique_ptr<CG::Tensor>(new CG::Tensor()));
+                    sinks.at(i).at(c) = buffers.back().get();
+                    sources.at(j).push_back(buffers.back().get());
+                }
+            }
+        }
+    }
+
+    ParallelExecutor::~ParallelExecutor ()
+    {
+        delete pool;
+    }
+
+    void ParallelExecutor::forward(ttype time)
+    {
+        for (int i=0; i<steps.size(); ++i) {
+            count[i] = predecessors.at(i).size();
+        }
+        for (int i=0; i<steps.size(); ++i) {
+            if (predecessors.at(i).empty()) {
+                pool->submit([this, i, time]{ forwardTask(i, time); });
+            }
+        }
+        pool->wait();
+    }
+
+    void ParallelExecutor::forwardTask(size_t step, ttype time)
+    {
+        steps.at(step)->forwardStep(time);
+        for (int k=0; k<successors.at(step).size(); ++k) {
+            size_t j = successors.at(step).at(k);
+            if (--count[j] == 0) {
+                pool->submit([this, j, time]{ forwardTask(j, time); });
+            }
+        }
+    }
+
+    void ParallelExecutor::backward(ttype time)
+    {
+        assert (top->forward.size() == 0);
+        for (int i=0; i<steps.size(); ++i) {
+            CG::Node *node = steps.at(i);
+            count[i] = successors.at(i).size();
+            node->gradSink = sinks.at(i);
+            for (int k=0; k<sources.at(i).size(); ++k) {
+                CG::Tensor *buffer = sources.at(i).at(k);
+                if (buffer->shape != node->grad.shape) {
+                    buffer->reshape(node->grad.shape);
+                } else {
+                    std::memset(buffer->data(node->slot(time)), 0, buffer->stride(0) * sizeof(dtype));
+                }
+            }
+        }
+
+        pool->submit([this, time]{ backwardTask(steps.size() - 1, time); });
+        pool->wait();
+
+        for (int i=0; i<steps.size(); ++i) {
+            steps.at(i)->gradSink.clear();
+        }
+    }
+
+    void ParallelExecutor::backwardTask(size_t step, ttype time)
+    {
+        CG::Node *node = steps.at(step);
+        if (!sources.at(step).empty()) {
+            node->clearGrad(time);
+            dtype *g = node->grad.data(node->slot(time));
+            size_t n = node->grad.stride(0);
+            for (int k=0; k<sources.at(step).size(); ++k) {
+                const dtype *b = sources.at(step).at(k)->data(node->slot(time));
+                for (int i=0; i<n; ++i) {
+                    g[i] += b[i];
+                }
+            }
+        }
+
+        node->backwardStep(time);
+
+        for (int k=0; k<predecessors.at(step).size(); ++k) {
+            size_t j = predecessors.at(step).at(k);
+            if (--count[j] == 0) {
+                pool->submit([this, j, time]{ backwardTask(j, time); });
+            }
+        }
+    }
+
+    void ParallelExecutor::update(dtype eta)
+    {
+        for (int i=0; i<steps.size(); ++i) {
+            pool->submit([this, i, eta]{ steps.at(i)->updateParameters(eta); });
+        }
+        pool->wait();
+    }
+}
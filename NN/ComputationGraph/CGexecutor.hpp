@@ -0,0 +1,122 @@
+#ifndef CGE_HPP
+#define CGE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Type.hpp"
+#include "CG.hpp"
+
+namespace CGE
+{
+    template<typename T> using vec1 = type::vec1<T>;
+    using dtype = type::dtype;
+    using ttype = type::ttype;
+
+    vec1<CG::Node*> sortTopologically(CG::Node *top);
+    vec1<CG::Node*> replicate(vec1<CG::Node*> steps);
+
+    class Plan // flat execution order; backward needs top to be a loss
+    {
+        public :
+            CG::Node        *top;
+            vec1<CG::Node*>  steps;
+
+            Plan (CG::Node *top);
+            virtual ~Plan ();
+
+            virtual void forward(ttype time);
+            void forward();
+
+            virtual void backward(ttype time);
+            void backward();
+            void truncatedBackward(ttype time);
+
+            virtual void update(dtype eta);
+    };
+
+    class CheckpointPlan : public Plan // recomputes the dropped nodes during backward
+    {
+        public :
+            std::map<CG::Node*, size_t> index;
+            vec1<size_t>                lastUse; // last step that reads the data of each step
+            vec1<bool>                  keep;    // data survives the forward pass
+
+            CheckpointPlan (CG::Node *top);
+            CheckpointPlan (CG::Node *top, size_t interval);
+
+            using Plan::forward;
+            using Plan::backward;
+
+            virtual void forward(ttype time);
+            virtual void backward(ttype time);
+
+            void recompute(size_t step, ttype time);
+    };
+
+    class ThreadPool // work-stealing, one deque per worker
+    {
+        public :
+            struct Worker
+            {
+                std::deque<std::function<void()>> tasks;
+                std::mutex                        lock;
+            };
+
+            vec1<std::thread>             threads;
+            vec1<std::unique_ptr<Worker>> workers;
+            std::atomic<size_t>           pending;
+            std::atomic<size_t>           queued;
+            std::atomic<size_t>           next;
+            std::mutex                    sleep;
+            std::condition_variable       wake;
+            std::condition_variable       done;
+            bool                          stop;
+
+            ThreadPool (size_t size);
+            ~ThreadPool ();
+
+            size_t size();
+
+            void submit(std::function<void()> task);
+            void wait();
+
+            bool pop(size_t index, std::function<void()> &task);
+            bool steal(size_t index, std::function<void()> &task);
+            void work(size_t index);
+    };
+
+    class ParallelExecutor : public Plan // runs every node as soon as its dependencies are done
+    {
+        public :
+            ThreadPool                          *pool;
+            std::map<CG::Node*, size_t>          index;
+            vec1<vec1<size_t>>                   successors;   // forward edges inside the plan
+            vec1<vec1<size_t>>                   predecessors; // backward edges
+            std::unique_ptr<std::atomic<int>[]>  count;
+            vec1<std::unique_ptr<CG::Tensor>>    buffers;      // one per edge into a fan-out node
+            vec1<vec1<CG::Tensor*>>              sinks;        // consumer side of the buffers
+            vec1<vec1<CG::Tensor*>>              sources;      // producer side of the buffers
+
+            ParallelExecutor (CG::Node *top, size_t threads);
+            virtual ~ParallelExecutor ();
+
+            using Plan::forward;
+            using Plan::backward;
+
+            virtual void forward(ttype time);
+            virtual void backward(ttype time);
+            virtual void update(dtype eta);
+
+            void forwardTask(size_t step, ttype time);
+            void backwardTask(size_t step, ttype time);
+    };
+}
+
+#endif
@@ -1,8 +1,12 @@
 #include "CGgenerator.hpp"
 #include "CGconverter.hpp"
 #include "CGparser.hpp"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <string>
 #include <random>
+#include <typeinfo>
 
 namespace CGG
 {
@@ -49,10 +53,24 @@ namespace CGG
         return ret;
     }
 
+    CG::Tensor initKernel(std::string initType, size_t output, size_t channel, size_t height, size_t width) // [output][channel][height][width]
+    {
+        CG::Tensor ret({output, channel, height, width});
+        for (int o=0; o<output; ++o) {
+            CG::Tensor kernel(initKernel(initType, channel, height, width));
+            std::copy(kernel.data(), kernel.data() + kernel.numel(), ret.data(o));
+        }
+
+        return ret;
+    }
+
     CG::Node* setLossFunction(CG::Node *output, CG::Node *target, std::string lossType)
     {
         if (lossType == "MSE") {
             return new CG::MSE(output, target);
+        } else if (lossType == "CEE" && typeid(*output) == typeid(CG::Softmax)) { // the Softmax stays as the output
+            CG::detach(output);
+            return new CG::SoftmaxCrossEntropy(output->backward.at(0), target);
         } else if (lossType == "CEE") {
             return new CG::CEE(output, target);
         } else {
@@ -73,48 +91,158 @@ namespace CGG
 
 
 
-    NN1d::NN1d (CG::Leaf1 *input, CG::Leaf1 *target, CG::Node *output, CG::Node *loss)
+    vec2<dtype> getBatchOutput(CG::Node *output) // split the data of time 0 into samples
+    {
+        vec2<dtype> ret;
+        ret.resize(output->batch);
+        const dtype *y = output->data.at(0).data();
+        for (int n=0; n<output->batch; ++n) {
+            ret.at(n) = vec1<dtype>(y + n * output->dsize, y + (n + 1) * output->dsize);
+        }
+        return ret;
+    }
+
+    dtype getBatchLoss(CG::Node *loss)
+    {
+        dtype ret = 0;
+        for (int n=0; n<loss->batch; ++n) {
+            ret += loss->data.at(0)[n];
+        }
+        return ret;
+    }
+
+
+
+    NN1d::NN1d (CG::Leaf1 *input, CG::Leaf1 *target, CG::Node *output, CG::Node *loss) // fuses the element-wise nodes
     : input(input), target(target), output(output), loss(loss)
     {
         assert (loss->data.size() == 1);
+        fusedNodes    = CG::fuseActivations(loss, {input, target, output});
+        plan          = new CGE::Plan(loss);
+        inferencePlan = new CGE::Plan(output);
+    }
+
+    void NN1d::setBatch(size_t batch)
+    {
+        if (output->batch != batch) {
+            CG::setBatch(output, batch); // reaches a detached Softmax too
+            if (memory != nullptr) {
+                memory->apply();
+            }
+        }
+    }
+
+    void NN1d::setThreads(size_t threads)
+    {
+        assert (memory == nullptr || threads <= 1); // the memory plan needs the sequential order
+        delete plan;
+        delete inferencePlan;
+        if (threads > 1) {
+            plan          = new CGE::ParallelExecutor(loss, threads);
+            inferencePlan = new CGE::ParallelExecutor(output, threads);
+        } else {
+            plan          = new CGE::Plan(loss);
+            inferencePlan = new CGE::Plan(output);
+        }
+    }
+
+    void NN1d::setCheckpointing(size_t interval) // 0 lets the plan choose
+    {
+        delete plan;
+        plan = new CGE::CheckpointPlan(loss, interval);
+    }
+
+    void NN1d::setInference(bool inference) // releases the gradients
+    {
+        if (!inference) {
+            setMemoryPlan(false);
+        }
+        CG::setInference(output, inference);
+    }
+
+    void NN1d::setMemoryPlan(bool planning) // inference only
+    {
+        if (memory != nullptr) {
+            memory->release();
+            delete memory;
+            memory = nullptr;
+        }
+        if (planning) {
+            assert (loss->inference && dynamic_cast<CGE::ParallelExecutor*>(inferencePlan) == nullptr);
+            memory = new CGM::MemoryPlan(inferencePlan->steps);
+            memory->apply();
+        }
     }
 
     vec1<dtype> NN1d::expect(vec1<dtype> expectData)
     {
+        setBatch(1);
         input->getInput(expectData);
-        input->forwardPropagation();
-
-        target->forwardPropagation();
+        inferencePlan->forward();
 
         return output->data.at(0);
     }
 
+    vec2<dtype> NN1d::expectBatch(vec2<dtype> expectData)
+    {
+        setBatch(expectData.size());
+        input->getBatchInput(expectData);
+        inferencePlan->forward();
+
+        return getBatchOutput(output);
+    }
+
     dtype NN1d::test(vec1<dtype> testData, vec1<dtype> targetData)
     {
+        setBatch(1);
         input->getInput(testData);
         target->getInput(targetData);
 
-        input->forwardPropagation();
-        target->forwardPropagation();
+        plan->forward();
 
         return loss->data.at(0).at(0);
     }
 
+    dtype NN1d::testBatch(vec2<dtype> testData, vec2<dtype> targetData)
+    {
+        setBatch(testData.size());
+        input->getBatchInput(testData);
+        target->getBatchInput(targetData);
+
+        plan->forward();
+
+        return getBatchLoss(loss);
+    }
+
     dtype NN1d::train(vec1<dtype> trainData, vec1<dtype> targetData)
     {
+        assert (!loss->inference);
+        setBatch(1);
         input->getInput(trainData);
         target->getInput(targetData);
 
-        input->forwardPropagation();
-        target->forwardPropagation();
-        loss->backwardPropagation();
+        plan->forward();
+        plan->backward();
         
         return loss->data.at(0).at(0);
     }
 
+    dtype NN1d::trainBatch(vec2<dtype> trainData, vec2<dtype> targetData)
+    {
+        assert (!loss->inference);
+        setBatch(trainData.size());
+        input->getBatchInput(trainData);
+        target->getBatchInput(targetData);
+
+        plan->forward();
+        plan->backward();
+        
+        return getBatchLoss(loss);
+    }
+
     void NN1d::update(dtype eta)
     {
-        loss->update(eta);
+        plan->update(eta);
     }
 
 
@@ -123,54 +251,424 @@ namespace CGG
     : input(input), target(target), output(output), loss(loss)
     {
         assert (loss->data.size() == 1);
+        fusedNodes    = CG::fuseActivations(loss, {input, target, output});
+        plan          = new CGE::Plan(loss);
+        inferencePlan = new CGE::Plan(output);
+    }
+
+    void NN2d::setBatch(size_t batch)
+    {
+        if (output->batch != batch) {
+            CG::setBatch(output, batch);
+            if (memory != nullptr) {
+                memory->apply();
+            }
+        }
+    }
+
+    void NN2d::setThreads(size_t threads)
+    {
+        assert (memory == nullptr || threads <= 1);
+        delete plan;
+        delete inferencePlan;
+        if (threads > 1) {
+            plan          = new CGE::ParallelExecutor(loss, threads);
+            inferencePlan = new CGE::ParallelExecutor(output, threads);
+        } else {
+            plan          = new CGE::Plan(loss);
+            inferencePlan = new CGE::Plan(output);
+        }
+    }
+
+    void NN2d::setCheckpointing(size_t interval)
+    {
+        delete plan;
+        plan = new CGE::CheckpointPlan(loss, interval);
+    }
+
+    void NN2d::setInference(bool inference)
+    {
+        if (!inference) {
+            setMemoryPlan(false);
+        }
+        CG::setInference(output, inference);
+    }
+
+    void NN2d::setMemoryPlan(bool planning)
+    {
+        if (memory != nullptr) {
+            memory->release();
+            delete memory;
+            memory = nullptr;
+        }
+        if (planning) {
+            assert (loss->inference && dynamic_cast<CGE::ParallelExecutor*>(inferencePlan) == nullptr);
+            memory = new CGM::MemoryPlan(inferencePlan->steps);
+            memory->apply();
+        }
     }
 
     vec1<dtype> NN2d::expect(vec2<dtype> expectData)
     {
+        setBatch(1);
         input->getInput(expectData);
-        input->forwardPropagation();
-
-        target->forwardPropagation();
+        inferencePlan->forward();
 
         return output->data.at(0);
     }
 
+    vec2<dtype> NN2d::expectBatch(vec3<dtype> expectData)
+    {
+        setBatch(expectData.size());
+        input->getBatchInput(expectData);
+        inferencePlan->forward();
+
+        return getBatchOutput(output);
+    }
+
     dtype NN2d::test(vec2<dtype> testData, vec1<dtype> targetData)
     {
+        setBatch(1);
         input->getInput(testData);
         target->getInput(targetData);
 
-        input->forwardPropagation();
-        target->forwardPropagation();
+        plan->forward();
 
         return loss->data.at(0).at(0);
     }
 
+    dtype NN2d::testBatch(vec3<dtype> testData, vec2<dtype> targetData)
+    {
+        setBatch(testData.size());
+        input->getBatchInput(testData);
+        target->getBatchInput(targetData);
+
+        plan->forward();
+
+        return getBatchLoss(loss);
+    }
+
     dtype NN2d::train(vec2<dtype> trainData, vec1<dtype> targetData)
     {
+        assert (!loss->inference);
+        setBatch(1);
         input->getInput(trainData);
         target->getInput(targetData);
 
-        input->forwardPropagation();
-        target->forwardPropagation();
-        loss->backwardPropagation();
+        plan->forward();
+        plan->backward();
         
         return loss->data.at(0).at(0);
     }
 
+    dtype NN2d::trainBatch(vec3<dtype> trainData, vec2<dtype> targetData)
+    {
+        assert (!loss->inference);
+        setBatch(trainData.size());
+        input->getBatchInput(trainData);
+        target->getBatchInput(targetData);
+
+        plan->forward();
+        plan->backward();
+        
+        return getBatchLoss(loss);
+    }
+
     void NN2d::update(dtype eta)
     {
-        loss->update(eta);
+        plan->update(eta);
     }
 
 
 
+    size_t getPosition(vec1<CG::Node*> &steps, CG::Node *node)
+    {
+        for (int i=0; i<steps.size(); ++i) {
+            if (steps.at(i) == node) {
+                return i;
+            }
+        }
+        assert (false);
+        return steps.size();
+    }
+
+    CG::Node* getReplica(vec1<CG::Node*> &steps, vec1<CG::Node*> &nodes, CG::Node *node) // also an output beside the loss
+    {
+        if (std::find(steps.begin(), steps.end(), node) != steps.end()) {
+            return nodes.at(getPosition(steps, node));
+        }
+        vec1<CG::Node*> inputs(node->backward.size());
+        for (int i=0; i<inputs.size(); ++i) {
+            inputs.at(i) = getReplica(steps, nodes, node->backward.at(i));
+        }
+        CG::Node *ret = node->replicate(inputs);
+        vec1<CG::Node*> &forward = node->backward.at(0)->forward;
+        if (std::find(forward.begin(), forward.end(), node) == forward.end()) {
+            CG::detach(ret);
+        }
+        return ret;
+    }
+
+    NN1d* replicate(NN1d *nn, vec1<CG::Node*> &nodes) // nodes receives the replica of the steps
+    {
+        vec1<CG::Node*> &steps = nn->plan->steps;
+        nodes = CGE::replicate(steps);
+        return new NN1d(dynamic_cast<CG::Leaf1*>(nodes.at(getPosition(steps, nn->input)))
+                      , dynamic_cast<CG::Leaf1*>(nodes.at(getPosition(steps, nn->target)))
+                      , getReplica(steps, nodes, nn->output)
+                      , nodes.at(getPosition(steps, nn->loss)));
+    }
+
+    NN2d* replicate(NN2d *nn, vec1<CG::Node*> &nodes)
+    {
+        vec1<CG::Node*> &steps = nn->plan->steps;
+        nodes = CGE::replicate(steps);
+        return new NN2d(dynamic_cast<CG::Leaf2*>(nodes.at(getPosition(steps, nn->input)))
+                      , dynamic_cast<CG::Leaf1*>(nodes.at(getPosition(steps, nn->target)))
+                      , getReplica(steps, nodes, nn->output)
+                      , nodes.at(getPosition(steps, nn->loss)));
+    }
+
+    DataParallel1d::DataParallel1d (NN1d *master, size_t threads)
+    : master(master)
+    {
+        assert (threads > 0);
+        replicas.push_back(master);
+        nodes.push_back(master->plan->steps);
+        for (int k=1; k<threads; ++k) {
+            nodes.push_back({});
+            replicas.push_back(replicate(master, nodes.back()));
+        }
+        pool = new CGE::ThreadPool(threads);
+    }
+
+    DataParallel1d::~DataParallel1d ()
+    {
+        delete pool;
+    }
+
+    dtype DataParallel1d::trainBatch(vec2<dtype> trainData, vec2<dtype> targetData) // each replica takes a contiguous slice
+    {
+        assert (trainData.size() == targetData.size());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        size_t size = trainData.size();
+        vec1<dtype> losses(replicas.size(), 0);
+        for (int k=0; k<replicas.size(); ++k) {
+            size_t begin = size * k / replicas.size();
+            size_t end   = size * (k+1) / replicas.size();
+            if (begin == end) {
+                continue;
+            }
+            pool->submit([this, k, begin, end, &trainData, &targetData, &losses]{
+                losses.at(k) = replicas.at(k)->trainBatch(vec2<dtype>(trainData.begin() + begin, trainData.begin() + end)
+                                                         , vec2<dtype>(targetData.begin() + begin, targetData.begin() + end));
+            });
+        }
+        pool->wait();
+
+        dtype ret = 0;
+        for (int k=0; k<losses.size(); ++k) {
+            ret += losses.at(k);
+        }
+
+        samples += size;
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ret;
+    }
+
+    void DataParallel1d::update(dtype eta) // sums the replica gradients into the master
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (int i=0; i<nodes.at(0).size(); ++i) {
+            pool->submit([this, i]{
+                for (int k=1; k<nodes.size(); ++k) {
+                    nodes.at(0).at(i)->mergeGradients(nodes.at(k).at(i));
+                }
+            });
+        }
+        pool->wait();
+        master->update(eta);
+
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double DataParallel1d::samplesPerSecond()
+    {
+        return (seconds == 0) ? 0 : samples / seconds;
+    }
+
+
+
+    DataParallel2d::DataParallel2d (NN2d *master, size_t threads)
+    : master(master)
+    {
+        assert (threads > 0);
+        replicas.push_back(master);
+        nodes.push_back(master->plan->steps);
+        for (int k=1; k<threads; ++k) {
+            nodes.push_back({});
+            replicas.push_back(replicate(master, nodes.back()));
+        }
+        pool = new CGE::ThreadPool(threads);
+    }
+
+    DataParallel2d::~DataParallel2d ()
+    {
+        delete pool;
+    }
+
+    dtype DataParallel2d::trainBatch(vec3<dtype> trainData, vec2<dtype> targetData)
+    {
+        assert (trainData.size() == targetData.size());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        size_t size = trainData.size();
+        vec1<dtype> losses(replicas.size(), 0);
+        for (int k=0; k<replicas.size(); ++k) {
+            size_t begin = size * k / replicas.size();
+            size_t end   = size * (k+1) / replicas.size();
+            if (begin == end) {
+                continue;
+            }
+            pool->submit([this, k, begin, end, &trainData, &targetData, &losses]{
+                losses.at(k) = replicas.at(k)->trainBatch(vec3<dtype>(trainData.begin() + begin, trainData.begin() + end)
+                                                         , vec2<dtype>(targetData.begin() + begin, targetData.begin() + end));
+            });
+        }
+        pool->wait();
+
+        dtype ret = 0;
+        for (int k=0; k<losses.size(); ++k) {
+            ret += losses.at(k);
+        }
+
+        samples += size;
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ret;
+    }
+
+    void DataParallel2d::update(dtype eta)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (int i=0; i<nodes.at(0).size(); ++i) {
+            pool->submit([this, i]{
+                for (int k=1; k<nodes.size(); ++k) {
+                    nodes.at(0).at(i)->mergeGradients(nodes.at(k).at(i));
+                }
+            });
+        }
+        pool->wait();
+        master->update(eta);
+
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double DataParallel2d::samplesPerSecond()
+    {
+        return (seconds == 0) ? 0 : samples / seconds;
+    }
+
+
+
+    Hogwild1d::Hogwild1d (NN1d *master, size_t threads)
+    : master(master)
+    {
+        assert (threads > 0);
+        replicas.push_back(master);
+        nodes.push_back(master->plan->steps);
+        for (int k=1; k<threads; ++k) {
+            nodes.push_back({});
+            replicas.push_back(replicate(master, nodes.back()));
+        }
+        for (int i=0; i<nodes.at(0).size() && threads > 1; ++i) { // private copies read, atomic ones written
+            CG::Affine *node = dynamic_cast<CG::Affine*>(nodes.at(0).at(i));
+            if (node == nullptr) {
+                continue;
+            }
+            std::shared_ptr<vec1<std::atomic<dtype>>> shared = std::make_shared<vec1<std::atomic<dtype>>>(node->weight.numel());
+            for (int j=0; j<node->weight.numel(); ++j) {
+                shared->at(j).store(node->weight.data()[j], std::memory_order_relaxed);
+            }
+            for (int k=0; k<replicas.size(); ++k) {
+                CG::Affine *replica = dynamic_cast<CG::Affine*>(nodes.at(k).at(i));
+                replica->weight       = CG::Tensor(node->weight);
+                replica->sharedWeight = shared;
+            }
+        }
+        pool = new CGE::ThreadPool(threads);
+    }
+
+    Hogwild1d::~Hogwild1d ()
+    {
+        delete pool;
+    }
+
+    dtype Hogwild1d::train(vec2<dtype> trainData, vec2<dtype> targetData, dtype eta, size_t batch) // one pass over the data
+    {
+        assert (trainData.size() == targetData.size() && batch > 0);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        size_t size = trainData.size();
+        vec1<dtype> losses(replicas.size(), 0);
+        for (int k=0; k<replicas.size(); ++k) {
+            size_t begin = size * k / replicas.size();
+            size_t end   = size * (k+1) / replicas.size();
+            pool->submit([this, k, begin, end, batch, eta, &trainData, &targetData, &losses]{
+                for (size_t i=begin; i<end; i+=batch) {
+                    size_t last = std::min(i + batch, end);
+                    losses.at(k) += replicas.at(k)->trainBatch(vec2<dtype>(trainData.begin() + i, trainData.begin() + last)
+                                                              , vec2<dtype>(targetData.begin() + i, targetData.begin() + last));
+                    replicas.at(k)->update(eta);
+                }
+            });
+        }
+        pool->wait();
+
+        for (int i=0; i<nodes.at(0).size(); ++i) { // so that the master holds the trained weights
+            CG::Affine *node = dynamic_cast<CG::Affine*>(nodes.at(0).at(i));
+            if (node != nullptr && node->sharedWeight != nullptr) {
+                node->readSharedWeight();
+            }
+        }
+
+        dtype ret = 0;
+        for (int k=0; k<losses.size(); ++k) {
+            ret += losses.at(k);
+        }
+
+        samples += size;
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ret;
+    }
+
+    double Hogwild1d::samplesPerSecond()
+    {
+        return (seconds == 0) ? 0 : samples / seconds;
+    }
+
+
+
+    CG::Node* getOutput(CG::Node *loss) // a detached Softmax for a fused loss
+    {
+        CG::Node *logits = loss->backward.at(0);
+        if (typeid(*loss) != typeid(CG::SoftmaxCrossEntropy)) {
+            return logits;
+        }
+        CG::Node *ret = new CG::Softmax(logits);
+        CG::detach(ret);
+        return ret;
+    }
+
     NN1d* parseFeedForward(std::string filename)
     {
         CGP::Parser P;
-        CG::Node *loss = P.parseAll(filename);
+        CG::Node *loss = CG::fuseSoftmaxCrossEntropy(P.parseAll(filename));
+        CG::mergeSiblings(loss);
 
-        CG::Node  *output = loss->backward.at(0);
+        CG::Node  *output = getOutput(loss);
         CG::Leaf1 *target = dynamic_cast<CG::Leaf1*>(loss->backward.at(1));
 
         CG::Node *temp = output;
@@ -187,9 +685,11 @@ namespace CGG
     NN2d* parseLenet5(std::string filename)
     {
         CGP::Parser P;
-        CG::Node *loss = P.parseAll(filename);
+        CG::Node *loss = CG::fuseSoftmaxCrossEntropy(P.parseAll(filename));
+        CG::stackChannels(loss); // as multi-channel layers
+        CG::mergeSiblings(loss); // the rest as merged siblings
 
-        CG::Node  *output = loss->backward.at(0);
+        CG::Node  *output = getOutput(loss);
         CG::Leaf1 *target = dynamic_cast<CG::Leaf1*>(loss->backward.at(1));
 
         CG::Node *temp = output;
@@ -230,93 +730,53 @@ namespace CGG
 
 
         /* C1- Convolution Layer */
-        vec1<CG::Convolution2d*> c1 = vec1<CG::Convolution2d*>(6);
-        for (int i=0; i<6; ++i) {
-            c1.at(i) = new CG::Convolution2d({i0}, initKernel("He", 1, 5, 5), 0, 28, 28);
-        }
+        CG::Node *c1 = new CG::MultiConvolution2d({i0}, initKernel("He", 6, 1, 5, 5), CG::Tensor(vec1<size_t>{6}), CG::Tensor(), 28, 28);
+        CG::Node *a1 = new CG::ReLU(c1);
 
-        vec1<CG::ReLU*> a1 = vec1<CG::ReLU*>(6);
-        for (int i=0; i<6; ++i) {
-            a1.at(i) = new CG::ReLU(c1.at(i));
-        }
 
 
-        
         /* S2- Pooling Layer */
-        vec1<CG::AveragePooling2d*> s2 = vec1<CG::AveragePooling2d*>(6);
-        for (int i=0; i<6; ++i) {
-            s2.at(i) = new CG::AveragePooling2d(a1.at(i), 2, 2, 2);
-        }
-
-        vec1<CG::ReLU*> a2 = vec1<CG::ReLU*>(6);
-        for (int i=0; i<6; ++i) {
-            a2.at(i) = new CG::ReLU(s2.at(i));
-        }
+        CG::Node *s2 = new CG::AveragePooling2d(a1, 2, 2, 2);
+        CG::Node *a2 = new CG::ReLU(s2);
 
 
 
         /* C3- Convolution Layer */
-        vec1<CG::Convolution2d*> c3 = {  new CG::Convolution2d({a2.at(0), a2.at(1), a2.at(2)}, initKernel("He", 3, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(1), a2.at(2), a2.at(3)}, initKernel("He", 3, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(2), a2.at(3), a2.at(4)}, initKernel("He", 3, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(3), a2.at(4), a2.at(5)}, initKernel("He", 3, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(4), a2.at(5), a2.at(0)}, initKernel("He", 3, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(5), a2.at(0), a2.at(1)}, initKernel("He", 3, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(0), a2.at(1), a2.at(2), a2.at(3)}, initKernel("He", 4, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(1), a2.at(2), a2.at(3), a2.at(4)}, initKernel("He", 4, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(2), a2.at(3), a2.at(4), a2.at(5)}, initKernel("He", 4, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(3), a2.at(4), a2.at(5), a2.at(0)}, initKernel("He", 4, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(4), a2.at(5), a2.at(0), a2.at(1)}, initKernel("He", 4, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(5), a2.at(0), a2.at(1), a2.at(2)}, initKernel("He", 4, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(0), a2.at(1), a2.at(3), a2.at(4)}, initKernel("He", 4, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(1), a2.at(2), a2.at(4), a2.at(5)}, initKernel("He", 4, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(2), a2.at(3), a2.at(5), a2.at(0)}, initKernel("He", 4, 5, 5), 0)
-                                       , new CG::Convolution2d({a2.at(0), a2.at(1), a2.at(2), a2.at(3), a2.at(4), a2.at(5)}, initKernel("He", 6, 5, 5), 0)};
-
-        vec1<CG::ReLU*> a3 = vec1<CG::ReLU*>(16);
-        for (int i=0; i<16; ++i) {
-            a3.at(i) = new CG::ReLU(c3.at(i));
-        }
+        vec2<dtype> table = { {1, 1, 1, 0, 0, 0}
+                            , {0, 1, 1, 1, 0, 0}
+                            , {0, 0, 1, 1, 1, 0}
+                            , {0, 0, 0, 1, 1, 1}
+                            , {1, 0, 0, 0, 1, 1}
+                            , {1, 1, 0, 0, 0, 1}
+                            , {1, 1, 1, 1, 0, 0}
+                            , {0, 1, 1, 1, 1, 0}
+                            , {0, 0, 1, 1, 1, 1}
+                            , {1, 0, 0, 1, 1, 1}
+                            , {1, 1, 0, 0, 1, 1}
+                            , {1, 1, 1, 0, 0, 1}
+                            , {1, 1, 0, 1, 1, 0}
+                            , {0, 1, 1, 0, 1, 1}
+                            , {1, 0, 1, 1, 0, 1}
+                            , {1, 1, 1, 1, 1, 1} };
+        CG::Node *c3 = new CG::GroupedConvolution2d({a2}, initKernel("He", 16, 6, 5, 5), CG::Tensor(vec1<size_t>{16}), CG::Tensor(table));
+        CG::Node *a3 = new CG::ReLU(c3);
 
 
 
         /* S4- Pooling Layer */
-        vec1<CG::AveragePooling2d*> s4 = vec1<CG::AveragePooling2d*>(16);
-        for (int i=0; i<16; ++i) {
-            s4.at(i) = new CG::AveragePooling2d(a3.at(i), 2, 2, 2);
-        }
-
-        vec1<CG::ReLU*> a4 = vec1<CG::ReLU*>(16);
-        for (int i=0; i<16; ++i) {
-            a4.at(i) = new CG::ReLU(s4.at(i));
-        }
+        CG::Node *s4 = new CG::AveragePooling2d(a3, 2, 2, 2);
+        CG::Node *a4 = new CG::ReLU(s4);
 
 
 
         /* C5- Convolution Layer */
-        vec1<CG::Node*> arg5 = vec1<CG::Node*>(16);
-        for (int i=0; i<16; ++i) {
-            arg5.at(i) = a4.at(i);
-        }
-        vec1<CG::Convolution2d*> c5 = vec1<CG::Convolution2d*>(120);
-        for (int i=0; i<120; ++i) {
-            c5.at(i) = new CG::Convolution2d(arg5, initKernel("He", 16, 5, 5), 0);
-        }
-
-        vec1<CG::ReLU*> a5 = vec1<CG::ReLU*>(120);
-        for (int i=0; i<120; ++i) {
-            a5.at(i) = new CG::ReLU(c5.at(i));
-        }
+        CG::Node *c5 = new CG::MultiConvolution2d({a4}, initKernel("He", 120, 16, 5, 5), CG::Tensor(vec1<size_t>{120}), CG::Tensor());
+        CG::Node *a5 = new CG::ReLU(c5);
 
 
 
         /* F6- Fully Connected Layer */
-        vec1<CG::Node*> arg6 = vec1<CG::Node*>(120);
-        for (int i=0; i<120; ++i) {
-            arg6.at(i) = a5.at(i);
-        }
-        CG::Node* c6 = new CG::Concatenation(arg6);
-        CG::Affine* f6 = new CG::Affine(c6, initWeight("He", 120, 10), 1);
+        CG::Affine* f6 = new CG::Affine(a5, initWeight("He", 120, 10), 1);
         CG::Softmax* o6 = new CG::Softmax(f6);
 
 
@@ -327,7 +787,7 @@ namespace CGG
 
 
         /* Output Layer */
-        CG::CEE* l7 = new CG::CEE(o6, target);
+        CG::Node* l7 = setLossFunction(o6, target, "CEE");
 
         
 
@@ -2,6 +2,8 @@
 #define CGG_H
 
 #include "CG.hpp"
+#include "CGexecutor.hpp"
+#include "CGmemory.hpp"
 #include <string>
 
 namespace CGG
@@ -13,11 +15,15 @@ namespace CGG
 
     vec2<dtype> initWeight(std::string initType, size_t domSize, size_t ranSize);
     vec3<dtype> initKernel(std::string initType, size_t channel, size_t height, size_t width);
+    CG::Tensor  initKernel(std::string initType, size_t output, size_t channel, size_t height, size_t width);
 
     CG::Node* setLossFunction(CG::Node *output, CG::Node *target, std::string lossType);
 
     CG::Node* setNormalizationFunction(CG::Node *output, std::string normalizationType);
 
+    vec2<dtype> getBatchOutput(CG::Node *output);
+    dtype getBatchLoss(CG::Node *loss);
+
     class NN1d
     {
         public : 
@@ -25,14 +31,27 @@ namespace CGG
             CG::Leaf1 *target;
             CG::Node  *output;
             CG::Node  *loss;
+            CGE::Plan *plan;
+            CGE::Plan *inferencePlan; // rooted at the output
+            CGM::MemoryPlan *memory = nullptr;
+            size_t     fusedNodes; // folded by CG::fuseActivations
 
             NN1d (CG::Leaf1 *input, CG::Leaf1 *target, CG::Node *output, CG::Node *loss);
 
+            void setBatch(size_t batch);
+            void setThreads(size_t threads);
+            void setInference(bool inference);
+            void setMemoryPlan(bool planning);
+            void setCheckpointing(size_t interval);
+
             vec1<dtype> expect(vec1<dtype> expectData);
+            vec2<dtype> expectBatch(vec2<dtype> expectData);
 
             dtype test(vec1<dtype> testData, vec1<dtype> targetData);
+            dtype testBatch(vec2<dtype> testData, vec2<dtype> targetData);
 
             dtype train(vec1<dtype> trainData, vec1<dtype> targetData);
+            dtype trainBatch(vec2<dtype> trainData, vec2<dtype> targetData);
 
             void update(dtype eta);
     };
@@ -43,16 +62,87 @@ namespace CGG
             CG::Leaf1 *target;
             CG::Node  *output;
             CG::Node  *loss;
+            CGE::Plan *plan;
+            CGE::Plan *inferencePlan;
+            CGM::MemoryPlan *memory = nullptr;
+            size_t     fusedNodes;
 
             NN2d (CG::Leaf2 *input, CG::Leaf1 *target, CG::Node *output, CG::Node *loss);
 
+            void setBatch(size_t batch);
+            void setThreads(size_t threads);
+            void setInference(bool inference);
+            void setMemoryPlan(bool planning);
+            void setCheckpointing(size_t interval);
+
             vec1<dtype> expect(vec2<dtype> expectData);
+            vec2<dtype> expectBatch(vec3<dtype> expectData);
 
             dtype test(vec2<dtype> testData, vec1<dtype> targetData);
+            dtype testBatch(vec3<dtype> testData, vec2<dtype> targetData);
 
             dtype train(vec2<dtype> trainData, vec1<dtype> targetData);
+            dtype trainBatch(vec3<dtype> trainData, vec2<dtype> targetData);
+
+            void update(dtype eta);
+    };
+
+    NN1d* replicate(NN1d *nn, vec1<CG::Node*> &nodes);
+    NN2d* replicate(NN2d *nn, vec1<CG::Node*> &nodes);
 
+    class DataParallel1d // mini-batches split across replicas
+    {
+        public :
+            NN1d                     *master;
+            vec1<NN1d*>               replicas; // replicas.at(0) is the master
+            vec1<vec1<CG::Node*>>     nodes;    // aligned plan steps of every replica
+            CGE::ThreadPool          *pool;
+            size_t                    samples = 0;
+            double                    seconds = 0;
+
+            DataParallel1d (NN1d *master, size_t threads);
+            ~DataParallel1d ();
+
+            dtype trainBatch(vec2<dtype> trainData, vec2<dtype> targetData);
             void update(dtype eta);
+
+            double samplesPerSecond();
+    };
+    class DataParallel2d
+    {
+        public :
+            NN2d                     *master;
+            vec1<NN2d*>               replicas;
+            vec1<vec1<CG::Node*>>     nodes;
+            CGE::ThreadPool          *pool;
+            size_t                    samples = 0;
+            double                    seconds = 0;
+
+            DataParallel2d (NN2d *master, size_t threads);
+            ~DataParallel2d ();
+
+            dtype trainBatch(vec3<dtype> trainData, vec2<dtype> targetData);
+            void update(dtype eta);
+
+            double samplesPerSecond();
+    };
+
+    class Hogwild1d // asynchronous SGD over shared parameters
+    {
+        public :
+            NN1d                  *master;
+            vec1<NN1d*>            replicas; // replicas.at(0) is the master
+            vec1<vec1<CG::Node*>>  nodes;
+            CGE::ThreadPool       *pool;
+            size_t                 samples = 0;
+            double                 seconds = 0;
+
+            Hogwild1d (NN1d *master, size_t threads);
+            ~Hogwild1d ();
+
+            dtype train(vec2<dtype> trainData, vec2<dtype> targetData, dtype eta, size_t batch);
+
+            double samplesPerSecond();
     };
 
     NN1d* parseFeedForward(std::string filename);
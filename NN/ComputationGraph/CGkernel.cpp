@@ -0,0 +1,951 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include "Type.hpp"
+#include "CGkernel.hpp"
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+namespace CGK
+{
+#if defined(__AVX512F__)
+    using vtype = __m512d;
+    static const size_t W = 8;
+    static inline vtype vload(const dtype *p){ return _mm512_loadu_pd(p); }
+    static inline void  vstore(dtype *p, vtype v){ _mm512_storeu_pd(p, v); }
+    static inline vtype vset1(dtype x){ return _mm512_set1_pd(x); }
+    static inline vtype vzero(){ return _mm512_setzero_pd(); }
+    static inline vtype vfma(vtype a, vtype b, vtype c){ return _mm512_fmadd_pd(a, b, c); }
+    static inline dtype vsum(vtype v){ return _mm512_reduce_add_pd(v); }
+    static inline vtype vadd(vtype a, vtype b){ return _mm512_add_pd(a, b); }
+    static inline vtype vsub(vtype a, vtype b){ return _mm512_sub_pd(a, b); }
+    static inline vtype vmul(vtype a, vtype b){ return _mm512_mul_pd(a, b); }
+    static inline vtype vdiv(vtype a, vtype b){ return _mm512_div_pd(a, b); }
+    static inline vtype vmin(vtype a, vtype b){ return _mm512_min_pd(a, b); }
+    static inline vtype vmax(vtype a, vtype b){ return _mm512_max_pd(a, b); }
+    static inline vtype vround(vtype a){ return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static inline vtype vpow2(vtype k) // 2^k for an integral k in [-1022, 1023]
+    {
+        __m512i bits = _mm512_castpd_si512(_mm512_add_pd(k, _mm512_set1_pd(6755399441055744.0))); // k in the low bits
+        return _mm512_castsi512_pd(_mm512_add_epi64(_mm512_slli_epi64(bits, 52), _mm512_set1_epi64(1023LL << 52)));
+    }
+    static inline vtype vexponent(vtype a){ return _mm512_getexp_pd(a); } // floor(log2 a) for a positive normal a
+#elif defined(__AVX2__) && defined(__FMA__)
+    using vtype = __m256d;
+    static const size_t W = 4;
+    static inline vtype vload(const dtype *p){ return _mm256_loadu_pd(p); }
+    static inline void  vstore(dtype *p, vtype v){ _mm256_storeu_pd(p, v); }
+    static inline vtype vset1(dtype x){ return _mm256_set1_pd(x); }
+    static inline vtype vzero(){ return _mm256_setzero_pd(); }
+    static inline vtype vfma(vtype a, vtype b, vtype c){ return _mm256_fmadd_pd(a, b, c); }
+    static inline dtype vsum(vtype v)
+    {
+        __m128d h = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+    }
+    static inline vtype vadd(vtype a, vtype b){ return _mm256_add_pd(a, b); }
+    static inline vtype vsub(vtype a, vtype b){ return _mm256_sub_pd(a, b); }
+    static inline vtype vmul(vtype a, vtype b){ return _mm256_mul_pd(a, b); }
+    static inline vtype vdiv(vtype a, vtype b){ return _mm256_div_pd(a, b); }
+    static inline vtype vmin(vtype a, vtype b){ return _mm256_min_pd(a, b); }
+    static inline vtype vmax(vtype a, vtype b){ return _mm256_max_pd(a, b); }
+    static inline vtype vround(vtype a){ return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static inline vtype vpow2(vtype k)
+    {
+        __m256i bits = _mm256_castpd_si256(_mm256_add_pd(k, _mm256_set1_pd(6755399441055744.0)));
+        return _mm256_castsi256_pd(_mm256_add_epi64(_mm256_slli_epi64(bits, 52), _mm256_set1_epi64x(1023LL << 52)));
+    }
+    static inline vtype vexponent(vtype a) // the biased exponent field read as the mantissa of 2^52
+    {
+        __m256i bits = _mm256_or_si256(_mm256_srli_epi64(_mm256_castpd_si256(a), 52), _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0)));
+        return _mm256_sub_pd(_mm256_castsi256_pd(bits), _mm256_set1_pd(4503599627370496.0 + 1023));
+    }
+#else
+    using vtype = dtype;
+    static const size_t W = 1;
+    static inline vtype vload(const dtype *p){ return *p; }
+    static inline void  vstore(dtype *p, vtype v){ *p = v; }
+    static inline vtype vset1(dtype x){ return x; }
+    static inline vtype vzero(){ return 0; }
+    static inline vtype vfma(vtype a, vtype b, vtype c){ return a * b + c; }
+    static inline dtype vsum(vtype v){ return v; }
+    static inline vtype vadd(vtype a, vtype b){ return a + b; }
+    static inline vtype vsub(vtype a, vtype b){ return a - b; }
+    static inline vtype vmul(vtype a, vtype b){ return a * b; }
+    static inline vtype vdiv(vtype a, vtype b){ return a / b; }
+    static inline vtype vmin(vtype a, vtype b){ return std::min(a, b); }
+    static inline vtype vmax(vtype a, vtype b){ return std::max(a, b); }
+    static inline vtype vround(vtype a){ return std::nearbyint(a); }
+    static inline vtype vpow2(vtype k){ return std::ldexp(1.0, (int)k); }
+    static inline vtype vexponent(vtype a){ return std::ilogb(a); }
+#endif
+
+    static const size_t MR = 4;   // rows of C per micro-tile
+    static const size_t NR = 2;   // vectors of C per micro-tile
+    static const size_t KC = 256; // depth of the panel of B kept in L1
+
+    template<size_t R, size_t V>
+    static void tile(size_t kc, const dtype *A, size_t lda, const dtype *B, size_t ldb, dtype *C, size_t ldc) // C[R][V*W] += A[R][kc] B[kc][V*W], in registers
+    {
+        vtype acc[R][V];
+        for (int r=0; r<R; ++r) {
+            for (int v=0; v<V; ++v) {
+                acc[r][v] = vload(C + r * ldc + v * W);
+            }
+        }
+        for (int k=0; k<kc; ++k) {
+            vtype b[V];
+            for (int v=0; v<V; ++v) {
+                b[v] = vload(B + k * ldb + v * W);
+            }
+            for (int r=0; r<R; ++r) {
+                vtype a = vset1(A[r * lda + k]);
+                for (int v=0; v<V; ++v) {
+                    acc[r][v] = vfma(a, b[v], acc[r][v]);
+                }
+            }
+        }
+        for (int r=0; r<R; ++r) {
+            for (int v=0; v<V; ++v) {
+                vstore(C + r * ldc + v * W, acc[r][v]);
+            }
+        }
+    }
+
+    template<size_t V>
+    static void tile(size_t rows, size_t kc, const dtype *A, size_t lda, const dtype *B, size_t ldb, dtype *C, size_t ldc)
+    {
+        switch (rows) {
+            case 4 : tile<4, V>(kc, A, lda, B, ldb, C, ldc); break;
+            case 3 : tile<3, V>(kc, A, lda, B, ldb, C, ldc); break;
+            case 2 : tile<2, V>(kc, A, lda, B, ldb, C, ldc); break;
+            case 1 : tile<1, V>(kc, A, lda, B, ldb, C, ldc); break;
+        }
+    }
+
+    void gemm(size_t M, size_t N, size_t K, const dtype *A, size_t lda, const dtype *B, size_t ldb, dtype *C, size_t ldc)
+    {
+        for (size_t k0=0; k0<K; k0+=KC) {
+            size_t kc = std::min(KC, K - k0);
+            size_t j  = 0;
+            for (; j+NR*W<=N; j+=NR*W) {
+                for (size_t i=0; i<M; i+=MR) {
+                    tile<NR>(std::min(MR, M - i), kc, A + i * lda + k0, lda, B + k0 * ldb + j, ldb, C + i * ldc + j, ldc);
+                }
+            }
+            for (; j+W<=N; j+=W) {
+                for (size_t i=0; i<M; i+=MR) {
+                    tile<1>(std::min(MR, M - i), kc, A + i * lda + k0, lda, B + k0 * ldb + j, ldb, C + i * ldc + j, ldc);
+                }
+            }
+            for (; j<N; ++j) {
+                for (size_t i=0; i<M; ++i) {
+                    dtype sum = 0;
+                    for (size_t k=k0; k<k0+kc; ++k) {
+                        sum += A[i * lda + k] * B[k * ldb + j];
+                    }
+                    C[i * ldc + j] += sum;
+                }
+            }
+        }
+    }
+
+    void gemm(size_t M, size_t N, size_t K, const dtype *A, const dtype *B, dtype *C)
+    {
+        gemm(M, N, K, A, K, B, N, C, N);
+    }
+
+    template<size_t R>
+    static void rowBackward(size_t N, const dtype *a, size_t lda, const dtype *b, const dtype *G, size_t ldg, dtype *da, dtype *db) // one row of B against R rows of G
+    {
+        vtype dot[R];
+        vtype x[R];
+        for (int r=0; r<R; ++r) {
+            dot[r] = vzero();
+            x[r]   = vset1(a[r * lda]);
+        }
+        size_t j = 0;
+        for (; j+W<=N; j+=W) {
+            vtype w  = vload(b + j);
+            vtype gw = vload(db + j);
+            for (int r=0; r<R; ++r) {
+                vtype g = vload(G + r * ldg + j);
+                dot[r] = vfma(w, g, dot[r]);
+                gw     = vfma(x[r], g, gw);
+            }
+            vstore(db + j, gw);
+        }
+        for (int r=0; r<R; ++r) {
+            dtype sum = vsum(dot[r]);
+            for (size_t t=j; t<N; ++t) {
+                sum   += b[t] * G[r * ldg + t];
+                db[t] += a[r * lda] * G[r * ldg + t];
+            }
+            da[r * lda] += sum;
+        }
+    }
+
+    void gemmBackward(size_t M, size_t N, size_t K, const dtype *A, size_t lda, const dtype *B, size_t ldb, const dtype *G, size_t ldg, dtype *dA, dtype *dB)
+    {
+        for (size_t k=0; k<K; ++k) {
+            const dtype *b  = B  + k * ldb;
+            dtype       *db = dB + k * ldb;
+            for (size_t i=0; i<M; i+=MR) {
+                switch (std::min(MR, M - i)) {
+                    case 4 : rowBackward<4>(N, A + i * lda + k, lda, b, G + i * ldg, ldg, dA + i * lda + k, db); break;
+                    case 3 : rowBackward<3>(N, A + i * lda + k, lda, b, G + i * ldg, ldg, dA + i * lda + k, db); break;
+                    case 2 : rowBackward<2>(N, A + i * lda + k, lda, b, G + i * ldg, ldg, dA + i * lda + k, db); break;
+                    case 1 : rowBackward<1>(N, A + i * lda + k, lda, b, G + i * ldg, ldg, dA + i * lda + k, db); break;
+                }
+            }
+        }
+    }
+
+    void gemmBackward(size_t M, size_t N, size_t K, const dtype *A, const dtype *B, const dtype *G, dtype *dA, dtype *dB)
+    {
+        gemmBackward(M, N, K, A, K, B, N, G, N, dA, dB);
+    }
+
+    static vec1<dtype> vandermonde(size_t alpha, size_t n) // [alpha][n]: p^j at the finite points, the leading coefficient at infinity
+    {
+        vec1<dtype> ret(alpha * n, 0);
+        for (size_t i=0; i+1<alpha; ++i) {
+            dtype p = (i % 2 ? 1.0 : -1.0) * (dtype)((i + 1) / 2);
+            dtype x = 1;
+            for (size_t j=0; j<n; ++j) {
+                ret.at(i * n + j) = x;
+                x *= p;
+            }
+        }
+        ret.at((alpha - 1) * n + n - 1) = 1;
+        return ret;
+    }
+
+    Winograd::Winograd (size_t m, size_t r)
+    : m(m), r(r), alpha(m + r - 1)
+    {
+        /* y = AT [(G g) . (BT d)] with AT = V_m^T, G = V_r and BT = V_alpha^-T, which is the
+           transpose of the Toom-Cook linear convolution V_alpha^-1 [(V_m a) . (V_r g)] */
+        vec1<dtype> Vm = vandermonde(alpha, m);
+        AT.resize(m * alpha);
+        for (size_t i=0; i<m; ++i) {
+            for (size_t j=0; j<alpha; ++j) {
+                AT.at(i * alpha + j) = Vm.at(j * m + i);
+            }
+        }
+        G = vandermonde(alpha, r);
+
+        vec1<dtype> V   = vandermonde(alpha, alpha);
+        vec1<dtype> inv(alpha * alpha, 0);
+        for (size_t i=0; i<alpha; ++i) {
+            inv.at(i * alpha + i) = 1;
+        }
+        for (size_t c=0; c<alpha; ++c) { // Gauss-Jordan with partial pivoting
+            size_t pivot = c;
+            for (size_t i=c+1; i<alpha; ++i) {
+                if (std::abs(V.at(i * alpha + c)) > std::abs(V.at(pivot * alpha + c))) {
+                    pivot = i;
+                }
+            }
+            assert (V.at(pivot * alpha + c) != 0);
+            for (size_t j=0; j<alpha; ++j) {
+                std::swap(V.at(c * alpha + j), V.at(pivot * alpha + j));
+                std::swap(inv.at(c * alpha + j), inv.at(pivot * alpha + j));
+            }
+            dtype d = V.at(c * alpha + c);
+            for (size_t j=0; j<alpha; ++j) {
+                V.at(c * alpha + j)   /= d;
+                inv.at(c * alpha + j) /= d;
+            }
+            for (size_t i=0; i<alpha; ++i) {
+                dtype f = V.at(i * alpha + c);
+                if (i == c || f == 0) {
+                    continue;
+                }
+                for (size_t j=0; j<alpha; ++j) {
+                    V.at(i * alpha + j)   -= f * V.at(c * alpha + j);
+                    inv.at(i * alpha + j) -= f * inv.at(c * alpha + j);
+                }
+            }
+        }
+        BT.resize(alpha * alpha);
+        for (size_t i=0; i<alpha; ++i) {
+            for (size_t j=0; j<alpha; ++j) {
+                dtype x = inv.at(j * alpha + i);
+                BT.at(i * alpha + j) = std::abs(x) < 1e-12 ? 0 : x; // exact zeros instead of rounding noise
+            }
+        }
+
+        inputCost  = 4 * alpha * alpha * alpha;
+        outputCost = 2 * (m * alpha * alpha + m * m * alpha);
+        if (alpha == 6) { // rows of BT scaled to small integers, those of G inversely
+            const dtype scale[6]  = {4, -6, -6, 24, 24, 1};
+            const dtype expect[36] = {4,  0, -5,  0, 1, 0,
+                                      0, -4, -4,  1, 1, 0,
+                                      0,  4, -4, -1, 1, 0,
+                                      0, -2, -1,  2, 1, 0,
+                                      0,  2, -1, -2, 1, 0,
+                                      0,  4,  0, -5, 0, 1};
+            for (size_t i=0; i<6; ++i) {
+                for (size_t j=0; j<6; ++j) {
+                    BT.at(i * 6 + j) *= scale[i];
+                    assert (std::abs(BT.at(i * 6 + j) - expect[i * 6 + j]) < 1e-9);
+                    BT.at(i * 6 + j) = expect[i * 6 + j];
+                }
+                for (size_t j=0; j<r; ++j) {
+                    G.at(i * r + j) /= scale[i];
+                }
+            }
+            inputCost  = 12 * 19;
+            outputCost = (6 + m) * (6 + 2 * m);
+        }
+    }
+
+    static void multiply(size_t P, size_t Q, size_t R, const dtype *A, const dtype *B, dtype *C)
+    {
+        for (size_t i=0; i<P; ++i) {
+            for (size_t j=0; j<R; ++j) {
+                C[i * R + j] = 0;
+            }
+            for (size_t t=0; t<Q; ++t) {
+                for (size_t j=0; j<R; ++j) {
+                    C[i * R + j] += A[i * Q + t] * B[t * R + j];
+                }
+            }
+        }
+    }
+
+    static void multiplyT(size_t P, size_t Q, size_t R, const dtype *A, const dtype *B, dtype *C)
+    {
+        for (size_t i=0; i<P; ++i) {
+            for (size_t j=0; j<R; ++j) {
+                dtype sum = 0;
+                for (size_t t=0; t<Q; ++t) {
+                    sum += A[i * Q + t] * B[j * Q + t];
+                }
+                C[i * R + j] = sum;
+            }
+        }
+    }
+
+    void Winograd::transformKernel(const dtype *k, dtype *U) const // once per kernel update, so never specialized
+    {
+        dtype tmp[64];
+        multiply(alpha, r, r, G.data(), k, tmp);
+        multiplyT(alpha, r, alpha, tmp, G.data(), U);
+    }
+
+    /* With six points BT and AT have a fixed sign pattern, which turns each product into a few
+       additions on the pairs (d1, d2) and (d3, d4). s and t are the strides of the input and the output */
+
+    static inline void inputLine6(const dtype *d, size_t s, dtype *v, size_t t) // v = BT d
+    {
+        dtype a = d[4 * s] - 4 * d[2 * s];
+        dtype b = d[3 * s] - 4 * d[1 * s];
+        dtype c = d[4 * s] - d[2 * s];
+        dtype e = 2 * (d[3 * s] - d[1 * s]);
+        v[0]     = 4 * d[0] - 5 * d[2 * s] + d[4 * s];
+        v[t]     = a + b;
+        v[2 * t] = a - b;
+        v[3 * t] = c + e;
+        v[4 * t] = c - e;
+        v[5 * t] = 4 * d[s] - 5 * d[3 * s] + d[5 * s];
+    }
+
+    static inline void outputLine6(size_t m, const dtype *x, size_t s, dtype *y, size_t t) // y = AT x for the first m outputs
+    {
+        dtype sum12  = x[s] + x[2 * s];
+        dtype diff12 = x[s] - x[2 * s];
+        dtype sum34  = x[3 * s] + x[4 * s];
+        dtype diff34 = x[3 * s] - x[4 * s];
+        dtype p = 1;
+        for (size_t i=0; i<m; ++i) {
+            y[i * t] = (i % 2 == 0) ? sum12 + p * sum34 : diff12 + p * diff34;
+            p *= 2;
+        }
+        y[0]           += x[0];
+        y[(m - 1) * t] += x[5 * s];
+    }
+
+    static inline void inputAdjointLine6(const dtype *v, size_t s, dtype *d, size_t t) // d = B v, the transpose of inputLine6
+    {
+        dtype p = v[s] + v[2 * s];
+        dtype q = v[s] - v[2 * s];
+        dtype r = v[3 * s] + v[4 * s];
+        dtype e = v[3 * s] - v[4 * s];
+        d[0]     = 4 * v[0];
+        d[t]     = -4 * q - 2 * e + 4 * v[5 * s];
+        d[2 * t] = -5 * v[0] - 4 * p - r;
+        d[3 * t] = q + 2 * e - 5 * v[5 * s];
+        d[4 * t] = v[0] + p + r;
+        d[5 * t] = v[5 * s];
+    }
+
+    static inline void outputAdjointLine6(size_t m, const dtype *y, size_t s, dtype *x, size_t t) // x = A y, the transpose of outputLine6
+    {
+        dtype even = 0, odd = 0, evenp = 0, oddp = 0, p = 1;
+        for (size_t i=0; i<m; ++i) {
+            if (i % 2 == 0) {
+                even  += y[i * s];
+                evenp += p * y[i * s];
+            } else {
+                odd  += y[i * s];
+                oddp += p * y[i * s];
+            }
+            p *= 2;
+        }
+        x[0]     = y[0];
+        x[t]     = even + odd;
+        x[2 * t] = even - odd;
+        x[3 * t] = evenp + oddp;
+        x[4 * t] = evenp - oddp;
+        x[5 * t] = y[(m - 1) * s];
+    }
+
+    void Winograd::transformInput(const dtype *d, dtype *V, size_t stride) const
+    {
+        dtype tmp[64], out[64];
+        if (alpha == 6) {
+            for (size_t j=0; j<6; ++j) {
+                inputLine6(d + j, 6, tmp + j, 6);
+            }
+            for (size_t i=0; i<6; ++i) {
+                inputLine6(tmp + i * 6, 1, V + i * 6 * stride, stride);
+            }
+            return;
+        }
+        multiply(alpha, alpha, alpha, BT.data(), d, tmp);
+        multiplyT(alpha, alpha, alpha, tmp, BT.data(), out);
+        for (size_t i=0; i<alpha * alpha; ++i) {
+            V[i * stride] = out[i];
+        }
+    }
+
+    void Winograd::transformOutput(const dtype *M, dtype *Y, size_t stride) const
+    {
+        dtype tmp[64], in[64];
+        if (alpha == 6) {
+            for (size_t j=0; j<6; ++j) {
+                outputLine6(m, M + j * stride, 6 * stride, tmp + j, 6);
+            }
+            for (size_t i=0; i<m; ++i) {
+                outputLine6(m, tmp + i * 6, 1, Y + i * m, 1);
+            }
+            return;
+        }
+        for (size_t i=0; i<alpha * alpha; ++i) {
+            in[i] = M[i * stride];
+        }
+        multiply(m, alpha, alpha, AT.data(), in, tmp);
+        multiplyT(m, alpha, m, tmp, AT.data(), Y);
+    }
+
+    static void adjoint(size_t P, size_t Q, const dtype *L, const dtype *X, dtype *Y) // Y[Q][Q] = L^T X[P][P] L with L [P][Q]
+    {
+        dtype tmp[64];
+        for (size_t i=0; i<Q; ++i) {
+            for (size_t j=0; j<P; ++j) {
+                dtype sum = 0;
+                for (size_t t=0; t<P; ++t) {
+                    sum += L[t * Q + i] * X[t * P + j];
+                }
+                tmp[i * P + j] = sum;
+            }
+        }
+        multiply(Q, P, Q, tmp, L, Y);
+    }
+
+    void Winograd::transformInputAdjoint(const dtype *V, dtype *d, size_t stride) const
+    {
+        dtype tmp[64], in[64];
+        if (alpha == 6) {
+            for (size_t j=0; j<6; ++j) {
+                inputAdjointLine6(V + j * stride, 6 * stride, tmp + j, 6);
+            }
+            for (size_t i=0; i<6; ++i) {
+                inputAdjointLine6(tmp + i * 6, 1, d + i * 6, 1);
+            }
+            return;
+        }
+        for (size_t i=0; i<alpha * alpha; ++i) {
+            in[i] = V[i * stride];
+        }
+        adjoint(alpha, alpha, BT.data(), in, d);
+    }
+
+    void Winograd::transformOutputAdjoint(const dtype *Y, dtype *M, size_t stride) const
+    {
+        dtype tmp[64], out[64];
+        if (alpha == 6) {
+            for (size_t j=0; j<m; ++j) {
+                outputAdjointLine6(m, Y + j, m, tmp + j, m);
+            }
+            for (size_t i=0; i<6; ++i) {
+                outputAdjointLine6(m, tmp + i * m, 1, M + i * 6 * stride, stride);
+            }
+            return;
+        }
+        adjoint(m, alpha, AT.data(), Y, out);
+        for (size_t i=0; i<alpha * alpha; ++i) {
+            M[i * stride] = out[i];
+        }
+    }
+
+    void Winograd::transformKernelAdjoint(const dtype *U, dtype *k) const
+    {
+        adjoint(alpha, r, G.data(), U, k);
+    }
+
+    const Winograd& getWinograd(size_t m, size_t r) // built once per shape, shared by every node
+    {
+        assert (m + r - 1 <= 8);
+        static std::mutex lock;
+        static std::map<std::pair<size_t, size_t>, std::unique_ptr<Winograd>> cache;
+        std::lock_guard<std::mutex> guard(lock);
+        std::unique_ptr<Winograd> &ret = cache[std::make_pair(m, r)];
+        if (!ret) {
+            ret.reset(new Winograd(m, r));
+        }
+        return *ret;
+    }
+
+    template<size_t KW, size_t S>
+    static void convolutionRow(const dtype *x, const dtype *k, dtype *y, size_t n) // contiguous outputs a vector at a time, the taps in order
+    {
+        size_t b = 0;
+        if (S == 1) {
+            vtype kj[KW];
+            for (size_t j=0; j<KW; ++j) {
+                kj[j] = vset1(k[j]);
+            }
+            for (; b+W<=n; b+=W) {
+                vtype sum = vload(y + b);
+                for (size_t j=0; j<KW; ++j) {
+                    sum = vfma(kj[j], vload(x + b + j), sum);
+                }
+                vstore(y + b, sum);
+            }
+        }
+        for (; b<n; ++b) {
+            dtype sum = y[b];
+            for (size_t j=0; j<KW; ++j) {
+                sum += k[j] * x[b * S + j];
+            }
+            y[b] = sum;
+        }
+    }
+
+    template<size_t KW, size_t S>
+    static void convolutionRowBackward(const dtype *x, dtype *dx, const dtype *k, dtype *gk, const dtype *g, size_t n)
+    {
+        for (size_t j=0; j<KW; ++j) {
+            dtype kj  = k[j];
+            dtype sum = 0;
+            size_t b  = 0;
+            if (S == 1) {
+                vtype kv  = vset1(kj);
+                vtype dot = vzero();
+                for (; b+W<=n; b+=W) {
+                    vtype gv = vload(g + b);
+                    vstore(dx + b + j, vfma(kv, gv, vload(dx + b + j)));
+                    dot = vfma(vload(x + b + j), gv, dot);
+                }
+                sum = vsum(dot);
+            }
+            for (; b<n; ++b) {
+                dx[b * S + j] += kj * g[b];
+                sum           += x[b * S + j] * g[b];
+            }
+            gk[j] += sum;
+        }
+    }
+
+    template<size_t KH, size_t KW, size_t S>
+    static void maxPoolRow(const dtype *x, int offset, size_t ldx, dtype *y, unsigned int *count, int *first, size_t n)
+    {
+        for (size_t b=0; b<n; ++b) {
+            int   start = offset + (int)(b * S);
+            int   cnt   = 0;
+            int   arg   = -1;
+            dtype max   = std::nan("");
+            for (size_t i=0; i<KH; ++i) {
+                for (size_t j=0; j<KW; ++j) {
+                    dtype d = x[start + i * ldx + j];
+                    if (std::isnan(max) || max < d) {
+                        max = d;
+                        cnt = 1;
+                        arg = start + i * ldx + j;
+                    } else if (max == d) {
+                        ++cnt;
+                    }
+                }
+            }
+            y[b] = max;
+            if (count != nullptr) {
+                count[b] = cnt;
+                first[b] = arg;
+            }
+        }
+    }
+
+    template<size_t KH, size_t KW, size_t S>
+    static void averagePoolRow(const dtype *x, size_t ldx, dtype *y, size_t n)
+    {
+        for (size_t b=0; b<n; ++b) {
+            dtype sum = 0;
+            for (size_t i=0; i<KH; ++i) {
+                for (size_t j=0; j<KW; ++j) {
+                    sum += x[b * S + i * ldx + j];
+                }
+            }
+            y[b] = sum / (KH * KW);
+        }
+    }
+
+    template<size_t KH, size_t KW, size_t S>
+    static void averagePoolRowBackward(dtype *dx, size_t ldx, const dtype *g, size_t n)
+    {
+        for (size_t b=0; b<n; ++b) {
+            dtype ga = g[b] / (KH * KW);
+            for (size_t i=0; i<KH; ++i) {
+                for (size_t j=0; j<KW; ++j) {
+                    dx[b * S + i * ldx + j] += ga;
+                }
+            }
+        }
+    }
+
+    template<size_t KH, size_t KW, size_t S>
+    static const FilterKernels* specialize()
+    {
+        static const FilterKernels ret = { convolutionRow<KW, S>, convolutionRowBackward<KW, S>, maxPoolRow<KH, KW, S>, averagePoolRow<KH, KW, S>, averagePoolRowBackward<KH, KW, S> };
+        return &ret;
+    }
+
+    const FilterKernels* getFilterKernels(size_t kheight, size_t kwidth, size_t stride)
+    {
+        if (kheight == 3 && kwidth == 3 && stride == 1) {
+            return specialize<3, 3, 1>();
+        } else if (kheight == 5 && kwidth == 5 && stride == 1) {
+            return specialize<5, 5, 1>();
+        } else if (kheight == 2 && kwidth == 2 && stride == 2) {
+            return specialize<2, 2, 2>();
+        } else if (kheight == 3 && kwidth == 3 && stride == 2) {
+            return specialize<3, 3, 2>();
+        }
+        return nullptr;
+    }
+
+    size_t fftSize(size_t n)
+    {
+        size_t ret = 1;
+        while (ret < n) {
+            ret *= 2;
+        }
+        return ret;
+    }
+
+    static const vec1<complex>& getTwiddles(size_t n) // exp(-2 pi i k / n) for k < n / 2, built once per size
+    {
+        static std::mutex lock;
+        static std::map<size_t, vec1<complex>> cache;
+        std::lock_guard<std::mutex> guard(lock);
+        vec1<complex> &ret = cache[n];
+        if (ret.empty()) {
+            const dtype pi = std::acos((dtype)-1);
+            ret.resize(std::max<size_t>(1, n / 2));
+            for (size_t k=0; k<n/2; ++k) {
+                ret.at(k) = std::polar((dtype)1, -2 * pi * k / n);
+            }
+        }
+        return ret;
+    }
+
+    static void fft(complex *x, size_t n, const complex *twiddle, bool inverse) // iterative Cooley-Tukey after a bit-reversal permutation
+    {
+        for (size_t i=1, j=0; i<n; ++i) {
+            size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1) {
+                j ^= bit;
+            }
+            j ^= bit;
+            if (i < j) {
+                std::swap(x[i], x[j]);
+            }
+        }
+        for (size_t len=2; len<=n; len*=2) {
+            size_t half = len / 2;
+            size_t step = n / len;
+            for (size_t i=0; i<n; i+=len) {
+                for (size_t k=0; k<half; ++k) {
+                    complex u = x[i + k];
+                    complex v = inverse ? cmulConj(x[i + k + half], twiddle[k * step]) : cmul(x[i + k + half], twiddle[k * step]);
+                    x[i + k]        = u + v;
+                    x[i + k + half] = u - v;
+                }
+            }
+        }
+        if (inverse) {
+            dtype scale = (dtype)1 / n;
+            for (size_t i=0; i<n; ++i) {
+                x[i] *= scale;
+            }
+        }
+    }
+
+    void fft(complex *x, size_t n, bool inverse)
+    {
+        assert ((n & (n - 1)) == 0);
+        fft(x, n, getTwiddles(n).data(), inverse);
+    }
+
+    static void fftColumns(complex *x, size_t rows, size_t cols, const complex *twiddle, bool inverse) // every column of x[rows][cols] at once
+    {
+        /* One row of butterflies at a time, so that every access is contiguous and vectorizable */
+        for (size_t i=1, j=0; i<rows; ++i) {
+            size_t bit = rows >> 1;
+            for (; j & bit; bit >>= 1) {
+                j ^= bit;
+            }
+            j ^= bit;
+            if (i < j) {
+                std::swap_ranges(x + i * cols, x + (i + 1) * cols, x + j * cols);
+            }
+        }
+        for (size_t len=2; len<=rows; len*=2) {
+            size_t half = len / 2;
+            size_t step = rows / len;
+            for (size_t i=0; i<rows; i+=len) {
+                for (size_t k=0; k<half; ++k) {
+                    complex  w = inverse ? std::conj(twiddle[k * step]) : twiddle[k * step];
+                    complex *u = x + (i + k) * cols;
+                    complex *v = x + (i + k + half) * cols;
+                    for (size_t j=0; j<cols; ++j) {
+                        complex t = cmul(v[j], w);
+                        v[j] = u[j] - t;
+                        u[j] = u[j] + t;
+                    }
+                }
+            }
+        }
+        if (inverse) {
+            dtype scale = (dtype)1 / rows;
+            for (size_t i=0; i<rows * cols; ++i) {
+                x[i] *= scale;
+            }
+        }
+    }
+
+    void rfft2d(const dtype *x, size_t height, size_t width, complex *X, size_t rows, size_t cols)
+    {
+        /* Each row is a transform of half the length over z[k] = x[2k] + i x[2k+1], then X[k] = E[k] +
+           w^k O[k] with E and O those of the even and odd samples. The padding rows stay 0 until the columns */
+        assert ((rows & (rows - 1)) == 0 && (cols & (cols - 1)) == 0 && cols >= 2);
+        assert (height <= rows && width <= cols);
+        size_t h = cols / 2;
+        size_t W = h + 1;
+        vec1<complex> t(h * height);
+        for (size_t i=0; i<height; ++i) {
+            for (size_t k=0; k<h; ++k) {
+                dtype re = (2 * k     < width) ? x[i * width + 2 * k]     : 0;
+                dtype im = (2 * k + 1 < width) ? x[i * width + 2 * k + 1] : 0;
+                t[k * height + i] = complex(re, im);
+            }
+        }
+        fftColumns(t.data(), h, height, getTwiddles(h).data(), false);
+
+        const complex *w = getTwiddles(cols).data();
+        for (size_t i=0; i<height; ++i) {
+            for (size_t k=0; k<=h; ++k) {
+                complex z = t[(k % h) * height + i];
+                complex c = std::conj(t[((h - k) % h) * height + i]);
+                complex E = (z + c) * (dtype)0.5;
+                complex O = (z - c) * complex(0, -0.5);
+                X[i * W + k] = E + cmul(k < h ? w[k] : complex(-1), O);
+            }
+        }
+        std::fill(X + height * W, X + rows * W, complex(0));
+        fftColumns(X, rows, W, getTwiddles(rows).data(), false);
+    }
+
+    void irfft2d(complex *X, size_t rows, size_t cols, dtype *x) // the steps of rfft2d in reverse
+    {
+        assert ((rows & (rows - 1)) == 0 && (cols & (cols - 1)) == 0 && cols >= 2);
+        size_t h = cols / 2;
+        size_t W = h + 1;
+        fftColumns(X, rows, W, getTwiddles(rows).data(), true);
+
+        const complex *w = getTwiddles(cols).data();
+        vec1<complex> t(h * rows);
+        for (size_t i=0; i<rows; ++i) {
+            for (size_t k=0; k<h; ++k) {
+                complex a = X[i * W + k];
+                complex c = std::conj(X[i * W + h - k]);
+                complex E = (a + c) * (dtype)0.5;
+                complex O = cmulConj((a - c) * (dtype)0.5, w[k]);
+                t[k * rows + i] = E + complex(-O.imag(), O.real());
+            }
+        }
+        fftColumns(t.data(), h, rows, getTwiddles(h).data(), true);
+        for (size_t i=0; i<rows; ++i) {
+            for (size_t k=0; k<h; ++k) {
+                x[i * cols + 2 * k]     = t[k * rows + i].real();
+                x[i * cols + 2 * k + 1] = t[k * rows + i].imag();
+            }
+        }
+    }
+
+    static std::atomic<MathMode> mathMode(MathMode::Fast);
+
+    void setMathMode(MathMode mode)
+    {
+        mathMode = mode;
+    }
+
+    MathMode getMathMode()
+    {
+        return mathMode;
+    }
+
+    static const dtype LN2HI = 6.93147180369123816490e-01; // ln 2 split so that k LN2HI is exact for |k| < 2^11
+    static const dtype LN2LO = 1.90821492927058770002e-10;
+
+    static inline vtype reduce(vtype x, vtype &k) // x = k ln 2 + r with |r| <= ln 2 / 2
+    {
+        k = vround(vmul(x, vset1(1.44269504088896338700)));
+        return vfma(k, vset1(-LN2LO), vfma(k, vset1(-LN2HI), x));
+    }
+
+    static inline vtype expm1Taylor(vtype r) // exp(r) - 1 to degree 13, below half an ulp on |r| <= ln 2 / 2
+    {
+        vtype p = vset1(1.0 / 6227020800);
+        const dtype c[12] = {1.0 / 479001600, 1.0 / 39916800, 1.0 / 3628800, 1.0 / 362880, 1.0 / 40320, 1.0 / 5040
+                           , 1.0 / 720, 1.0 / 120, 1.0 / 24, 1.0 / 6, 1.0 / 2, 1.0};
+        for (int i=0; i<12; ++i) {
+            p = vfma(p, r, vset1(c[i]));
+        }
+        return vmul(p, r);
+    }
+
+    static inline vtype expFast(vtype x)
+    {
+        x = vmin(vmax(x, vset1(-708.0)), vset1(709.0));
+        vtype k;
+        vtype r = reduce(x, k);
+        return vmul(vadd(expm1Taylor(r), vset1(1)), vpow2(k));
+    }
+
+    static inline vtype expm1Fast(vtype x) // 2^k (exp(r) - 1) + 2^k - 1, exact in r near 0; x in [-708, 709]
+    {
+        vtype k;
+        vtype r = reduce(x, k);
+        vtype s = vpow2(k);
+        return vfma(s, expm1Taylor(r), vsub(s, vset1(1)));
+    }
+
+    static inline vtype logFast(vtype x) // log(1 + f) = 2 atanh(f / (2 + f)) as in fdlibm
+    {
+        vtype e = vexponent(vmul(x, vset1(1.41421356237309504880)));
+        vtype f = vsub(vmul(x, vpow2(vsub(vzero(), e))), vset1(1)); // exact
+        vtype s = vdiv(f, vadd(vset1(2), f));
+        vtype z = vmul(s, s); // below 0.0295
+        vtype R = vset1(2.0 / 23);
+        for (int j=10; j>=1; --j) {
+            R = vfma(R, z, vset1(2.0 / (2 * j + 1)));
+        }
+        R = vmul(R, z);
+        vtype hfsq = vmul(vset1(0.5), vmul(f, f));
+        vtype tail = vfma(s, vadd(hfsq, R), vmul(e, vset1(LN2LO)));
+        return vfma(e, vset1(LN2HI), vsub(f, vsub(hfsq, tail)));
+    }
+
+    static inline vtype tanhFast(vtype x) // t / (t + 2) with t = exp(2x) - 1, tanh is 1 in double beyond 20
+    {
+        vtype t = expm1Fast(vmul(vset1(2), vmin(vmax(x, vset1(-20.0)), vset1(20.0))));
+        return vdiv(t, vadd(t, vset1(2)));
+    }
+
+    static inline vtype sigmoidFast(vtype x)
+    {
+        return vdiv(vset1(1), vadd(vset1(1), expFast(vsub(vzero(), x))));
+    }
+
+    template<vtype (*F)(vtype)>
+    static void apply(const dtype *x, dtype *y, size_t n) // the tail goes through a padded vector
+    {
+        size_t i = 0;
+        for (; i+W<=n; i+=W) {
+            vstore(y + i, F(vload(x + i)));
+        }
+        if (i < n) {
+            dtype buffer[W];
+            std::fill(buffer, buffer + W, 1);
+            std::copy(x + i, x + n, buffer);
+            vstore(buffer, F(vload(buffer)));
+            std::copy(buffer, buffer + (n - i), y + i);
+        }
+    }
+
+    void vexp(const dtype *x, dtype *y, size_t n)
+    {
+        if (mathMode == MathMode::Fast) {
+            apply<expFast>(x, y, n);
+        } else {
+            for (size_t i=0; i<n; ++i) {
+                y[i] = std::exp(x[i]);
+            }
+        }
+    }
+
+    void vlog(const dtype *x, dtype *y, size_t n)
+    {
+        if (mathMode == MathMode::Fast) {
+            apply<logFast>(x, y, n);
+        } else {
+            for (size_t i=0; i<n; ++i) {
+                y[i] = std::log(x[i]);
+            }
+        }
+    }
+
+    void vtanh(const dtype *x, dtype *y, size_t n)
+    {
+        if (mathMode == MathMode::Fast) {
+            apply<tanhFast>(x, y, n);
+        } else {
+            for (size_t i=0; i<n; ++i) {
+                y[i] = std::tanh(x[i]);
+            }
+        }
+    }
+
+    void vsigmoid(const dtype *x, dtype *y, size_t n)
+    {
+        if (mathMode == MathMode::Fast) {
+            apply<sigmoidFast>(x, y, n);
+        } else {
+            for (size_t i=0; i<n; ++i) {
+                y[i] = 1 / (1 + std::exp(-x[i]));
+            }
+        }
+    }
+
+    const char* instructionSet()
+    {
+#if defined(__AVX512F__)
+        return "AVX-512";
+#elif defined(__AVX2__) && defined(__FMA__)
+        return "AVX2";
+#else
+        return "scalar";
+#endif
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef CGK_HPP
+#define CGK_HPP
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+#include "Type.hpp"
+
+namespace CGK
+{
+    template<typename T> using vec1 = type::vec1<T>;
+    using dtype = type::dtype;
+    using complex = std::complex<dtype>;
+
+    /* Dense kernels on row-major contiguous matrices, vectorized with AVX-512 or AVX2+FMA when the
+       compiler targets them (e.g. -march=native) and plain loops otherwise. All of them accumulate. */
+
+    // C[M][N] += A[M][K] B[K][N]
+    void gemm(size_t M, size_t N, size_t K, const dtype *A, const dtype *B, dtype *C);
+
+    // dA[M][K] += G[M][N] B^T and dB[K][N] += A^T G[M][N], in a single pass over B and dB
+    void gemmBackward(size_t M, size_t N, size_t K, const dtype *A, const dtype *B, const dtype *G, dtype *dA, dtype *dB);
+
+    // the same on sub-matrices, whose rows are lda, ldb, ldc and ldg apart
+    void gemm(size_t M, size_t N, size_t K, const dtype *A, size_t lda, const dtype *B, size_t ldb, dtype *C, size_t ldc);
+    void gemmBackward(size_t M, size_t N, size_t K, const dtype *A, size_t lda, const dtype *B, size_t ldb, const dtype *G, size_t ldg, dtype *dA, dtype *dB);
+
+    const char* instructionSet();
+
+    /* Element-wise transcendentals, y may alias x. Exact calls the standard library per element;
+       Fast evaluates polynomials a vector at a time. Maximum errors of Fast against a long double
+       reference, measured on 2^22 points with and without FMA (NN/CGGtest/Benchmark/Math.cpp):
+           vexp      x in [-708, 709]   1.5 ulp   (x is clamped to that range)
+           vlog      positive normal x  1   ulp
+           vtanh     any x              3   ulp
+           vsigmoid  any x              2.5 ulp                                                     */
+    enum class MathMode { Exact, Fast };
+
+    void setMathMode(MathMode mode); // Fast by default
+    MathMode getMathMode();
+
+    void vexp(const dtype *x, dtype *y, size_t n);
+    void vlog(const dtype *x, dtype *y, size_t n);
+    void vtanh(const dtype *x, dtype *y, size_t n);
+    void vsigmoid(const dtype *x, dtype *y, size_t n);
+
+    class Winograd // F(m x m, r x r) correlation by Toom-Cook on the points 0, 1, -1, 2, -2, ... and infinity
+    {
+        public :
+            const size_t m;
+            const size_t r;
+            const size_t alpha; // m + r - 1, the tile size
+            vec1<dtype>  AT;    // [m][alpha]
+            vec1<dtype>  G;     // [alpha][r]
+            vec1<dtype>  BT;    // [alpha][alpha]
+            size_t       inputCost;  // arithmetic operations of transformInput
+            size_t       outputCost; // arithmetic operations of transformOutput
+
+            Winograd (size_t m, size_t r);
+
+            /* Element i of a transformed tile is at V[i * stride] */
+            void transformKernel(const dtype *k, dtype *U) const;  // U = G k G^T, k is [r][r]
+            void transformInput(const dtype *d, dtype *V, size_t stride = 1) const;  // V = BT d B, d is [alpha][alpha]
+            void transformOutput(const dtype *M, dtype *Y, size_t stride = 1) const; // Y = AT M A, Y is [m][m]
+
+            /* Adjoints, for the gradients */
+            void transformInputAdjoint(const dtype *V, dtype *d, size_t stride = 1) const;  // d = B V BT
+            void transformOutputAdjoint(const dtype *Y, dtype *M, size_t stride = 1) const; // M = A Y AT
+            void transformKernelAdjoint(const dtype *U, dtype *k) const; // k = G^T U G
+    };
+
+    const Winograd& getWinograd(size_t m, size_t r);
+
+    /* Loops over the interior of a filter, where every tap of the window is inside the input, compiled
+       for a fixed kernel height, width and stride so that the taps unroll (NN/CGGtest/Benchmark/
+       Specialized.cpp). n outputs are S apart in the input, whose rows are ldx apart */
+    struct FilterKernels
+    {
+        void (*convolution)(const dtype *x, const dtype *k, dtype *y, size_t n); // y[b] += sum_j k[j] x[b*S + j], one row of the kernel
+        void (*convolutionBackward)(const dtype *x, dtype *dx, const dtype *k, dtype *gk, const dtype *g, size_t n); // dx[b*S + j] += k[j] g[b] and gk[j] += sum_b x[b*S + j] g[b]
+        void (*maxPool)(const dtype *x, int offset, size_t ldx, dtype *y, unsigned int *count, int *first, size_t n); // ties counted into count unless it is nullptr
+        void (*averagePool)(const dtype *x, size_t ldx, dtype *y, size_t n);
+        void (*averagePoolBackward)(dtype *dx, size_t ldx, const dtype *g, size_t n);
+    };
+
+    const FilterKernels* getFilterKernels(size_t kheight, size_t kwidth, size_t stride); // nullptr for other shapes
+
+    /* Radix-2 FFT, unnormalized forward and scaled by 1/n inverse, so that ifft(fft(x)) = x */
+    inline complex cmul(complex a, complex b) // a b without the inf/nan recovery of operator*
+    {
+        return complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+    }
+    inline complex cmulConj(complex a, complex b) // a conj(b)
+    {
+        return complex(a.real() * b.real() + a.imag() * b.imag(), a.imag() * b.real() - a.real() * b.imag());
+    }
+
+    size_t fftSize(size_t n); // smallest power of two not below n
+    void fft(complex *x, size_t n, bool inverse);
+
+    /* 2-D transforms of real planes, which keep the half spectrum X[rows][cols / 2 + 1] */
+    void rfft2d(const dtype *x, size_t height, size_t width, complex *X, size_t rows, size_t cols); // x[height][width] zero-padded to rows x cols
+    void irfft2d(complex *X, size_t rows, size_t cols, dtype *x); // x[rows][cols], X is overwritten
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <vector>
+#include "Type.hpp"
+#include "CG.hpp"
+#include "CGmemory.hpp"
+
+namespace CGM
+{
+    MemoryPlan::MemoryPlan (vec1<CG::Node*> steps)
+    : steps(steps)
+    {
+        std::map<CG::Node*, size_t> index;
+        for (int i=0; i<steps.size(); ++i) {
+            index[steps.at(i)] = i;
+        }
+
+        lastUse.resize(steps.size());
+        for (int i=0; i<steps.size(); ++i) {
+            lastUse.at(i) = i;
+            for (int c=0; c<steps.at(i)->backward.size(); ++c) {
+                size_t j = index.at(steps.at(i)->backward.at(c));
+                lastUse.at(j) = i;
+            }
+        }
+        lastUse.back() = steps.size(); // the result is read after the plan
+
+        /* Inputs are written before the plan runs, so they are placed first */
+        vec1<size_t> order;
+        for (int i=0; i<steps.size(); ++i) {
+            if (steps.at(i)->backward.empty()) {
+                order.push_back(i);
+            }
+        }
+        for (int i=0; i<steps.size(); ++i) {
+            if (!steps.at(i)->backward.empty()) {
+                order.push_back(i);
+            }
+        }
+
+        /* Greedy best fit: a slot is free once the last reader of its current node has run.
+           Times are shifted by one so that inputs are live before step 0 */
+        vec1<size_t> size; // largest dsize placed in each slot
+        vec1<size_t> busy; // time until which each slot is in use
+        slot.resize(steps.size());
+        for (int k=0; k<order.size(); ++k) {
+            size_t i     = order.at(k);
+            size_t start = steps.at(i)->backward.empty() ? 0 : i + 1;
+            size_t need  = steps.at(i)->dsize;
+            int    best  = -1;
+            for (int s=0; s<size.size(); ++s) {
+                if (busy.at(s) >= start) {
+                    continue;
+                }
+                if (best < 0) {
+                    best = s;
+                } else if (size.at(best) < need) { // prefer a slot that fits, then the largest
+                    if (size.at(s) > size.at(best)) {
+                        best = s;
+                    }
+                } else if (need <= size.at(s) && size.at(s) < size.at(best)) { // then the tightest
+                    best = s;
+                }
+            }
+            if (best < 0) {
+                best = size.size();
+                size.push_back(0);
+                busy.push_back(0);
+            }
+            slot.at(i) = best;
+            size.at(best) = std::max(size.at(best), need);
+            busy.at(best) = lastUse.at(i) + 1;
+        }
+        arena.resize(size.size());
+    }
+
+    void MemoryPlan::apply() // repeat after the batch size or time steps change
+    {
+        vec1<size_t> size(arena.size(), 0);
+        for (int i=0; i<steps.size(); ++i) {
+            assert (steps.at(i)->inference);
+            size.at(slot.at(i)) = std::max(size.at(slot.at(i)), steps.at(i)->data.numel());
+        }
+        for (int s=0; s<arena.size(); ++s) {
+            if (arena.at(s).numel() < size.at(s)) {
+                arena.at(s).reshape({size.at(s)});
+            }
+        }
+        for (int i=0; i<steps.size(); ++i) {
+            CG::Tensor &data = steps.at(i)->data;
+            data.view(arena.at(slot.at(i)), data.shape);
+        }
+    }
+
+    void MemoryPlan::release() // every node gets back a private copy of its data
+    {
+        for (int i=0; i<steps.size(); ++i) {
+            steps.at(i)->data = CG::Tensor(steps.at(i)->data);
+        }
+        arena.assign(arena.size(), CG::Tensor());
+    }
+
+    size_t MemoryPlan::naiveBytes()
+    {
+        size_t ret = 0;
+        for (int i=0; i<steps.size(); ++i) {
+            ret += steps.at(i)->data.numel() * sizeof(dtype);
+        }
+        return ret;
+    }
+
+    size_t MemoryPlan::plannedBytes()
+    {
+        vec1<size_t> size(arena.size(), 0);
+        for (int i=0; i<steps.size(); ++i) {
+            size.at(slot.at(i)) = std::max(size.at(slot.at(i)), steps.at(i)->data.numel());
+        }
+        size_t ret = 0;
+        for (int s=0; s<size.size(); ++s) {
+            ret += size.at(s) * sizeof(dtype);
+        }
+        return ret;
+    }
+}
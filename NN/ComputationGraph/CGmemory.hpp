@@ -0,0 +1,31 @@
+#ifndef CGM_HPP
+#define CGM_HPP
+
+#include <vector>
+#include "Type.hpp"
+#include "CG.hpp"
+
+namespace CGM
+{
+    template<typename T> using vec1 = type::vec1<T>;
+    using dtype = type::dtype;
+
+    class MemoryPlan // inference only: nodes with disjoint lifetimes share a slot
+    {
+        public :
+            vec1<CG::Node*>   steps;   // sequential execution order
+            vec1<size_t>      lastUse; // last step that reads the data of each step
+            vec1<size_t>      slot;    // arena slot of each step
+            vec1<CG::Tensor>  arena;
+
+            MemoryPlan (vec1<CG::Node*> steps);
+
+            void apply();
+            void release();
+
+            size_t naiveBytes();
+            size_t plannedBytes();
+    };
+}
+
+#endif
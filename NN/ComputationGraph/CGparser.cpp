@@ -75,6 +75,18 @@ namespace CGP
             ret = new CG::Concatenation(nodes);
             i2p[id] = ret;
             return ret;
+        } else if (token == "Channel") {
+            size_t index;
+            *in >> token;
+            assert (token == "back");
+            *in >> id1;
+            assert (i2p.find(id1) != i2p.end());
+            *in >> token;
+            assert (token == "index");
+            *in >> index;
+            ret = new CG::Channel(i2p[id1], index);
+            i2p[id] = ret;
+            return ret;
         } else if (token == "Add") {
             *in >> token;
             assert (token == "back");
@@ -125,6 +137,16 @@ namespace CGP
             ret = new CG::CEE(i2p[id1], i2p[id2]);
             i2p[id] = ret;
             return ret;
+        } else if (token == "SoftmaxCrossEntropy") {
+            *in >> token;
+            assert (token == "back");
+            *in >> id1;
+            *in >> id2;
+            assert (i2p.find(id1) != i2p.end());
+            assert (i2p.find(id2) != i2p.end());
+            ret = new CG::SoftmaxCrossEntropy(i2p[id1], i2p[id2]);
+            i2p[id] = ret;
+            return ret;
         } else if (token == "ReLU") {
             *in >> token;
             assert (token == "back");
@@ -237,6 +259,76 @@ namespace CGP
             CG::Convolution2d *ret1 = new CG::Convolution2d(nodes, k, b, s, pt, pl, h, w);
             i2p[id] = ret1;
             return ret1;
+        } else if (token == "MultiConvolution2d" || token == "GroupedConvolution2d") { // a grouped one lists only the kernels of its connected pairs
+            bool   grouped = token == "GroupedConvolution2d";
+            size_t co, ci, h, w;
+            size_t s, pt, pl, kh, kw;
+            int    masked;
+            vec1<CG::Node*> nodes;
+
+            *in >> token;
+            assert (token == "back");
+            std::getline(*in, buffer); // one id per input
+            std::stringstream ids(buffer);
+            while (ids >> id1) {
+                assert (i2p.find(id1) != i2p.end());
+                nodes.push_back(i2p[id1]);
+            }
+            *in >> token;
+            assert (token == "channel");
+            *in >> co >> ci;
+            *in >> token;
+            assert (token == "data");
+            *in >> h >> w;
+            *in >> token;
+            assert (token == "stride");
+            *in >> s;
+            *in >> token;
+            assert (token == "padding");
+            *in >> pt >> pl;
+            *in >> token;
+            assert (token == "bias");
+            CG::Tensor b(vec1<size_t>{co});
+            for (int o=0; o<co; ++o) {
+                *in >> b.data()[o];
+            }
+            *in >> token;
+            if (grouped) {
+                assert (token == "connection");
+                masked = 1;
+            } else {
+                assert (token == "mask");
+                *in >> masked;
+            }
+            CG::Tensor m;
+            if (masked) {
+                m = CG::Tensor({co, ci});
+                for (int i=0; i<co*ci; ++i) {
+                    *in >> m.data()[i];
+                }
+            }
+            *in >> token;
+            assert (token == "kernel");
+            *in >> kh >> kw;
+            CG::Tensor k({co, ci, kh, kw});
+            for (int o=0; o<co; ++o) {
+                for (int c=0; c<ci; ++c) {
+                    if (grouped && m.at(o, c) == 0) {
+                        continue;
+                    }
+                    for (int i=0; i<kh*kw; ++i) {
+                        *in >> k.data(o)[c * kh * kw + i];
+                    }
+                }
+            }
+            CG::MultiConvolution2d *ret1;
+            if (grouped) {
+                ret1 = new CG::GroupedConvolution2d(nodes, k, b, m, s, pt, pl, h, w);
+            } else {
+                ret1 = new CG::MultiConvolution2d(nodes, k, b, m, s, pt, pl, h, w);
+            }
+            i2p[id] = ret1;
+            return ret1;
         } else if (token == "MaxPooling2d") {
             size_t h, w;
             size_t s, pt, pl, kh, kw;
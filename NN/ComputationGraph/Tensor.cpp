@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+#include "Tensor.hpp"
+#include "Type.hpp"
+
+namespace type
+{
+    Span::Span (dtype *ptr, size_t length)
+    : ptr(ptr), length(length){}
+
+    size_t Span::size() const
+    {
+        return length;
+    }
+
+    dtype* Span::data() const
+    {
+        return ptr;
+    }
+
+    dtype* Span::begin() const
+    {
+        return ptr;
+    }
+
+    dtype* Span::end() const
+    {
+        return ptr + length;
+    }
+
+    dtype& Span::at(size_t index) const
+    {
+        assert (index < length);
+        return ptr[index];
+    }
+
+    dtype& Span::operator[](size_t index) const
+    {
+        return ptr[index];
+    }
+
+    Span::operator vec1<dtype>() const
+    {
+        return vec1<dtype>(ptr, ptr + length);
+    }
+
+
+
+    std::shared_ptr<dtype> allocate(size_t size) // zero-initialized
+    {
+        if (size == 0) {
+            return nullptr;
+        }
+        dtype *p = static_cast<dtype*>(::operator new(size * sizeof(dtype), std::align_val_t(Tensor::alignment)));
+        std::memset(p, 0, size * sizeof(dtype));
+        return std::shared_ptr<dtype>(p, [](dtype *q){ ::operator delete(q, std::align_val_t(Tensor::alignment)); });
+    }
+
+    vec1<size_t> getStrides(vec1<size_t> shape)
+    {
+        vec1<size_t> ret(shape.size());
+        size_t s = 1;
+        for (int i=(int)shape.size()-1; i>=0; --i) {
+            ret.at(i) = s;
+            s *= shape.at(i);
+        }
+        return ret;
+    }
+
+    Tensor::Tensor (){}
+
+    Tensor::Tensor (vec1<size_t> shape)
+    {
+        reshape(shape);
+    }
+
+    Tensor::Tensor (const vec2<dtype> &values)
+    : Tensor ({values.size(), values.at(0).size()})
+    {
+        for (int i=0; i<shape.at(0); ++i) {
+            assert (values.at(i).size() == shape.at(1));
+            for (int j=0; j<shape.at(1); ++j) {
+                at(i, j) = values.at(i).at(j);
+            }
+        }
+    }
+
+    Tensor::Tensor (const vec3<dtype> &values)
+    : Tensor ({values.size(), values.at(0).size(), values.at(0).at(0).size()})
+    {
+        for (int i=0; i<shape.at(0); ++i) {
+            assert (values.at(i).size() == shape.at(1));
+            for (int j=0; j<shape.at(1); ++j) {
+                assert (values.at(i).at(j).size() == shape.at(2));
+                for (int k=0; k<shape.at(2); ++k) {
+                    at(i, j, k) = values.at(i).at(j).at(k);
+                }
+            }
+        }
+    }
+
+    Tensor::Tensor (const Tensor &tensor) // deep copy
+    {
+        *this = tensor;
+    }
+
+    Tensor::Tensor (Tensor &&tensor)
+    {
+        *this = std::move(tensor);
+    }
+
+    Tensor& Tensor::operator=(const Tensor &tensor)
+    {
+        if (this == &tensor) {
+            return *this;
+        }
+        shape    = tensor.shape;
+        strides  = tensor.strides;
+        capacity = tensor.numel();
+        storage  = allocate(capacity);
+        ptr      = storage.get();
+        if (capacity != 0) {
+            std::memcpy(ptr, tensor.ptr, capacity * sizeof(dtype));
+        }
+        return *this;
+    }
+
+    Tensor& Tensor::operator=(Tensor &&tensor)
+    {
+        shape    = std::move(tensor.shape);
+        strides  = std::move(tensor.strides);
+        storage  = std::move(tensor.storage);
+        ptr      = tensor.ptr;
+        capacity = tensor.capacity;
+        tensor.ptr      = nullptr;
+        tensor.capacity = 0;
+        return *this;
+    }
+
+    size_t Tensor::rank() const
+    {
+        return shape.size();
+    }
+
+    size_t Tensor::size() const
+    {
+        return (rank() == 0) ? 0 : shape.at(0);
+    }
+
+    size_t Tensor::size(size_t axis) const
+    {
+        return shape.at(axis);
+    }
+
+    size_t Tensor::stride(size_t axis) const
+    {
+        return strides.at(axis);
+    }
+
+    size_t Tensor::numel() const
+    {
+        size_t ret = (rank() == 0) ? 0 : 1;
+        for (int i=0; i<rank(); ++i) {
+            ret *= shape.at(i);
+        }
+        return ret;
+    }
+
+    dtype* Tensor::data() const
+    {
+        return ptr;
+    }
+
+    dtype* Tensor::data(size_t index) const
+    {
+        assert (index < size());
+        return ptr + index * strides.at(0);
+    }
+
+    Span Tensor::at(size_t index) const
+    {
+        return Span(data(index), strides.at(0));
+    }
+
+    dtype& Tensor::at(size_t i, size_t j) const
+    {
+        assert (rank() == 2 && i < shape.at(0) && j < shape.at(1));
+        return ptr[i * strides.at(0) + j];
+    }
+
+    dtype& Tensor::at(size_t i, size_t j, size_t k) const
+    {
+        assert (rank() == 3 && i < shape.at(0) && j < shape.at(1) && k < shape.at(2));
+        return ptr[i * strides.at(0) + j * strides.at(1) + k];
+    }
+
+    void Tensor::resize(size_t length) // change the leading dimension, keeping the contents
+    {
+        assert (rank() > 0);
+        size_t required = length * strides.at(0);
+        if (capacity < required) {
+            size_t grown = std::max(required, 2 * capacity);
+            std::shared_ptr<dtype> next = allocate(grown);
+            if (numel() != 0) {
+                std::memcpy(next.get(), ptr, numel() * sizeof(dtype));
+            }
+            storage  = next;
+            ptr      = storage.get();
+            capacity = grown;
+        } else if (length < shape.at(0)) {
+            std::memset(ptr + required, 0, (numel() - required) * sizeof(dtype));
+        }
+        shape.at(0) = length;
+    }
+
+    void Tensor::reshape(vec1<size_t> shape) // contents are reset to zero
+    {
+        this->shape = shape;
+        strides  = getStrides(shape);
+        capacity = numel();
+        storage  = allocate(capacity);
+        ptr      = storage.get();
+    }
+
+    void Tensor::fill(dtype value)
+    {
+        size_t n = numel();
+        for (size_t i=0; i<n; ++i) {
+            ptr[i] = value;
+        }
+    }
+
+    void Tensor::share(const Tensor &tensor) // alias the storage of another tensor
+    {
+        shape    = tensor.shape;
+        strides  = tensor.strides;
+        storage  = tensor.storage;
+        ptr      = tensor.ptr;
+        capacity = tensor.capacity;
+    }
+
+    void Tensor::view(const Tensor &tensor, vec1<size_t> shape) // alias the front of tensor with a new shape
+    {
+        view(tensor, shape, 0);
+    }
+
+    void Tensor::view(const Tensor &tensor, vec1<size_t> shape, size_t offset) // alias a contiguous range of tensor
+    {
+        this->shape = shape;
+        strides  = getStrides(shape);
+        capacity = numel(); // growing past the view makes a private copy
+        assert (offset + capacity <= tensor.capacity);
+        storage  = tensor.storage;
+        ptr      = tensor.ptr + offset;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef TENSOR_HPP
+#define TENSOR_HPP
+
+#include <cassert>
+#include <memory>
+#include <vector>
+#include "Type.hpp"
+
+namespace type
+{
+    class Span // non-owning view of a contiguous range
+    {
+        public :
+            dtype  *ptr;
+            size_t  length;
+
+            Span (dtype *ptr, size_t length);
+
+            size_t size() const;
+            dtype* data() const;
+            dtype* begin() const;
+            dtype* end() const;
+
+            dtype& at(size_t index) const;
+            dtype& operator[](size_t index) const;
+
+            operator vec1<dtype>() const;
+    };
+
+    class Tensor // row-major, single aligned allocation
+    {
+        public :
+            static const size_t alignment = 64;
+
+            vec1<size_t>           shape;
+            vec1<size_t>           strides;
+            std::shared_ptr<dtype> storage;
+            dtype                 *ptr      = nullptr;
+            size_t                 capacity = 0;
+
+            Tensor ();
+            Tensor (vec1<size_t> shape);
+            Tensor (const vec2<dtype> &values);
+            Tensor (const vec3<dtype> &values);
+            Tensor (const Tensor &tensor);
+            Tensor (Tensor &&tensor);
+
+            Tensor& operator=(const Tensor &tensor);
+            Tensor& operator=(Tensor &&tensor);
+
+            size_t rank() const;
+            size_t size() const;
+            size_t size(size_t axis) const;
+            size_t stride(size_t axis) const;
+            size_t numel() const;
+
+            dtype* data() const;
+            dtype* data(size_t index) const;
+
+            Span   at(size_t index) const;
+            dtype& at(size_t i, size_t j) const;
+            dtype& at(size_t i, size_t j, size_t k) const;
+
+            void resize(size_t length);
+            void reshape(vec1<size_t> shape);
+            void fill(dtype value);
+            void share(const Tensor &tensor);
+            void view(const Tensor &tensor, vec1<size_t> shape);
+            void view(const Tensor &tensor, vec1<size_t> shape, size_t offset);
+    };
+}
+
+#endif
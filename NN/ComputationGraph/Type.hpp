@@ -1,6 +1,8 @@
 #ifndef TYPE_HPP
 #define TYPE_HPP
 
+#include <vector>
+
 namespace type
 {
     template<typename T> using vec1 = std::vector<T>;